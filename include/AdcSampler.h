@@ -0,0 +1,46 @@
+#ifndef ADC_SAMPLER_H
+#define ADC_SAMPLER_H
+
+#include <Arduino.h>
+#include "Filter.h"
+
+#define ADC_SAFETY_SAMPLES  16      // Current/voltage pairs per safety reading, followed by one throttle conversion
+#define ADC_OVERSAMPLE_BITS 2       // Default extra bits, 4^bits pairs averaged into one block
+#define ADC_OVERSAMPLE_MIN  1       // 4 pairs, ~1.2k blocks/s
+#define ADC_OVERSAMPLE_MAX  4       // 256 pairs, ~18 blocks/s; sums stay below 2^18 so Q4 averages fit 32 bits
+#define ADC_QUEUE_SIZE      8       // Blocks buffered between the ISR and loop(), power of two
+#define ADC_PRESCALER       7       // ADPS bits, 16MHz/128 = 125kHz ADC clock, ~9.6k conversions/s
+#define ADC_CONVERSION_US   104     // 13 ADC clocks
+
+/*
+One block of conversions summed by the ADC interrupt. Divide the sums by
+samples to get the average counts for the block.
+
+Averaging 4^n samples gives n extra bits of resolution, provided there is
+at least one count of noise on the input to dither it (the current sensor
+and the divider both have that). The averages are kept in Q4 (see
+Conversion.h), which holds up to ADC_OVERSAMPLE_MAX extra bits.
+*/
+struct AdcBlock {
+    unsigned long timestamp;        // micros() when the block was completed
+    unsigned long currentSum;
+    unsigned long voltageSum;
+    unsigned int samples;
+};
+
+void adcBegin(uint8_t currentPin, uint8_t voltagePin, uint8_t throttlePin);
+bool adcReadBlock(AdcBlock& block);
+int adcThrottleValue();
+void adcLatestCurrent(unsigned long& sum, unsigned long& timestamp);
+unsigned int adcOverruns();
+bool adcSetOversampling(uint8_t bits);
+uint8_t adcOversampling();
+unsigned int adcBlockSamples();
+unsigned int adcBlockRate();        // Nominal blocks per 10s
+bool adcSetCurrentFilter(uint8_t type, uint8_t length);
+const Filter& adcCurrentFilter();
+void adcSetSleep(bool enabled);
+bool adcSleep();
+void adcConversionComplete(uint16_t value);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef AUTO_TEST_H
+#define AUTO_TEST_H
+
+#include <Arduino.h>
+#include "Profile.h"
+
+#define AUTO_TEST_COUNTDOWN_MS  6000UL
+#define AUTO_TEST_FREEZE_MS     6000UL  // Results stay on screen while the motor spins down
+
+/*
+Time driven sequencer running a throttle Profile for the automatic test.
+
+autoTestStep() is called periodically and makes at most one state
+transition per call, so every state is seen by the caller at least once
+and nothing in the test ever blocks:
+
+    COUNTDOWN -> RAMP or HOLD -> NEXT_SEGMENT -> ... -> FREEZE -> DONE
+
+RAMP runs ramp segments, HOLD runs step and hold segments. NEXT_SEGMENT
+lasts one step after every segment so the caller can collect its results.
+After the last segment of the last repeat the throttle is cut and the
+test freezes before it is done. The caller uses autoTestEntered() to run
+the entry actions of a state (enable the ESC, reset or collect statistics,
+change screens).
+*/
+enum AutoTestState { AUTO_IDLE, AUTO_COUNTDOWN, AUTO_RAMP, AUTO_HOLD, AUTO_NEXT_SEGMENT, AUTO_FREEZE, AUTO_DONE };
+
+struct AutoTest {
+    const Profile* profile;
+    uint8_t segment;            // Index of the running segment
+    uint8_t cycle;              // Index of the running repeat
+    AutoTestState state;
+    bool entered;               // The last step changed state
+    unsigned long stateStart;   // ms
+    uint8_t startThrottle;      // Throttle the running segment started from, %
+    uint8_t throttle;           // Throttle requested for the current step, %
+};
+
+void autoTestBegin(AutoTest& test, const Profile& profile, unsigned long now);
+AutoTestState autoTestStep(AutoTest& test, unsigned long now);
+void autoTestAbort(AutoTest& test);
+bool autoTestEntered(const AutoTest& test);
+unsigned long autoTestRemaining(const AutoTest& test, unsigned long now);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef AUTO_ZERO_H
+#define AUTO_ZERO_H
+
+#include <Arduino.h>
+
+/*
+Zero offset of one sensor, set by a non-blocking tare and kept up to date
+while the bench is idle.
+
+A tare averages the next samples readings fed to autoZeroUpdate() and
+makes the average the new zero and the centre of the drift limit; nothing
+waits for it. Between tares, readings fed while idle pull the zero towards
+them through a single pole low pass, y += (x - y) / 2^shift, as long as
+they are within window of the zero (anything larger is a load, not drift)
+and the zero stays within limit of the last tare.
+
+The zero is kept shifted left by shift bits, so the reading times 2^shift
+has to fit in a long.
+*/
+struct AutoZero {
+    long zero;              // Offset in use, reading units
+    long centre;            // Result of the last tare
+    long limit;             // Largest drift tracked away from the centre
+    long window;            // Largest distance of a reading tracked as drift
+    long accumulator;       // zero << shift while tracking, the sum while taring
+    uint8_t shift;
+    uint8_t samples;        // Readings per tare
+    uint8_t remaining;      // Readings left in the tare, 0 when tracking
+};
+
+void autoZeroBegin(AutoZero& tracker, long zero, long limit, long window, uint8_t shift);
+void autoZeroTare(AutoZero& tracker, uint8_t samples);
+bool autoZeroTaring(const AutoZero& tracker);
+bool autoZeroUpdate(AutoZero& tracker, long reading, bool idle);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef BUTTONS_H
+#define BUTTONS_H
+
+#include <Arduino.h>
+
+#define BUTTON_SCAN_TICKS       5       // 1kHz ticks between scans
+#define BUTTON_DEBOUNCE_SCANS   4       // Scans a new state has to hold, 20ms
+#define BUTTON_REPEAT_DELAY_MS  400     // First repeat of a held button
+#define BUTTON_REPEAT_MS        100     // Following repeats
+#define BUTTON_LONG_PRESS_MS    1000
+#define BUTTON_QUEUE_SIZE       4       // Power of two; debouncing allows one event per button every 20ms
+
+/*
+Debounced button events.
+
+The 1kHz tick interrupt scans the buttons every BUTTON_SCAN_TICKS ticks; a
+change of the scan has to hold for BUTTON_DEBOUNCE_SCANS scans before it
+counts. A debounced press posts BUTTON_PRESS, holding the button then posts
+BUTTON_REPEAT after BUTTON_REPEAT_DELAY_MS and every BUTTON_REPEAT_MS, and
+a single BUTTON_LONG_PRESS after BUTTON_LONG_PRESS_MS. Events go through a
+lock-free queue and are handled in loop(), so the interrupt only costs the
+scan; an event that finds the queue full is dropped.
+*/
+enum ButtonEventType { BUTTON_PRESS, BUTTON_REPEAT, BUTTON_LONG_PRESS };
+
+struct ButtonEvent {
+    uint8_t button;             // Index in the pins given to halButtonsBegin()
+    uint8_t type;               // ButtonEventType
+    unsigned long timestamp;    // micros() of the scan
+};
+
+void buttonsBegin(uint8_t count);
+bool buttonsRead(ButtonEvent& event);
+bool buttonsPost(uint8_t button, uint8_t type, unsigned long timestamp);
+uint8_t buttonsDropped();
+void buttonsTick();
+
+#endif
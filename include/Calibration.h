@@ -0,0 +1,74 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <Arduino.h>
+
+#define CALIBRATION_CHANNELS        3
+#define CALIBRATION_POINTS          6
+#define CALIBRATION_GAIN_BITS       15      // Segment gains are Q15, below 2.0
+#define CALIBRATION_CAPTURE_SAMPLES 64      // Readings averaged into one point
+#define CALIBRATION_EEPROM_ADDRESS  0x100   // See the layout in Storage.h
+#define CALIBRATION_EEPROM_SIZE     0x20    // Per channel
+#define CALIBRATION_EEPROM_MARKER   0x43
+
+/*
+Correction of the current, voltage and thrust readings against reference
+instruments (a clamp meter, a voltmeter, known weights).
+
+A point pairs the bench's own reading with the reference value, both in the
+channel's input domain: Q4 ADC counts for current and voltage, where the
+reference is converted with the channel's nominal scale, and grams for the
+thrust. Up to CALIBRATION_POINTS points per channel are fitted as
+
+    CALIBRATION_OFF     readings pass through
+    CALIBRATION_LINEAR  least squares gain and offset over all points, a
+                        single point only corrects the offset
+    CALIBRATION_TABLE   piecewise linear through the points, the end
+                        segments extend beyond the first and last point
+
+and compiled into segments of start, output and Q15 gain, so correcting a
+reading is a scan of at most five segment starts, one multiply and one
+shift. Every gain has to be positive and below 2, which keeps the table
+invertible for the cutoff limits and the multiply within 32 bits.
+
+Each channel's points are stored in EEPROM behind a marker byte and
+followed by a CRC-8, like the profile. A capture averages the readings fed
+from the acquisition task; the point is fitted once calibrationCaptureSave()
+runs from the serial task, and its EEPROM bytes go through the write queue
+of Storage.h, one per storage task run, so no task waits the ~90ms they
+take while a reference is being measured.
+*/
+enum CalibrationChannel { CALIBRATION_CURRENT, CALIBRATION_VOLTAGE, CALIBRATION_THRUST };
+enum CalibrationMode { CALIBRATION_OFF, CALIBRATION_LINEAR, CALIBRATION_TABLE };
+enum CalibrationCapture { CAPTURE_IDLE, CAPTURE_RUNNING, CAPTURE_DONE, CAPTURE_FAILED };
+
+struct CalibrationPoint {
+    int16_t input;          // Bench reading
+    int16_t reference;      // Reference instrument
+};
+
+struct CalibrationTable {
+    uint8_t mode;           // CalibrationMode
+    uint8_t count;
+    CalibrationPoint points[CALIBRATION_POINTS];    // Sorted by input
+};
+
+static_assert(sizeof(CalibrationTable) == 2 + 4 * CALIBRATION_POINTS, "Calibration layout differs from the stored one");
+static_assert(sizeof(CalibrationTable) + 2 <= CALIBRATION_EEPROM_SIZE, "Calibration does not fit its EEPROM area");
+
+void calibrationBegin();
+long calibrationApply(uint8_t channel, long input);
+long calibrationInverse(uint8_t channel, long output);
+bool calibrationLoad(uint8_t channel, CalibrationTable& table);
+bool calibrationAddPoint(uint8_t channel, long input, long reference);
+bool calibrationSetMode(uint8_t channel, uint8_t mode);
+void calibrationClear(uint8_t channel);
+uint8_t calibrationChanges();
+void calibrationCaptureStart(uint8_t channel, long reference);
+void calibrationFeed(uint8_t channel, long input);
+void calibrationCaptureSave();
+uint8_t calibrationCaptureState();
+const __FlashStringHelper* calibrationModeName(uint8_t mode);
+bool calibrationModeFromName(const char* name, uint8_t& mode);
+
+#endif
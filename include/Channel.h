@@ -0,0 +1,88 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <Arduino.h>
+#include "Filter.h"
+
+#define ADC_FRACTION_BITS   4
+#define ADC_MAX_Q           (1023L << ADC_FRACTION_BITS)
+#define CHANNEL_SCALE_BITS_MAX 16
+
+/*
+Compile-time description of one analog input, converting Q4 block averages
+to integer units (mA, mV, 0.1C, ...):
+
+    value = (adcQ + Offset * 16) * Scale / 16
+
+    Pin         analog pin sampled by the ADC
+    Scale       Ratio<N, D>, units per ADC count
+    Offset      Ratio<N, D>, counts added before scaling, minus the reading
+                at zero
+    Filter      FilterSpec<type, length>, the channel's default filter
+    Unipolar    readings below zero clamp to zero (one way sensors)
+
+Floats can not be template arguments, so Scale and Offset are integer
+ratios. Everything else is derived at compile time: the scale becomes a Q
+multiplier with as many fractional bits as fit in 32 bits over the full ADC
+range, which makes a conversion one multiply and one shift on constants,
+the same code as a hand written conversion. A new input is one typedef, see
+Conversion.h.
+*/
+template <long Numerator, long Denominator = 1>
+struct Ratio {
+    static constexpr float value = (float)Numerator / (float)Denominator;
+};
+
+template <FilterType Type, uint8_t Length>
+struct FilterSpec {
+    static constexpr uint8_t type = Type;
+    static constexpr uint8_t length = Length;
+};
+
+constexpr long channelRound(float value) {
+    return value < 0 ? (long)(value - 0.5F) : (long)(value + 0.5F);
+}
+
+// Most fractional bits for which range * scale still fits in a long
+constexpr uint8_t channelScaleBits(float scale, long range, uint8_t bits) {
+    return bits == 0 || (float)range * channelRound(scale * (float)(1L << bits)) <= 2147483647.0F ? bits : channelScaleBits(scale, range, bits - 1);
+}
+
+template <uint8_t Pin, typename Scale, typename Offset, typename Filter, bool Unipolar = false>
+struct Channel {
+    static constexpr uint8_t pin = Pin;
+    static constexpr float scale = Scale::value;
+    static constexpr float offset = Offset::value;
+    static constexpr uint8_t filterType = Filter::type;
+    static constexpr uint8_t filterLength = Filter::length;
+
+    static constexpr long offsetQ = channelRound(offset * (1 << ADC_FRACTION_BITS));
+    static constexpr long range = ADC_MAX_Q + (offsetQ < 0 ? -offsetQ : offsetQ);
+    static constexpr uint8_t scaleBits = channelScaleBits(scale, range, CHANNEL_SCALE_BITS_MAX);
+    static constexpr long scaleQ = channelRound(scale * (float)(1L << scaleBits));
+    static constexpr uint8_t shift = ADC_FRACTION_BITS + scaleBits;
+    static constexpr long maximum = ((ADC_MAX_Q + offsetQ) * scaleQ) >> shift;
+    static constexpr unsigned long microPerCount = (unsigned long)channelRound(scale * 1000.0F);    // Step of one count in thousandths of the unit
+
+    static_assert(scaleQ > 0, "Channel scale must be positive");
+    static_assert(range <= 2147483647L / scaleQ, "Channel scale overflows 32 bits");
+
+    static long fromAdcQ(long adcQ) {
+        if (Unipolar && adcQ + offsetQ <= 0) {
+            return 0;   // Readings below zero are noise
+        }
+        return ((adcQ + offsetQ) * scaleQ) >> shift;
+    }
+
+    // Inverse of fromAdcQ(), rounded up, used to turn limits into counts
+    static long adcQFrom(long value) {
+        return ((value << shift) + scaleQ - 1) / scaleQ - offsetQ;
+    }
+};
+
+// Average of a block of conversions in Q4 counts
+inline long adcAverageQ(unsigned long sum, unsigned int samples) {
+    return (long)((sum << ADC_FRACTION_BITS) / samples);
+}
+
+#endif
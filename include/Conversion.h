@@ -0,0 +1,44 @@
+#ifndef CONVERSION_H
+#define CONVERSION_H
+
+#include <Arduino.h>
+#include "Channel.h"
+
+/*
+The bench's analog inputs, converted with integer arithmetic to mA, mV and
+mW.
+
+    current     ACS715 on A1 (originally A0), 124 counts at 0A and
+                0.1220703125A per count (5V / 0.133V/A / 1024, or
+                0.1221896383186706)
+    voltage     divider on A3, 4.59mV per count on the pin times R1/R2
+                (47k / 10k, the old board had 11.66k / 4.62k), 15 counts
+                below zero
+
+Error against the float reference
+    current = (avg - 124) * 0.1220703125
+    voltage = (avg + 15) * 0.00459 * R1 / R2
+evaluated on the same block sums:
+    current: scale 62500/512 mA per count is exact, Q4 averaging and the
+             final shift truncate < 1/16 count plus 1mA; total < 9mA,
+             always rounding towards zero
+    voltage: Q12 scale rounding < 1e-5 relative, plus < 1/16 count (1.4mV)
+             and 1mV truncation; total < 3mV
+    power:   mA * mV / 1000 in 32 bit unsigned, exact to 1mW on top of the
+             current and voltage errors (< 0.25W at 22V/110A full scale)
+The old float path truncated the block average to whole counts (up to
+122mA / 21mV) and the power to whole watts, so these bounds are tighter.
+
+Adding an input is one more typedef here, for example an LM35 (10mV/C) in
+0.1C: Channel<A2, Ratio<4590, 10000>, Ratio<0>, FilterSpec<FILTER_IIR, 4> >.
+*/
+typedef Channel<A1, Ratio<31250, 256>, Ratio<-124>, FilterSpec<FILTER_MEDIAN, 3>, true> CurrentChannel;   // mA, the median also filters the cutoff's readings
+typedef Channel<A3, Ratio<4590L * 47000, 1000L * 10000>, Ratio<15>, FilterSpec<FILTER_NONE, 1> > VoltageChannel;  // mV
+
+static_assert((unsigned long)CurrentChannel::maximum <= 4294967295UL / (unsigned long)VoltageChannel::maximum, "Power overflows 32 bits");
+
+inline long powerFromCurrentVoltage(long milliAmps, long milliVolts) {
+    return (unsigned long)milliAmps * (unsigned long)milliVolts / 1000;
+}
+
+#endif
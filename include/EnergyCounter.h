@@ -0,0 +1,27 @@
+#ifndef ENERGY_COUNTER_H
+#define ENERGY_COUNTER_H
+
+#include <Arduino.h>
+
+#define ENERGY_MAX_GAP_US   1000000UL   // Longer gaps between samples are not integrated
+
+/*
+Charge and energy integrated sample by sample with the trapezoidal rule.
+The accumulators hold twice the mA*us and mW*us so the trapezoid needs no
+division; 64 bits cover far more than a full battery at 120A.
+*/
+struct EnergyCounter {
+    uint64_t charge;
+    uint64_t energy;
+    long lastCurrent;           // mA
+    long lastPower;             // mW
+    unsigned long lastTimestamp;    // us
+    bool started;
+};
+
+void energyReset(EnergyCounter& counter);
+void energyAddSample(EnergyCounter& counter, long milliAmps, long milliWatts, unsigned long timestamp);
+long energyMilliAmpHours(const EnergyCounter& counter);
+long energyMilliWattHours(const EnergyCounter& counter);
+
+#endif
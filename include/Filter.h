@@ -0,0 +1,42 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <Arduino.h>
+
+#define FILTER_MAX_TAPS     5       // Longest median and FIR, four bytes of SRAM per tap and filter
+#define FILTER_IIR_MAX      6       // Largest IIR shift, state keeps 2^6 times the input
+
+/*
+Fixed memory, integer filters for one channel of the acquisition path, cheap
+enough for the interrupts that feed the cutoff.
+
+    FILTER_NONE     passes the samples through
+    FILTER_MEDIAN   moving median of length samples (odd), removes spikes
+                    shorter than half the window and leaves steps sharp
+    FILTER_IIR      single pole low pass y += (x - y) / 2^length
+    FILTER_FIR      length taps (odd) of binomial coefficients, a short
+                    Gaussian-like smoother; the coefficients sum to
+                    2^(length-1) so normalising is a shift
+
+All of them start from the first sample instead of from zero. The group
+delay, in samples, is (length-1)/2 for the median and the FIR, which are
+linear phase, and 2^length-1 at low frequencies for the IIR.
+*/
+enum FilterType { FILTER_NONE, FILTER_MEDIAN, FILTER_IIR, FILTER_FIR };
+
+struct Filter {
+    uint8_t type;
+    uint8_t length;             // Taps of MEDIAN and FIR, shift of IIR
+    uint8_t next;               // Oldest sample in window
+    bool primed;
+    long window[FILTER_MAX_TAPS];   // IIR keeps its state, 2^length times the output, in window[0]
+};
+
+bool filterConfigure(Filter& filter, uint8_t type, uint8_t length);
+void filterReset(Filter& filter);
+long filterUpdate(Filter& filter, long sample);
+unsigned int filterDelay(const Filter& filter);
+const __FlashStringHelper* filterTypeName(uint8_t type);
+bool filterTypeFromName(const char* name, uint8_t& type);
+
+#endif
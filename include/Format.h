@@ -0,0 +1,22 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <Arduino.h>
+
+/*
+Fixed width field formatting into caller supplied buffers, used instead of
+Arduino String so the screens never touch the heap.
+
+Every function writes prefix, value and unit, pads with spaces to exactly
+width characters (truncating if longer), terminates the string and returns
+buf so the result can go straight into print(). buf must hold width + 1
+characters. Labels and units are flash strings, F("V="), so they take no
+SRAM.
+*/
+
+char* formatTextField(char* buf, uint8_t width, const __FlashStringHelper* text);
+char* formatField(char* buf, uint8_t width, const __FlashStringHelper* prefix, long value, const __FlashStringHelper* unit);
+char* formatFixedField(char* buf, uint8_t width, const __FlashStringHelper* prefix, long value, uint8_t decimals, const __FlashStringHelper* unit);
+char* formatFloatField(char* buf, uint8_t width, const __FlashStringHelper* prefix, float value, uint8_t decimals, const __FlashStringHelper* unit);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <Arduino.h>
+#include "Instrumentation.h"
+
+#define LCD_I2C_ADDRESS     0x27
+
+/*
+Hardware abstraction layer: everything that touches a peripheral register,
+a pin or a hardware library. src/HalAvr.cpp implements it for the
+ATmega328P; src/native/HalNative.cpp implements it on the bench simulator
+for the native build.
+
+Interrupts call straight into the module that owns the data, there are no
+callback pointers:
+    conversion complete     adcConversionComplete()     (AdcSampler)
+    HX711 data ready        loadCellConversionComplete() (LoadCell)
+    1kHz tick               safetyTick()                 (SafetyMonitor)
+                            buttonsTick()                (Buttons)
+
+Time comes from the Arduino millis(), micros() and delay(); the native
+build provides them from its virtual clock, as it provides Serial.
+*/
+
+// ADC: one conversion at a time, the result goes to adcConversionComplete()
+void halAdcBegin(const uint8_t* pins, uint8_t count);
+void halAdcStart(uint8_t pin);
+
+// HX711 load cell amplifier, every conversion goes to loadCellConversionComplete()
+void halLoadCellBegin(uint8_t doutPin, uint8_t sckPin);
+
+// 1kHz periodic interrupt calling safetyTick() and buttonsTick()
+void halTickBegin();
+
+// ESC pulse output, safe to call from interrupts
+void halEscBegin(uint8_t pin, int minPulse, int maxPulse);
+void halEscWrite(int pulse);
+int halEscRead();
+
+// Buttons close to the common pin, which is held low; scan returns one bit per pressed pin in pins[]
+void halButtonsBegin(uint8_t commonPin, const int* pins, uint8_t count);
+uint8_t halButtonsScan();
+
+// Character display
+void halLcdBegin();
+void halLcdClear();
+void halLcdSetCursor(uint8_t col, uint8_t row);
+void halLcdWrite(uint8_t c);
+
+// EEPROM, writes take 3.4ms on the ATmega328P and wait for the previous one; ready once it is done
+uint8_t halEepromRead(int address);
+void halEepromWrite(int address, uint8_t value);
+bool halEepromReady();
+
+// Idle sleep until the next interrupt; timers, ADC and UART keep running
+void halSleep();
+
+#if INSTRUMENTATION
+// SRAM between the heap and the stack pointer, and the part of it the stack has never reached
+unsigned int halFreeMemory();
+unsigned int halStackUnused();
+#endif
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <Arduino.h>
+
+#ifndef INSTRUMENTATION
+#define INSTRUMENTATION     0       // 1 adds the stage timers and the PERF command, about 300 bytes of SRAM
+#endif
+
+#define INSTRUMENT_BINS     6       // Histogram bins of run time: <16us, <64, <256, <1024, <4096 and longer
+
+/*
+Run time instrumentation of the firmware stages.
+
+INSTRUMENT_SCOPE(stage) at the top of a block times the block with micros()
+(4us resolution on a 16MHz board; Timer1 belongs to the Servo library and
+is reset every servo frame, so it can not serve as a cycle counter). Each
+stage keeps count, total, minimum, maximum and a histogram with bins four
+times wider each. INSTRUMENT_LOOP() in loop() counts passes and keeps the
+longest gap between two passes, the worst case latency of anything polled
+from loop().
+
+Built with INSTRUMENTATION 0 the macros expand to nothing and none of this
+is compiled.
+*/
+enum InstrumentStage {
+    STAGE_ACQUISITION,
+    STAGE_STATISTICS,
+    STAGE_SAFETY_TICK,
+    STAGE_SAFETY,
+    STAGE_ESC,
+    STAGE_AUTO_TEST,
+    STAGE_SERIAL,
+    STAGE_DISPLAY,
+    STAGE_LCD_REFRESH,
+    STAGE_TELEMETRY,
+    STAGE_BUTTONS,
+    STAGE_STORAGE,
+    STAGE_COUNT
+};
+
+struct StageStats {
+    unsigned long count;
+    unsigned long total;            // us
+    unsigned int minimum;           // us, saturates at 65535
+    unsigned int maximum;
+    unsigned int bins[INSTRUMENT_BINS];     // Halved together when one would overflow
+};
+
+#if INSTRUMENTATION
+
+void instrumentReset();
+void instrumentRecord(uint8_t stage, unsigned long duration);
+void instrumentLoop();
+void instrumentRead(uint8_t stage, StageStats& stats);
+const __FlashStringHelper* instrumentStageName(uint8_t stage);
+unsigned long instrumentLoops();
+unsigned long instrumentElapsed();      // us since the last reset
+unsigned long instrumentLoopGap();      // Longest time between two passes of loop(), us
+
+class InstrumentScope {
+public:
+    explicit InstrumentScope(uint8_t stage) : stage(stage), start(micros()) {}
+    ~InstrumentScope() { instrumentRecord(stage, micros() - start); }
+
+private:
+    uint8_t stage;
+    unsigned long start;
+};
+
+#define INSTRUMENT_JOIN2(a, b)      a##b
+#define INSTRUMENT_JOIN(a, b)       INSTRUMENT_JOIN2(a, b)
+#define INSTRUMENT_SCOPE(stage)     InstrumentScope INSTRUMENT_JOIN(instrumentScope, __LINE__)(stage)
+#define INSTRUMENT_LOOP()           instrumentLoop()
+
+#else
+
+#define INSTRUMENT_SCOPE(stage)
+#define INSTRUMENT_LOOP()
+
+#endif
+
+#endif
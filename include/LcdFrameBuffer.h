@@ -0,0 +1,48 @@
+#ifndef LCD_FRAME_BUFFER_H
+#define LCD_FRAME_BUFFER_H
+
+#include <Arduino.h>
+
+#define LCD_COLUMNS         20
+#define LCD_ROWS            4
+#define LCD_REFRESH_MS      200     // Minimum time between two display updates
+#define LCD_REFRESH_CELLS   LCD_COLUMNS     // Most cells one refresh() sends, about 10ms of I2C
+
+/*
+Shadow copy of the 20x4 display. Screens print into the frame buffer as they
+would into the LCD; refresh() then sends only the cells that differ from
+what is on the glass (through the HAL), at most once every refresh interval. Every character
+sent over I2C costs about half a millisecond, so unchanged headers and
+fields are never resent. Changed cells are kept as a bit each rather than
+as a second copy of the display, which saves 68 bytes of SRAM. One refresh()
+sends at most LCD_REFRESH_CELLS cells and the next one goes on from there,
+so redrawing a whole screen is spread over LCD_ROWS calls.
+*/
+class LcdFrameBuffer : public Print {
+public:
+    LcdFrameBuffer();
+
+    void clear();
+    void setCursor(uint8_t col, uint8_t row);
+    size_t write(uint8_t c) override;
+    using Print::write;
+
+    bool refresh(bool force = false);
+    void invalidate();
+    void setRefreshInterval(unsigned int ms) { refreshInterval = ms; }
+
+private:
+    void put(uint8_t col, uint8_t row, char c);
+    bool dirty(uint8_t col, uint8_t row) const { return changed[row][col >> 3] & (1 << (col & 7)); }
+    void clean(uint8_t col, uint8_t row) { changed[row][col >> 3] &= ~(1 << (col & 7)); }
+
+    char frame[LCD_ROWS][LCD_COLUMNS];
+    uint8_t changed[LCD_ROWS][(LCD_COLUMNS + 7) / 8];   // Cells that differ from the display
+    uint8_t cursorCol;
+    uint8_t cursorRow;
+    uint8_t refreshRow;         // Row the next refresh() starts at
+    unsigned long lastRefresh;
+    unsigned int refreshInterval;
+};
+
+#endif
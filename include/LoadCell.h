@@ -0,0 +1,32 @@
+#ifndef LOAD_CELL_H
+#define LOAD_CELL_H
+
+#include <Arduino.h>
+#include "Filter.h"
+
+#define LOADCELL_STALE_MS   500     // Older conversions mean the HX711 stopped: thrust reads -1 and an armed bench trips
+
+/*
+One HX711 conversion. raw is the signed 24 bit reading before offset and
+scale are applied, filtered the same after the thrust filter.
+*/
+struct ThrustSample {
+    long raw;
+    long filtered;
+    unsigned long timestamp;        // micros() when the conversion was clocked out
+};
+
+void loadCellBegin(uint8_t doutPin, uint8_t sckPin);
+bool loadCellRead(ThrustSample& sample);
+bool loadCellLatest(ThrustSample& sample);
+void loadCellSetScale(float scale);
+void loadCellSetOffset(long offset);
+long loadCellGetOffset();
+float loadCellUnits(long raw);
+long loadCellRawFromUnits(float units);
+bool loadCellSetFilter(uint8_t type, uint8_t length);
+const Filter& loadCellFilter();
+unsigned long loadCellPeriod();
+void loadCellConversionComplete(long raw);
+
+#endif
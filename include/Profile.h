@@ -0,0 +1,51 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <Arduino.h>
+
+#define PROFILE_MAX_SEGMENTS    6       // Each also costs a SegmentResult of SRAM
+#define PROFILE_MAX_REPEAT      20
+#define PROFILE_EEPROM_ADDRESS  0x40    // See the layout in Storage.h
+#define PROFILE_EEPROM_MARKER   0x52
+#define PROFILE_LEGACY_MARKER   0x50    // Profiles stored with room for 16 segments
+#define PROFILE_LEGACY_SEGMENTS 16
+#define PROFILE_EIGHT_MARKER    0x51    // Profiles stored with room for 8 segments
+#define PROFILE_EIGHT_SEGMENTS  8
+
+/*
+Throttle profile run by the automatic test, four bytes per segment.
+
+STEP jumps to its throttle and holds it, RAMP moves linearly from the
+throttle the previous segment ended at to its own, HOLD keeps the throttle
+the previous segment ended at (its own throttle is ignored). The whole
+segment list runs repeat times.
+
+In EEPROM the profile is preceded by a marker byte and followed by a CRC-8,
+so an erased or half written profile is never run. Profiles stored by
+firmware with 16 segments still load if they use no more than 8.
+*/
+enum SegmentType { SEGMENT_STEP, SEGMENT_RAMP, SEGMENT_HOLD };
+
+struct ProfileSegment {
+    uint8_t type;           // SegmentType
+    uint8_t throttle;       // %
+    uint16_t duration;      // 0.1s
+};
+
+struct Profile {
+    uint8_t count;
+    uint8_t repeat;
+    ProfileSegment segments[PROFILE_MAX_SEGMENTS];
+};
+
+static_assert(sizeof(Profile) == 2 + 4 * PROFILE_MAX_SEGMENTS, "Profile layout differs from the stored one");
+
+void profileClear(Profile& profile);
+bool profileAdd(Profile& profile, uint8_t type, uint8_t throttle, uint16_t duration);
+void profileDefault(Profile& profile, int warmUpTime, int midTestDuration, int maxTestDuration);
+bool profileLoad(Profile& profile);
+void profileSave(const Profile& profile);
+void profileErase();
+const __FlashStringHelper* profileSegmentName(uint8_t type);
+
+#endif
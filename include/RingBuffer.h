@@ -0,0 +1,55 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <Arduino.h>
+
+// Stops the compiler from moving the item copy past the index update that publishes it
+#define RING_BUFFER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+/*
+Lock-free single-producer/single-consumer queue.
+
+One side (usually an ISR) only calls push(), the other side only calls pop().
+Indexes are single bytes so their reads and writes are atomic on AVR and no
+interrupt masking is needed. Size must be a power of two; one slot is kept
+free to tell a full queue from an empty one.
+*/
+template <typename T, uint8_t Size>
+class RingBuffer {
+public:
+    RingBuffer() : head(0), tail(0) {}
+
+    bool push(const T& item) {
+        uint8_t next = (head + 1) & (Size - 1);
+        if (next == tail) {
+            return false;   // Full, caller decides what to do with the item
+        }
+        items[head] = item;
+        RING_BUFFER_BARRIER();
+        head = next;
+        return true;
+    }
+
+    bool pop(T& item) {
+        uint8_t current = tail;
+        if (current == head) {
+            return false;
+        }
+        item = items[current];
+        RING_BUFFER_BARRIER();
+        tail = (current + 1) & (Size - 1);
+        return true;
+    }
+
+    bool isEmpty() const { return head == tail; }
+    uint8_t count() const { return (head - tail) & (Size - 1); }
+    void clear() { tail = head; }   // Consumer side only
+
+private:
+    static_assert((Size & (Size - 1)) == 0, "RingBuffer size must be a power of two");
+    T items[Size];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+};
+
+#endif
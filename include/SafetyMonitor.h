@@ -0,0 +1,20 @@
+#ifndef SAFETY_MONITOR_H
+#define SAFETY_MONITOR_H
+
+#include <Arduino.h>
+
+#define SAFETY_CURRENT_PERSIST_MS   20      // Over current has to last this long to trip
+#define SAFETY_THRUST_PERSIST_MS    50      // Over thrust has to last this long to trip
+
+enum SafetyFault { FAULT_NONE, FAULT_CURRENT, FAULT_THRUST, FAULT_LOADCELL };
+
+void safetyBegin(int idlePulse);
+void safetySetLimits(long maxMilliAmps, long maxGrams, long currentDriftQ);
+void safetySetPersistence(unsigned int currentMs, unsigned int thrustMs);
+void safetyArm(bool armed);
+SafetyFault safetyFault();
+void safetyClearFault();
+unsigned long safetyTripLatency();
+void safetyTick();
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include "Instrumentation.h"
+
+/*
+Cooperative fixed rate scheduler driven by the micros() tick.
+
+Each task is released every period and has to finish within deadline of its
+release time, otherwise its overrun counter is incremented. Releases stay on
+the period grid: a task that falls behind skips the missed releases instead
+of running back to back to catch up. Tasks earlier in the table have
+priority, schedulerRun() runs at most one due task per call so a higher
+priority task never waits behind more than one lower priority one.
+
+The task table is constant and lives in flash (PROGMEM); only the release
+time and the overrun counter, and with INSTRUMENTATION the skipped releases
+and the longest run time, are kept in a TaskState per task.
+*/
+struct Task {
+    const char* name;           // In flash, PROGMEM
+    void (*run)();
+    unsigned long period;       // us
+    unsigned long deadline;     // us after release
+};
+
+struct TaskState {
+    unsigned long nextRelease;
+    unsigned int overruns;
+#if INSTRUMENTATION
+    unsigned int skipped;       // Releases lost because the task was late
+    unsigned long maxDuration;  // Longest run time seen, us
+#endif
+};
+
+void schedulerBegin(TaskState* states, uint8_t count);
+bool schedulerRun(const Task* tasks, TaskState* states, uint8_t count);
+void schedulerReport(Print& out, const Task* tasks, const TaskState* states, uint8_t count);
+bool schedulerReportField(Print& out, const Task& task, const TaskState& state, uint8_t field);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SERIAL_COMMAND_H
+#define SERIAL_COMMAND_H
+
+#include <Arduino.h>
+
+#define SERIAL_COMMAND_LINE     32  // Longest command line, longer lines are rejected; PROFILE ADD RAMP 100 6553.5 is 27
+#define SERIAL_COMMAND_ARGS     6
+#define SERIAL_REPLY_ROOM       48  // Free transmit buffer a command waits for, so its reply does not block
+#define SERIAL_REPLY_FIELD      24  // Longest field of a reply function
+#define SERIAL_COMMAND_NAME     8   // Longest command name plus its terminator
+
+/*
+Line based text commands on the serial port, one command per line:
+
+    NAME ARG1 ARG2 ...
+
+Names are matched without regard to case. The handler gets the line split
+on spaces, argv[0] being the name, and prints any output itself; the
+parser then answers OK or ERR on its own line. Polling never blocks, it
+only consumes what is already in the receive buffer, and only while the
+transmit buffer has SERIAL_REPLY_ROOM bytes free; until then the next
+command waits in the receive buffer.
+
+Output that does not fit that room is handed to serialCommandReply()
+instead of printed. The parser keeps a cursor of line and field and calls
+the reply function for one field at a time, on this and the following
+polls, while the transmit buffer has room for SERIAL_REPLY_FIELD bytes.
+The function returns false past the last field of a line, and past the
+last line when asked for its first field. OK follows the last line; no
+other command is read before.
+*/
+typedef bool (*SerialReply)(Print& port, uint8_t line, uint8_t field);
+
+typedef bool (*SerialHandler)(uint8_t argc, char** argv);
+
+// Command tables are PROGMEM, names and all
+struct SerialCommand {
+    char name[SERIAL_COMMAND_NAME];
+    SerialHandler run;
+};
+
+void serialCommandPoll(Stream& port, const SerialCommand* commands, uint8_t count);
+void serialCommandReply(SerialReply reply);
+bool serialCommandPrintPart(Print& port, const __FlashStringHelper* text, uint8_t part);
+bool serialCommandParseLong(const char* text, long& value);
+bool serialCommandParseFixed(const char* text, uint8_t decimals, long& value);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <Arduino.h>
+#include "WatmeterTestBench.h"
+
+/*
+Online mean, variance, minimum and maximum of one channel (Welford's
+algorithm). Memory use is constant no matter how many samples are added
+and the mean does not drift the way a running sum folded back every N
+samples does.
+The sample count is passed in, since channels sampled together share it;
+count includes the sample being added.
+*/
+struct RunningStats {
+    float mean;
+    float m2;           // Sum of squared differences from the mean
+    float minimum;
+    float maximum;
+};
+
+void statsReset(RunningStats& stats);
+void statsAdd(RunningStats& stats, float value, unsigned long count);
+float statsVariance(const RunningStats& stats, unsigned long count);
+float statsStdDev(const RunningStats& stats, unsigned long count);
+
+/*
+Statistics for every channel of WattmeterValues. Consumption is a running
+total, so only its latest value is kept.
+*/
+struct WattmeterStats {
+    unsigned long count;
+    RunningStats throttle;
+    RunningStats voltage;
+    RunningStats current;
+    RunningStats power;
+    RunningStats thrust;
+    long consumption;
+};
+
+void wattmeterStatsReset(WattmeterStats& stats);
+void wattmeterStatsAdd(WattmeterStats& stats, const WattmeterValues& values);
+void wattmeterStatsMean(const WattmeterStats& stats, WattmeterValues& values);
+void wattmeterStatsMaximum(const WattmeterStats& stats, WattmeterValues& values);
+void wattmeterStatsStdDev(const WattmeterStats& stats, WattmeterValues& values);
+
+/*
+Compact result of one automatic test segment, in the telemetry units.
+When a profile repeats, averages are averaged over the repeats, maxima
+and spreads keep the largest value and the minimum voltage the lowest.
+*/
+struct SegmentResult {
+    uint8_t cycles;         // Repeats merged into the result
+    uint8_t throttle;       // Average %
+    uint16_t voltage;       // Average 10mV
+    uint16_t voltageMin;    // 10mV
+    uint16_t current;       // Average 10mA
+    uint16_t currentMax;    // 10mA
+    uint16_t currentSpread; // Standard deviation, 10mA
+    uint16_t power;         // Average 0.1W
+    uint16_t powerMax;      // 0.1W
+    int16_t thrust;         // Average g
+    int16_t thrustMax;      // g
+    uint16_t thrustSpread;  // Standard deviation, g
+    uint16_t consumption;   // Used during the segment, mAh
+};
+
+void segmentResultReset(SegmentResult& result);
+void segmentResultMerge(SegmentResult& result, const WattmeterStats& stats, long consumption);
+void segmentResultMean(const SegmentResult& result, WattmeterValues& values);
+void segmentResultMaximum(const SegmentResult& result, WattmeterValues& values);
+void segmentResultStdDev(const SegmentResult& result, WattmeterValues& values);
+
+#endif
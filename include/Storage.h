@@ -0,0 +1,94 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <Arduino.h>
+#include "WatmeterTestBench.h"
+
+/*
+EEPROM layout
+
+    0x000   legacy Settings, only read to migrate it
+    0x040   throttle profile (Profile.h)
+    0x0A0   settings slot A
+    0x0D0   settings slot B
+    0x100   calibration points of current, voltage and thrust (Calibration.h)
+    0x160   run log ring, up to the end of the EEPROM
+
+Settings are written alternately to slot A and B with a schema version, a
+sequence number and a CRC-8. The newest valid slot wins, so a reset in the
+middle of a save leaves the previous settings in place. A slot with an
+unknown version is ignored, so a layout change can never be misread. A save
+that changes nothing is skipped, since the other slot always differs.
+
+The run log is a ring of fixed size records written one after the other,
+which spreads the wear over the whole area. The newest record is found at
+startup from the sequence numbers.
+
+An EEPROM byte write takes 3.4ms, so storageWrite() never writes itself: it
+queues the runs of bytes that differ and storagePoll(), run by its own
+task, writes one of them whenever the EEPROM is ready. Writes go out in the
+order they were queued, so a marker queued after its record is still
+written last, and a reset before the queue drains leaves the previous
+record, which the CRCs tell apart from a partly written one. Reads see the
+queued bytes. Only a full queue makes storageWrite() wait for the oldest
+writes.
+
+The records are copied to and from EEPROM as they are in memory. They only
+use fixed width fields and are packed, so the simulator reads an EEPROM
+image from a bench with the AVR's byte layout; the sizes are asserted below.
+*/
+#define STORAGE_LEGACY_ADDRESS  0x000
+#define STORAGE_SLOT_A          0x0A0
+#define STORAGE_SLOT_B          0x0D0
+#define STORAGE_SLOT_SIZE       0x30
+#define STORAGE_LOG_ADDRESS     0x160   // Was 0x100, the remaining entries stay aligned
+#define STORAGE_LOG_END         (E2END + 1)
+#define STORAGE_QUEUE_SIZE      48      // Three bytes of address and length per queued write plus its data
+
+#define SETTINGS_VERSION        2       // Version 1 was the raw Settings struct at address 0
+
+#define RUN_AUTOMATIC           0x01
+#define RUN_ABORTED             0x02
+
+struct __attribute__((packed)) SettingsRecord {
+    uint8_t version;
+    uint8_t sequence;
+    Settings settings;
+    uint8_t crc;
+};
+
+// Summary of one test run, in the telemetry units
+struct __attribute__((packed)) RunSummary {
+    uint16_t sequence;
+    uint8_t flags;          // RUN_AUTOMATIC, RUN_ABORTED
+    uint16_t duration;      // s
+    uint16_t consumption;   // mAh
+    uint16_t energy;        // 0.1Wh
+    uint16_t currentMax;    // 10mA
+    uint16_t voltageMin;    // 10mV
+    int16_t thrustMax;      // g
+    uint8_t crc;
+};
+
+#define STORAGE_LOG_ENTRIES     ((STORAGE_LOG_END - STORAGE_LOG_ADDRESS) / sizeof(RunSummary))
+
+static_assert(sizeof(Settings) == 22, "Settings layout differs from the stored one");
+static_assert(sizeof(SettingsRecord) == 25, "Settings record layout differs from the stored one");
+static_assert(sizeof(RunSummary) == 16, "Run summary layout differs from the stored one");
+static_assert(sizeof(SettingsRecord) <= STORAGE_SLOT_SIZE, "Settings do not fit a slot");
+static_assert(3 + sizeof(SettingsRecord) <= STORAGE_QUEUE_SIZE, "Settings do not fit the write queue");
+
+void storageBegin();
+uint8_t storageCrc(const void* data, unsigned int size);
+void storageRead(int address, void* data, unsigned int size);
+uint8_t storageReadByte(int address);
+void storageWrite(int address, const void* data, unsigned int size);
+void storagePoll();
+bool storageLoadSettings(Settings& settings);
+void storageSaveSettings(const Settings& settings);
+bool storageSettingsChanged(const Settings& settings);
+void runLogAppend(RunSummary& summary);
+uint8_t runLogCount();
+bool runLogRead(uint8_t index, RunSummary& summary);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include "TelemetryProtocol.h"
+#include "WatmeterTestBench.h"
+#include "AdcSampler.h"
+#include "LoadCell.h"
+
+bool telemetrySendFrame(uint8_t type, const uint8_t* payload, uint8_t length);
+void telemetryBatchSample(const WattmeterValues& values, unsigned long timestamp, uint8_t blocks);
+bool telemetryFlushBatch();
+bool telemetryBatchStart(unsigned long& timestamp);
+bool telemetrySendStatus(unsigned long timestamp);
+bool telemetrySendRawAdc(const AdcBlock& block, int throttle);
+bool telemetrySendRawLoadCell(const ThrustSample& sample);
+bool telemetrySendRawEvent(uint8_t type, unsigned long timestamp, long value);
+unsigned int telemetryDropped();
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef TELEMETRY_PROTOCOL_H
+#define TELEMETRY_PROTOCOL_H
+
+#include <stdint.h>
+
+/*
+Binary telemetry frames sent over the serial port. Shared by the firmware and
+the host tools, so this header must not depend on Arduino.h.
+
+Frame layout, all multi byte fields little endian:
+
+    sync    0xA5
+    type    TelemetryFrameType
+    length  payload length in bytes
+    seq     frame counter, incremented for every frame including dropped ones
+    payload length bytes
+    crc     CRC-8 (poly 0x07, init 0) over type, length, seq and payload
+
+A receiver resynchronises by scanning for the sync byte and checking the CRC.
+The length field lets older decoders skip frame types they do not know.
+*/
+
+#define TELEMETRY_SYNC              0xA5
+#define TELEMETRY_HEADER_SIZE       4
+#define TELEMETRY_MAX_PAYLOAD       48      // A whole frame stays below the firmware's 63 byte transmit buffer
+#define TELEMETRY_THROTTLE_IDLE     -1
+
+enum TelemetryFrameType {
+    TELEMETRY_SAMPLE = 0x01,
+    TELEMETRY_RAW_ADC = 0x02,
+    TELEMETRY_RAW_LOADCELL = 0x03,
+    TELEMETRY_RAW_EVENT = 0x04,
+    TELEMETRY_STATUS = 0x05,
+    TELEMETRY_SAMPLE_BATCH = 0x06
+};
+
+/*
+TELEMETRY_SAMPLE payload, 15 bytes. Fixed point units are chosen so a 120A,
+6S, 10kg bench fits in 16 bits.
+*/
+#define TELEMETRY_SAMPLE_SIZE       15
+struct TelemetrySample {
+    uint32_t timestamp;     // us, wraps every ~71 minutes
+    int8_t throttle;        // %, TELEMETRY_THROTTLE_IDLE when the throttle is disabled
+    uint16_t voltage;       // 10mV
+    uint16_t current;       // 10mA
+    uint16_t power;         // 0.1W
+    uint16_t consumption;   // mAh
+    int16_t thrust;         // g
+};
+
+/*
+TELEMETRY_SAMPLE_BATCH payload, up to TELEMETRY_BATCH_PAYLOAD bytes: several
+consecutive samples of a stream, delta coded, so a stream of every ADC block
+costs a few bytes per sample.
+
+    sample      15 bytes, the first sample as in TELEMETRY_SAMPLE
+    span        uint16, us from the first sample's time stamp to the last one's
+    entries     one per further sample:
+                    flags   bits 0-5 mark the fields that changed, in the order
+                            throttle, voltage, current, power, consumption, thrust;
+                            bits 6-7 are the ADC blocks since the previous sample, minus 1
+                    deltas  int8 per changed field, in the field's units
+
+The ADC runs free, so the samples' time stamps are the first one plus the
+span in proportion to the blocks up to each sample; off by at most one
+conversion where the throttle pot's conversions fall unevenly on the blocks.
+A batch ends when it is full or a delta, the span or the blocks between two
+samples do not fit. A sample that ends up alone is sent as TELEMETRY_SAMPLE.
+*/
+#define TELEMETRY_BATCH_HEADER_SIZE 17
+#define TELEMETRY_BATCH_PAYLOAD     40
+#define TELEMETRY_BATCH_FIELDS      6
+#define TELEMETRY_BATCH_BLOCKS_SHIFT 6
+#define TELEMETRY_BATCH_BLOCKS_MAX  4
+
+static_assert(TELEMETRY_BATCH_PAYLOAD <= TELEMETRY_MAX_PAYLOAD, "Sample batches do not fit a frame");
+
+/*
+Raw frames carry the sensor inputs before any conversion, so a recorded run
+can be replayed through the firmware (see src/native/SimReplay.cpp). They are
+only sent when the firmware is built with RECORD_RAW.
+*/
+
+// TELEMETRY_RAW_ADC payload, 16 bytes: one AdcBlock and the throttle pot
+#define TELEMETRY_RAW_ADC_SIZE      16
+struct TelemetryRawAdc {
+    uint32_t timestamp;     // us, AdcBlock::timestamp
+    uint32_t currentSum;    // counts
+    uint32_t voltageSum;    // counts
+    uint16_t samples;
+    uint16_t throttle;      // counts
+};
+
+// TELEMETRY_RAW_LOADCELL payload, 8 bytes: one HX711 conversion
+#define TELEMETRY_RAW_LOADCELL_SIZE 8
+struct TelemetryRawLoadCell {
+    uint32_t timestamp;     // us, ThrustSample::timestamp
+    int32_t raw;            // counts, sign extended from 24 bits
+};
+
+enum TelemetryRawEventType {
+    RAW_EVENT_BUTTONS = 0x01,   // value: halButtonsScan() mask on a button interrupt, older recordings
+    RAW_EVENT_TARE = 0x02,      // value: new load cell offset, counts
+    RAW_EVENT_BUTTON = 0x03     // value: ButtonEvent button | type << 8, time stamp of the scan
+};
+
+// TELEMETRY_RAW_EVENT payload, 9 bytes
+#define TELEMETRY_RAW_EVENT_SIZE    9
+struct TelemetryRawEvent {
+    uint32_t timestamp;     // us
+    uint8_t type;           // TelemetryRawEventType
+    int32_t value;
+};
+
+/*
+TELEMETRY_STATUS payload, 18 bytes: acquisition settings, sent once a second
+and whenever they change. The resolutions are the value of one count of the
+block average, before any further averaging on the host.
+*/
+#define TELEMETRY_STATUS_SIZE       18
+#define TELEMETRY_STATUS_SLEEP      0x01    // CPU sleeps between tasks while converting
+struct TelemetryStatus {
+    uint32_t timestamp;     // us
+    uint8_t adcBits;        // Effective bits of the block average, 10 + oversampling bits
+    uint16_t blockSamples;  // Current/voltage pairs per block
+    uint16_t blockRate;     // 0.1 blocks/s, nominal
+    uint16_t currentStep;   // uA per count of the block average
+    uint16_t voltageStep;   // uV per count of the block average
+    uint8_t flags;
+    uint16_t adcOverruns;   // Blocks dropped because loop() fell behind, since reset
+    uint16_t dropped;       // Telemetry frames dropped, since reset
+};
+
+inline uint8_t telemetryCrc8(uint8_t crc, uint8_t data) {
+    crc ^= data;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = crc & 0x80 ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+inline uint8_t* telemetryPut16(uint8_t* p, uint16_t value) {
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+    return p + 2;
+}
+
+inline uint8_t* telemetryPut32(uint8_t* p, uint32_t value) {
+    p = telemetryPut16(p, value & 0xFFFF);
+    return telemetryPut16(p, value >> 16);
+}
+
+inline uint16_t telemetryGet16(const uint8_t* p) {
+    return p[0] | ((uint16_t)p[1] << 8);
+}
+
+inline uint32_t telemetryGet32(const uint8_t* p) {
+    return telemetryGet16(p) | ((uint32_t)telemetryGet16(p + 2) << 16);
+}
+
+inline void telemetryEncodeSample(const TelemetrySample& sample, uint8_t* payload) {
+    payload = telemetryPut32(payload, sample.timestamp);
+    *payload++ = (uint8_t)sample.throttle;
+    payload = telemetryPut16(payload, sample.voltage);
+    payload = telemetryPut16(payload, sample.current);
+    payload = telemetryPut16(payload, sample.power);
+    payload = telemetryPut16(payload, sample.consumption);
+    telemetryPut16(payload, (uint16_t)sample.thrust);
+}
+
+inline void telemetryDecodeSample(const uint8_t* payload, TelemetrySample& sample) {
+    sample.timestamp = telemetryGet32(payload);
+    sample.throttle = (int8_t)payload[4];
+    sample.voltage = telemetryGet16(payload + 5);
+    sample.current = telemetryGet16(payload + 7);
+    sample.power = telemetryGet16(payload + 9);
+    sample.consumption = telemetryGet16(payload + 11);
+    sample.thrust = (int16_t)telemetryGet16(payload + 13);
+}
+
+inline void telemetryEncodeRawAdc(const TelemetryRawAdc& raw, uint8_t* payload) {
+    payload = telemetryPut32(payload, raw.timestamp);
+    payload = telemetryPut32(payload, raw.currentSum);
+    payload = telemetryPut32(payload, raw.voltageSum);
+    payload = telemetryPut16(payload, raw.samples);
+    telemetryPut16(payload, raw.throttle);
+}
+
+inline void telemetryDecodeRawAdc(const uint8_t* payload, TelemetryRawAdc& raw) {
+    raw.timestamp = telemetryGet32(payload);
+    raw.currentSum = telemetryGet32(payload + 4);
+    raw.voltageSum = telemetryGet32(payload + 8);
+    raw.samples = telemetryGet16(payload + 12);
+    raw.throttle = telemetryGet16(payload + 14);
+}
+
+inline void telemetryEncodeRawLoadCell(const TelemetryRawLoadCell& raw, uint8_t* payload) {
+    payload = telemetryPut32(payload, raw.timestamp);
+    telemetryPut32(payload, (uint32_t)raw.raw);
+}
+
+inline void telemetryDecodeRawLoadCell(const uint8_t* payload, TelemetryRawLoadCell& raw) {
+    raw.timestamp = telemetryGet32(payload);
+    raw.raw = (int32_t)telemetryGet32(payload + 4);
+}
+
+inline void telemetryEncodeRawEvent(const TelemetryRawEvent& raw, uint8_t* payload) {
+    payload = telemetryPut32(payload, raw.timestamp);
+    *payload++ = raw.type;
+    telemetryPut32(payload, (uint32_t)raw.value);
+}
+
+inline void telemetryDecodeRawEvent(const uint8_t* payload, TelemetryRawEvent& raw) {
+    raw.timestamp = telemetryGet32(payload);
+    raw.type = payload[4];
+    raw.value = (int32_t)telemetryGet32(payload + 5);
+}
+
+inline void telemetryEncodeStatus(const TelemetryStatus& status, uint8_t* payload) {
+    payload = telemetryPut32(payload, status.timestamp);
+    *payload++ = status.adcBits;
+    payload = telemetryPut16(payload, status.blockSamples);
+    payload = telemetryPut16(payload, status.blockRate);
+    payload = telemetryPut16(payload, status.currentStep);
+    payload = telemetryPut16(payload, status.voltageStep);
+    *payload++ = status.flags;
+    payload = telemetryPut16(payload, status.adcOverruns);
+    telemetryPut16(payload, status.dropped);
+}
+
+inline void telemetryDecodeStatus(const uint8_t* payload, TelemetryStatus& status) {
+    status.timestamp = telemetryGet32(payload);
+    status.adcBits = payload[4];
+    status.blockSamples = telemetryGet16(payload + 5);
+    status.blockRate = telemetryGet16(payload + 7);
+    status.currentStep = telemetryGet16(payload + 9);
+    status.voltageStep = telemetryGet16(payload + 11);
+    status.flags = payload[13];
+    status.adcOverruns = telemetryGet16(payload + 14);
+    status.dropped = telemetryGet16(payload + 16);
+}
+
+#endif
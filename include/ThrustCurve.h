@@ -0,0 +1,37 @@
+#ifndef THRUST_CURVE_H
+#define THRUST_CURVE_H
+
+#include <Arduino.h>
+#include "WatmeterTestBench.h"
+
+#define THROTTLE_BIN_PERCENT    10  // 5 or even 1 work too, at 18 bytes of SRAM per bin
+#define THROTTLE_BINS           (100 / THROTTLE_BIN_PERCENT + 1)
+
+static_assert(100 % THROTTLE_BIN_PERCENT == 0, "THROTTLE_BIN_PERCENT must divide 100");
+
+/*
+Thrust and efficiency curve: the running mean of every channel per
+throttle bin, so one slow sweep gives the whole curve.
+
+Bins hold sums in the telemetry units (10mV, 10mA, 0.1W, g), which fit
+32 bits for the 65535 samples a bin can take before it stops adding.
+g/W is the ratio of the mean thrust and the mean power of the bin.
+*/
+struct CurveBin {
+    uint16_t count;
+    unsigned long voltage;
+    unsigned long current;
+    unsigned long power;
+    long thrust;
+};
+
+struct ThrustCurve {
+    CurveBin bins[THROTTLE_BINS];
+};
+
+void curveReset(ThrustCurve& curve);
+void curveAdd(ThrustCurve& curve, const WattmeterValues& values);
+bool curveMean(const ThrustCurve& curve, uint8_t bin, WattmeterValues& values);
+long curveGramsPerWatt(const WattmeterValues& values);
+
+#endif
@@ -1,41 +1,76 @@
+#ifndef WATMETER_TEST_BENCH_H
+#define WATMETER_TEST_BENCH_H
+
 #include <Arduino.h>
 
+// Stored raw in EEPROM (Storage.h), so only fixed width fields and the AVR layout
 struct Settings {
-    int maxCurrent;
-    int maxThrust;
-    int midTestDuration;
-    int maxTestDuration;
-//    int testCycles;
-    int warmUptime;
-    float currentOffset;
-    float voltageOffset;
-    float thrustOffset;
+    int16_t maxCurrent;
+    int16_t maxThrust;
+    int16_t midTestDuration;
+    int16_t maxTestDuration;
+//    int16_t testCycles;
+    int16_t warmUptime;
+    uint8_t unusedOffsets[12];  // Were three float offsets, superseded by Calibration.h; kept for the stored layout
 };
 
 struct WattmeterValues {
     int throttle;
-    float voltage;
-    float current;
-    long power;
-    int consumption;
+    long voltage;       // mV
+    long current;       // mA
+    long power;         // mW
+    long consumption;   // mAh
     int thrust;
 };
 
-struct AverageValues {
-    int samples;
-    WattmeterValues values;
-};
-
-void pressInterrupt();
-void configureCommon();
-void configureDistinct();
+void acquisitionTask();
+WattmeterValues valuesFromQ(long currentQ, long voltageQ, long thrust);
+void streamBlock(long currentQ, long voltageQ, long thrust, unsigned long timestamp);
+void recordRawEvents();
+void safetyTask();
+void escTask();
+void autoTestTask();
+void serialTask();
+bool throttleCommand(uint8_t argc, char** argv);
+bool armCommand(uint8_t argc, char** argv);
+bool disarmCommand(uint8_t argc, char** argv);
+bool tareCommand(uint8_t argc, char** argv);
+bool valuesCommand(uint8_t argc, char** argv);
+bool streamCommand(uint8_t argc, char** argv);
+bool getCommand(uint8_t argc, char** argv);
+bool setCommand(uint8_t argc, char** argv);
+bool profileCommand(uint8_t argc, char** argv);
+bool resultsCommand(uint8_t argc, char** argv);
+bool curveCommand(uint8_t argc, char** argv);
+bool logCommand(uint8_t argc, char** argv);
+bool adcCommand(uint8_t argc, char** argv);
+bool filterCommand(uint8_t argc, char** argv);
+bool setFilter(uint8_t channel, uint8_t type, uint8_t length);
+bool channelFromName(const char* name, uint8_t& channel);
+void captureCalibration(uint8_t channel, long reference);
+long calibrationUnits(uint8_t channel, long input);
+bool calibrationCommand(uint8_t argc, char** argv);
+bool perfCommand(uint8_t argc, char** argv);
+void logRun(uint8_t flags, unsigned long duration);
+void setEscOutput(int pulse);
+void displayTask();
+void telemetryTask();
+void showMessage(const __FlashStringHelper* line1, const __FlashStringHelper* line2);
+bool displayMessage();
+void buttonTask();
+void storageTask();
 void buttonPressed(int button);
 void toggleScreenMode();
-String fixedLength(String str, int len);
-void  processMaxValues();
-void processAverageValues();
-void displayValues(String header, WattmeterValues readings);
-void displayAverageValues(String header, AverageValues val);
+bool throttleAtZero();
+bool onValuesScreen();
+void abortAutomaticTest();
+void processStatistics();
+void displayValues(const char* header, WattmeterValues readings);
+void displayValues(const __FlashStringHelper* header, WattmeterValues readings);
+struct WattmeterStats;
+void displayAverageValues(const __FlashStringHelper* header, const WattmeterStats& stats);
+void displayMaximumValues(const __FlashStringHelper* header, const WattmeterStats& stats);
+void displayCurve();
 void settingsValues();
 void calibrationValues();
 void displayCurrentCutoffError();
@@ -45,8 +80,9 @@ void writeEepromSettings(Settings values);
 bool settingsDiff(Settings values);
 void displayAutoTestResultMenu();
 void displayAutoTestStart();
-void displayAutoTestPage1();
-void displayAutoTestPage2();
+void displayAutoTestSegment();
 void displayAutoTestEnd();
-void printDebug(String string);
+void printDebug(const __FlashStringHelper* label, long value);
 void printDebugNewLine();
+
+#endif
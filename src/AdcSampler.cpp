@@ -0,0 +1,175 @@
+#include <Arduino.h>
+#include "AdcSampler.h"
+#include "RingBuffer.h"
+#include "Hal.h"
+
+/*
+Interrupt driven acquisition of the current and voltage channels.
+
+Every conversion complete interrupt (adcConversionComplete()) stores the result, selects the next
+channel and starts the next conversion, so sampling runs at a fixed rate no
+matter what loop() is doing. Current and voltage are converted alternately and
+summed into a block of 4^n pairs (adcSetOversampling()), which is time stamped
+and queued for loop(). Independently of the block size, every
+ADC_SAFETY_SAMPLES pairs the current sum is passed through the cutoff's
+current filter and posted for the safety monitor, and the throttle pot is
+converted once, so a large block never slows down
+the cutoff or the throttle.
+The channel is switched before the next conversion is started, which avoids
+the one conversion lag of the free running mode when the mux changes.
+
+With sleep enabled, loop() puts the CPU in idle sleep whenever no task is
+due (see adcSleep()), so the CPU core is quiet during most conversions.
+*/
+
+enum AdcSlot { SLOT_CURRENT, SLOT_VOLTAGE, SLOT_THROTTLE };
+
+static uint8_t slotPin[3];
+static volatile uint8_t adcSlot;
+static AdcBlock pendingBlock;
+static RingBuffer<AdcBlock, ADC_QUEUE_SIZE> adcQueue;
+static volatile int throttleValue;
+static volatile unsigned int blockSamples = 1 << (2 * ADC_OVERSAMPLE_BITS);
+static uint8_t oversampleBits = ADC_OVERSAMPLE_BITS;
+static bool sleepEnabled;
+static unsigned long safetySum;
+static Filter safetyFilter;
+static uint8_t safetySamples;
+static volatile unsigned long latestCurrentSum;
+static volatile unsigned long latestCurrentTimestamp;
+static volatile unsigned int overruns;
+
+static inline void startConversion(uint8_t slot) {
+    adcSlot = slot;
+    halAdcStart(slotPin[slot]);
+}
+
+void adcBegin(uint8_t currentPin, uint8_t voltagePin, uint8_t throttlePin) {
+    slotPin[SLOT_CURRENT] = currentPin;
+    slotPin[SLOT_VOLTAGE] = voltagePin;
+    slotPin[SLOT_THROTTLE] = throttlePin;
+
+    pendingBlock = { 0, 0, 0, 0 };
+    safetySum = 0;
+    safetySamples = 0;
+    adcQueue.clear();
+    halAdcBegin(slotPin, 3);
+    startConversion(SLOT_THROTTLE); // Have a throttle reading before the first block
+}
+
+bool adcReadBlock(AdcBlock& block) {
+    return adcQueue.pop(block);
+}
+
+int adcThrottleValue() {
+    int value;
+    uint8_t oldSREG = SREG;
+    cli();
+    value = throttleValue;
+    SREG = oldSREG;
+    return value;
+}
+
+// Sum of the last ADC_SAFETY_SAMPLES current conversions, for the safety monitor; does not consume the queue
+void adcLatestCurrent(unsigned long& sum, unsigned long& timestamp) {
+    uint8_t oldSREG = SREG;
+    cli();
+    sum = latestCurrentSum;
+    timestamp = latestCurrentTimestamp;
+    SREG = oldSREG;
+}
+
+unsigned int adcOverruns() {
+    unsigned int value;
+    uint8_t oldSREG = SREG;
+    cli();
+    value = overruns;
+    SREG = oldSREG;
+    return value;
+}
+
+// Averages 4^bits pairs per block, ADC_OVERSAMPLE_MIN to ADC_OVERSAMPLE_MAX; restarts the block being summed
+bool adcSetOversampling(uint8_t bits) {
+    if (bits < ADC_OVERSAMPLE_MIN || bits > ADC_OVERSAMPLE_MAX) {
+        return false;
+    }
+    uint8_t oldSREG = SREG;
+    cli();
+    oversampleBits = bits;
+    blockSamples = 1 << (2 * bits);
+    pendingBlock = { 0, 0, 0, 0 };
+    SREG = oldSREG;
+    return true;
+}
+
+uint8_t adcOversampling() {
+    return oversampleBits;
+}
+
+unsigned int adcBlockSamples() {
+    return 1 << (2 * oversampleBits);
+}
+
+// Two conversions per pair plus one throttle conversion every ADC_SAFETY_SAMPLES pairs
+unsigned int adcBlockRate() {
+    unsigned long pairs = adcBlockSamples();
+    unsigned long blockUs = (2 * pairs * ADC_SAFETY_SAMPLES + pairs) * ADC_CONVERSION_US / ADC_SAFETY_SAMPLES;
+    return (unsigned int)(10000000UL / blockUs);
+}
+
+// Filter of the current sums the cutoff sees; restarts from the next sum
+bool adcSetCurrentFilter(uint8_t type, uint8_t length) {
+    uint8_t oldSREG = SREG;
+    cli();
+    bool valid = filterConfigure(safetyFilter, type, length);
+    SREG = oldSREG;
+    return valid;
+}
+
+const Filter& adcCurrentFilter() {
+    return safetyFilter;
+}
+
+void adcSetSleep(bool enabled) {
+    sleepEnabled = enabled;
+}
+
+// True when loop() should sleep while it has nothing to do
+bool adcSleep() {
+    return sleepEnabled;
+}
+
+// Conversion complete interrupt
+void adcConversionComplete(uint16_t value) {
+    switch (adcSlot) {
+    case SLOT_CURRENT:
+        pendingBlock.currentSum += value;
+        safetySum += value;
+        startConversion(SLOT_VOLTAGE);
+        break;
+    case SLOT_VOLTAGE:
+        pendingBlock.voltageSum += value;
+        pendingBlock.samples++;
+        if (pendingBlock.samples >= blockSamples) {
+            pendingBlock.timestamp = micros();
+            if (!adcQueue.push(pendingBlock)) { // loop() fell behind, drop the block
+                overruns++;
+            }
+            pendingBlock = { 0, 0, 0, 0 };
+        }
+        if (++safetySamples >= ADC_SAFETY_SAMPLES) {
+            latestCurrentSum = filterUpdate(safetyFilter, safetySum);
+            latestCurrentTimestamp = micros();
+            safetySum = 0;
+            safetySamples = 0;
+            startConversion(SLOT_THROTTLE);
+        }
+        else {
+            startConversion(SLOT_CURRENT);
+        }
+        break;
+    default:
+        throttleValue = value;
+        startConversion(SLOT_CURRENT);
+    }
+}
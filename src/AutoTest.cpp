@@ -0,0 +1,118 @@
+#include <Arduino.h>
+#include "AutoTest.h"
+
+static void enterState(AutoTest& test, AutoTestState state, unsigned long now) {
+    test.state = state;
+    test.stateStart = now;
+    test.entered = true;
+}
+
+static void enterSegment(AutoTest& test, uint8_t segment, unsigned long now) {
+    const ProfileSegment& next = test.profile->segments[segment];
+    test.segment = segment;
+    test.startThrottle = test.throttle;
+    if (next.type == SEGMENT_STEP) {
+        test.throttle = next.throttle;
+    }
+    enterState(test, next.type == SEGMENT_RAMP ? AUTO_RAMP : AUTO_HOLD, now);
+}
+
+// Length of the current state, 0 for the states that only last one step
+static unsigned long stateDuration(const AutoTest& test) {
+    switch (test.state) {
+    case AUTO_COUNTDOWN:
+        return AUTO_TEST_COUNTDOWN_MS;
+    case AUTO_RAMP:
+    case AUTO_HOLD:
+        return test.profile->segments[test.segment].duration * 100UL;
+    case AUTO_FREEZE:
+        return AUTO_TEST_FREEZE_MS;
+    default:
+        return 0;
+    }
+}
+
+void autoTestBegin(AutoTest& test, const Profile& profile, unsigned long now) {
+    test.profile = &profile;
+    test.segment = 0;
+    test.cycle = 0;
+    test.throttle = 0;
+    test.startThrottle = 0;
+    enterState(test, profile.count > 0 ? AUTO_COUNTDOWN : AUTO_DONE, now);
+}
+
+AutoTestState autoTestStep(AutoTest& test, unsigned long now) {
+    test.entered = false;
+    if (test.state == AUTO_IDLE || test.state == AUTO_DONE) {
+        test.throttle = 0;
+        return test.state;
+    }
+
+    unsigned long duration = stateDuration(test);
+    unsigned long elapsed = now - test.stateStart;
+    bool expired = elapsed >= duration;
+
+    switch (test.state) {
+    case AUTO_COUNTDOWN:
+        if (expired) {
+            enterSegment(test, 0, now);
+        }
+        break;
+    case AUTO_RAMP: {
+        int target = test.profile->segments[test.segment].throttle;
+        if (expired) {
+            test.throttle = target;
+            enterState(test, AUTO_NEXT_SEGMENT, now);
+        }
+        else {
+            test.throttle = test.startThrottle + (long)(target - test.startThrottle) * (long)elapsed / (long)duration;
+        }
+        break;
+    }
+    case AUTO_HOLD:
+        if (expired) {
+            enterState(test, AUTO_NEXT_SEGMENT, now);
+        }
+        break;
+    case AUTO_NEXT_SEGMENT:     // Gives the caller one step to collect the results of the segment
+        if (test.segment + 1 < test.profile->count) {
+            enterSegment(test, test.segment + 1, now);
+        }
+        else if (test.cycle + 1 < test.profile->repeat) {
+            test.cycle++;
+            enterSegment(test, 0, now);
+        }
+        else {
+            test.throttle = 0;
+            enterState(test, AUTO_FREEZE, now);
+        }
+        break;
+    case AUTO_FREEZE:
+        if (expired) {
+            enterState(test, AUTO_DONE, now);
+        }
+        break;
+    default:
+        break;
+    }
+    return test.state;
+}
+
+void autoTestAbort(AutoTest& test) {
+    test.state = AUTO_IDLE;
+    test.entered = false;
+    test.throttle = 0;
+}
+
+bool autoTestEntered(const AutoTest& test) {
+    return test.entered;
+}
+
+unsigned long autoTestRemaining(const AutoTest& test, unsigned long now) {
+    if (test.state == AUTO_IDLE || test.state == AUTO_DONE) {
+        return 0;
+    }
+    unsigned long duration = stateDuration(test);
+    unsigned long elapsed = now - test.stateStart;
+    return elapsed < duration ? duration - elapsed : 0;
+}
@@ -0,0 +1,55 @@
+#include <Arduino.h>
+#include "AutoZero.h"
+
+void autoZeroBegin(AutoZero& tracker, long zero, long limit, long window, uint8_t shift) {
+    tracker.zero = zero;
+    tracker.centre = zero;
+    tracker.limit = limit;
+    tracker.window = window;
+    tracker.shift = shift;
+    tracker.accumulator = zero << shift;
+    tracker.samples = 0;
+    tracker.remaining = 0;
+}
+
+// Restarts a tare that is still running
+void autoZeroTare(AutoZero& tracker, uint8_t samples) {
+    if (samples == 0) {
+        return;
+    }
+    tracker.samples = samples;
+    tracker.remaining = samples;
+    tracker.accumulator = 0;
+}
+
+bool autoZeroTaring(const AutoZero& tracker) {
+    return tracker.remaining != 0;
+}
+
+// Feed every reading, idle when the sensor should read zero; true when the zero changed
+bool autoZeroUpdate(AutoZero& tracker, long reading, bool idle) {
+    long zero = tracker.zero;
+    if (tracker.remaining != 0) {
+        tracker.accumulator += reading;
+        if (--tracker.remaining != 0) {
+            return false;
+        }
+        long sum = tracker.accumulator;
+        long half = tracker.samples / 2;
+        tracker.zero = (sum + (sum < 0 ? -half : half)) / tracker.samples;
+        tracker.centre = tracker.zero;
+        tracker.accumulator = tracker.zero << tracker.shift;
+        return tracker.zero != zero;
+    }
+
+    if (!idle || reading - zero > tracker.window || zero - reading > tracker.window) {
+        return false;
+    }
+    tracker.accumulator += reading - (tracker.accumulator >> tracker.shift);
+    long tracked = constrain(tracker.accumulator >> tracker.shift, tracker.centre - tracker.limit, tracker.centre + tracker.limit);
+    if (tracked != tracker.accumulator >> tracker.shift) {
+        tracker.accumulator = tracked << tracker.shift;     // Hold at the limit instead of winding up
+    }
+    tracker.zero = tracked;
+    return tracked != zero;
+}
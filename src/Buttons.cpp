@@ -0,0 +1,91 @@
+#include <Arduino.h>
+#include "Buttons.h"
+#include "RingBuffer.h"
+#include "Hal.h"
+
+#define BUTTON_MAX              8
+#define REPEAT_DELAY_SCANS      (BUTTON_REPEAT_DELAY_MS / BUTTON_SCAN_TICKS)
+#define REPEAT_SCANS            (BUTTON_REPEAT_MS / BUTTON_SCAN_TICKS)
+#define LONG_PRESS_SCANS        (BUTTON_LONG_PRESS_MS / BUTTON_SCAN_TICKS)
+
+static_assert(LONG_PRESS_SCANS < 255, "Long press does not fit the held counter");
+
+static RingBuffer<ButtonEvent, BUTTON_QUEUE_SIZE> queue;
+static volatile uint8_t dropped;
+
+// Tick interrupt state
+static uint8_t buttonCount;
+static uint8_t ticks;
+static uint8_t lastScan;
+static uint8_t stableScans;
+static uint8_t stable;
+static uint8_t held[BUTTON_MAX];        // Scans since the press, saturates
+static uint8_t repeat[BUTTON_MAX];      // Scans to the next repeat
+
+// Scanning starts with the next tick
+void buttonsBegin(uint8_t count) {
+    buttonCount = min(count, (uint8_t)BUTTON_MAX);
+}
+
+bool buttonsRead(ButtonEvent& event) {
+    return queue.pop(event);
+}
+
+// Producer side of the queue: the tick interrupt, or the replay in the native build
+bool buttonsPost(uint8_t button, uint8_t type, unsigned long timestamp) {
+    ButtonEvent event = { button, type, timestamp };
+    if (!queue.push(event)) {
+        dropped++;
+        return false;
+    }
+    return true;
+}
+
+uint8_t buttonsDropped() {
+    return dropped;
+}
+
+// 1kHz tick interrupt
+void buttonsTick() {
+    if (buttonCount == 0 || ++ticks < BUTTON_SCAN_TICKS) {
+        return;
+    }
+    ticks = 0;
+
+    uint8_t scan = halButtonsScan();
+    if (scan != lastScan) {
+        lastScan = scan;
+        stableScans = 0;
+    }
+    else if (stableScans < BUTTON_DEBOUNCE_SCANS) {
+        stableScans++;
+    }
+    uint8_t previous = stable;
+    if (stableScans == BUTTON_DEBOUNCE_SCANS) {
+        stable = scan;
+    }
+    if (stable == 0) {
+        return;
+    }
+
+    unsigned long now = micros();
+    for (uint8_t i = 0; i < buttonCount; i++) {
+        uint8_t mask = 1 << i;
+        if (!(stable & mask)) {
+            continue;
+        }
+        if (!(previous & mask)) {
+            held[i] = 0;
+            repeat[i] = REPEAT_DELAY_SCANS;
+            buttonsPost(i, BUTTON_PRESS, now);
+            continue;
+        }
+        if (held[i] < 255 && ++held[i] == LONG_PRESS_SCANS) {
+            buttonsPost(i, BUTTON_LONG_PRESS, now);
+        }
+        if (--repeat[i] == 0) {
+            repeat[i] = REPEAT_SCANS;
+            buttonsPost(i, BUTTON_REPEAT, now);
+        }
+    }
+}
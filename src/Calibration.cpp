@@ -0,0 +1,271 @@
+#include <Arduino.h>
+#include "Calibration.h"
+#include "Storage.h"
+
+#define CALIBRATION_UNITY   (1L << CALIBRATION_GAIN_BITS)
+#define CALIBRATION_SPAN    32767L      // Largest distance from a segment start, keeps the multiply in 32 bits
+
+static const char modeNames[][7] PROGMEM = { "OFF", "LINEAR", "TABLE" };
+
+static_assert(CALIBRATION_EEPROM_ADDRESS + CALIBRATION_CHANNELS * CALIBRATION_EEPROM_SIZE <= STORAGE_LOG_ADDRESS, "Calibration overlaps the run log");
+static_assert(3 + sizeof(CalibrationTable) <= STORAGE_QUEUE_SIZE, "Calibration does not fit the write queue");
+
+// output + (input - start) * gain from start on; the first segment also covers readings below it
+struct CalibrationSegment {
+    int16_t input;
+    int16_t output;
+    uint16_t gain;          // Q15, below 2 (validGain())
+};
+
+static CalibrationSegment segments[CALIBRATION_CHANNELS][CALIBRATION_POINTS - 1];
+static uint8_t segmentCount[CALIBRATION_CHANNELS];
+static uint8_t changes;
+
+static uint8_t captureState = CAPTURE_IDLE;
+static uint8_t captureChannel;
+static long captureReference;
+static long captureSum;
+static uint8_t captureCount;
+static bool capturePending;     // Averaged, waiting for calibrationCaptureSave()
+static long captureInput;
+
+static int address(uint8_t channel) {
+    return CALIBRATION_EEPROM_ADDRESS + channel * CALIBRATION_EEPROM_SIZE;
+}
+
+static uint8_t tableCrc(const CalibrationTable& table) {
+    return storageCrc(&table, sizeof(CalibrationTable));
+}
+
+static bool validGain(long gain) {
+    return gain > 0 && gain < 2 * CALIBRATION_UNITY;
+}
+
+// false when the points give a gain outside (0, 2); the segments are then undefined
+static bool compile(const CalibrationTable& table, CalibrationSegment* segment, uint8_t& count) {
+    count = 0;
+    if (table.mode == CALIBRATION_OFF || table.count == 0) {
+        return true;
+    }
+    if (table.count == 1) {
+        segment[0].input = table.points[0].input;
+        segment[0].output = table.points[0].reference;
+        segment[0].gain = CALIBRATION_UNITY;
+        count = 1;
+        return true;
+    }
+
+    if (table.mode == CALIBRATION_LINEAR) {
+        // Fitted around the means, which keeps the float sums small
+        float meanInput = 0;
+        float meanReference = 0;
+        for (uint8_t i = 0; i < table.count; i++) {
+            meanInput += table.points[i].input;
+            meanReference += table.points[i].reference;
+        }
+        meanInput /= table.count;
+        meanReference /= table.count;
+        float sxx = 0;
+        float sxy = 0;
+        for (uint8_t i = 0; i < table.count; i++) {
+            float dx = table.points[i].input - meanInput;
+            sxx += dx * dx;
+            sxy += dx * (table.points[i].reference - meanReference);
+        }
+        long gain = (long)(sxy / sxx * CALIBRATION_UNITY + 0.5F);
+        if (!validGain(gain)) {
+            return false;
+        }
+        segment[0].input = (int16_t)lround(meanInput);
+        segment[0].output = (int16_t)lround(meanReference);
+        segment[0].gain = gain;
+        count = 1;
+        return true;
+    }
+
+    for (uint8_t i = 0; i + 1 < table.count; i++) {
+        long dx = (long)table.points[i + 1].input - table.points[i].input;
+        long dy = (long)table.points[i + 1].reference - table.points[i].reference;
+        long gain = (dy * CALIBRATION_UNITY + dx / 2) / dx;
+        if (!validGain(gain)) {
+            return false;
+        }
+        segment[i].input = table.points[i].input;
+        segment[i].output = table.points[i].reference;
+        segment[i].gain = gain;
+    }
+    count = table.count - 1;
+    return true;
+}
+
+static void emptyTable(CalibrationTable& table) {
+    memset(&table, 0, sizeof(CalibrationTable));
+    table.mode = CALIBRATION_LINEAR;
+}
+
+static bool save(uint8_t channel, const CalibrationTable& table) {
+    CalibrationSegment compiled[CALIBRATION_POINTS - 1];
+    uint8_t count;
+    if (!compile(table, compiled, count)) {
+        return false;
+    }
+    uint8_t crc = tableCrc(table);
+    uint8_t marker = CALIBRATION_EEPROM_MARKER;
+    storageWrite(address(channel) + 1, &table, sizeof(CalibrationTable));
+    storageWrite(address(channel) + 1 + sizeof(CalibrationTable), &crc, 1);
+    storageWrite(address(channel), &marker, 1);
+
+    memcpy(segments[channel], compiled, sizeof(compiled));
+    segmentCount[channel] = count;
+    changes++;
+    return true;
+}
+
+// Compiles the stored tables, a channel without a valid one reads uncorrected
+void calibrationBegin() {
+    CalibrationTable table;
+    for (uint8_t channel = 0; channel < CALIBRATION_CHANNELS; channel++) {
+        if (!calibrationLoad(channel, table) || !compile(table, segments[channel], segmentCount[channel])) {
+            segmentCount[channel] = 0;
+        }
+    }
+    changes++;
+}
+
+long calibrationApply(uint8_t channel, long input) {
+    uint8_t i = segmentCount[channel];
+    if (i == 0) {
+        return input;
+    }
+    const CalibrationSegment* segment = segments[channel];
+    for (i--; i > 0 && input < segment[i].input; i--) {
+    }
+    long dx = constrain(input - segment[i].input, -CALIBRATION_SPAN, CALIBRATION_SPAN);
+    return segment[i].output + ((dx * (long)segment[i].gain + CALIBRATION_UNITY / 2) >> CALIBRATION_GAIN_BITS);
+}
+
+// Reading that calibrates to output, used to turn limits into the cutoff's raw units
+long calibrationInverse(uint8_t channel, long output) {
+    uint8_t i = segmentCount[channel];
+    if (i == 0) {
+        return output;
+    }
+    const CalibrationSegment* segment = segments[channel];
+    for (i--; i > 0 && output < segment[i].output; i--) {
+    }
+    long dy = constrain(output - segment[i].output, -CALIBRATION_SPAN, CALIBRATION_SPAN);
+    long gain = segment[i].gain;
+    return segment[i].input + (dy * CALIBRATION_UNITY + (dy < 0 ? -gain : gain) / 2) / gain;
+}
+
+// Returns false and an empty LINEAR table when the EEPROM holds no valid one
+bool calibrationLoad(uint8_t channel, CalibrationTable& table) {
+    if (channel < CALIBRATION_CHANNELS && storageReadByte(address(channel)) == CALIBRATION_EEPROM_MARKER) {
+        storageRead(address(channel) + 1, &table, sizeof(CalibrationTable));
+        if (storageReadByte(address(channel) + 1 + sizeof(CalibrationTable)) == tableCrc(table)
+            && table.mode <= CALIBRATION_TABLE && table.count <= CALIBRATION_POINTS) {
+            return true;
+        }
+    }
+    emptyTable(table);
+    return false;
+}
+
+// A point at an input already in the table replaces it; false when the table is full or the fit fails
+bool calibrationAddPoint(uint8_t channel, long input, long reference) {
+    if (channel >= CALIBRATION_CHANNELS || input < -32768L || input > 32767L || reference < -32768L || reference > 32767L) {
+        return false;
+    }
+    CalibrationTable table;
+    calibrationLoad(channel, table);
+
+    uint8_t i = 0;
+    while (i < table.count && table.points[i].input < input) {
+        i++;
+    }
+    if (i == table.count || table.points[i].input != input) {
+        if (table.count >= CALIBRATION_POINTS) {
+            return false;
+        }
+        memmove(&table.points[i + 1], &table.points[i], (table.count - i) * sizeof(CalibrationPoint));
+        table.count++;
+    }
+    table.points[i].input = (int16_t)input;
+    table.points[i].reference = (int16_t)reference;
+    return save(channel, table);
+}
+
+bool calibrationSetMode(uint8_t channel, uint8_t mode) {
+    if (channel >= CALIBRATION_CHANNELS || mode > CALIBRATION_TABLE) {
+        return false;
+    }
+    CalibrationTable table;
+    calibrationLoad(channel, table);
+    table.mode = mode;
+    return save(channel, table);
+}
+
+void calibrationClear(uint8_t channel) {
+    if (channel >= CALIBRATION_CHANNELS) {
+        return;
+    }
+    uint8_t erased = 0xFF;
+    storageWrite(address(channel), &erased, 1);
+    segmentCount[channel] = 0;
+    changes++;
+}
+
+// Incremented whenever a correction changes, so derived limits can be refreshed
+uint8_t calibrationChanges() {
+    return changes;
+}
+
+// Averages the next CALIBRATION_CAPTURE_SAMPLES readings fed for the channel into a point
+void calibrationCaptureStart(uint8_t channel, long reference) {
+    captureChannel = channel;
+    captureReference = reference;
+    captureSum = 0;
+    captureCount = 0;
+    capturePending = false;
+    captureState = CAPTURE_RUNNING;
+}
+
+// Called with every uncorrected reading, in the channel's input domain; never writes the EEPROM
+void calibrationFeed(uint8_t channel, long input) {
+    if (captureState != CAPTURE_RUNNING || capturePending || channel != captureChannel) {
+        return;
+    }
+    captureSum += input;
+    if (++captureCount < CALIBRATION_CAPTURE_SAMPLES) {
+        return;
+    }
+    captureInput = (captureSum + (captureSum < 0 ? -CALIBRATION_CAPTURE_SAMPLES : CALIBRATION_CAPTURE_SAMPLES) / 2) / CALIBRATION_CAPTURE_SAMPLES;
+    capturePending = true;
+}
+
+// Stores a finished capture: fits the points and queues up to 28 EEPROM bytes, which storagePoll() writes
+void calibrationCaptureSave() {
+    if (!capturePending) {
+        return;
+    }
+    capturePending = false;
+    captureState = calibrationAddPoint(captureChannel, captureInput, captureReference) ? CAPTURE_DONE : CAPTURE_FAILED;
+}
+
+uint8_t calibrationCaptureState() {
+    return captureState;
+}
+
+const __FlashStringHelper* calibrationModeName(uint8_t mode) {
+    return mode <= CALIBRATION_TABLE ? reinterpret_cast<const __FlashStringHelper*>(modeNames[mode]) : F("?");
+}
+
+bool calibrationModeFromName(const char* name, uint8_t& mode) {
+    for (uint8_t i = 0; i <= CALIBRATION_TABLE; i++) {
+        if (strcasecmp_P(name, modeNames[i]) == 0) {
+            mode = i;
+            return true;
+        }
+    }
+    return false;
+}
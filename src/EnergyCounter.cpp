@@ -0,0 +1,36 @@
+#include <Arduino.h>
+#include "EnergyCounter.h"
+
+// Accumulators are doubled, so one mAh or mWh is 2 * 3600 * 10^6 units
+#define ENERGY_UNITS_PER_HOUR   7200000000ULL
+
+void energyReset(EnergyCounter& counter) {
+    counter.charge = 0;
+    counter.energy = 0;
+    counter.lastCurrent = 0;
+    counter.lastPower = 0;
+    counter.lastTimestamp = 0;
+    counter.started = false;
+}
+
+void energyAddSample(EnergyCounter& counter, long milliAmps, long milliWatts, unsigned long timestamp) {
+    if (counter.started) {
+        unsigned long dt = timestamp - counter.lastTimestamp;   // Wraps correctly with micros()
+        if (dt <= ENERGY_MAX_GAP_US) {
+            counter.charge += (uint64_t)(counter.lastCurrent + milliAmps) * dt;
+            counter.energy += (uint64_t)(counter.lastPower + milliWatts) * dt;
+        }
+    }
+    counter.lastCurrent = milliAmps;
+    counter.lastPower = milliWatts;
+    counter.lastTimestamp = timestamp;
+    counter.started = true;
+}
+
+long energyMilliAmpHours(const EnergyCounter& counter) {
+    return (long)(counter.charge / ENERGY_UNITS_PER_HOUR);
+}
+
+long energyMilliWattHours(const EnergyCounter& counter) {
+    return (long)(counter.energy / ENERGY_UNITS_PER_HOUR);
+}
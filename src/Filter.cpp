@@ -0,0 +1,122 @@
+#include <Arduino.h>
+#include "Filter.h"
+
+static const char typeNames[][7] PROGMEM = { "NONE", "MEDIAN", "IIR", "FIR" };
+
+// Rows 2 and 4 of Pascal's triangle, the coefficients of the 3 and 5 tap FIR
+static const uint8_t binomial[][FILTER_MAX_TAPS] PROGMEM = {
+    { 1, 2, 1 },
+    { 1, 4, 6, 4, 1 }
+};
+
+static_assert(sizeof(binomial) / sizeof(binomial[0]) == (FILTER_MAX_TAPS - 1) / 2, "No FIR coefficients for some lengths");
+
+// false for a length the type does not support; the filter is left as it was
+bool filterConfigure(Filter& filter, uint8_t type, uint8_t length) {
+    switch (type) {
+    case FILTER_NONE:
+        length = 1;
+        break;
+    case FILTER_MEDIAN:
+    case FILTER_FIR:
+        if (length < 3 || length > FILTER_MAX_TAPS || (length & 1) == 0) {
+            return false;
+        }
+        break;
+    case FILTER_IIR:
+        if (length < 1 || length > FILTER_IIR_MAX) {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    filter.type = type;
+    filter.length = length;
+    filterReset(filter);
+    return true;
+}
+
+void filterReset(Filter& filter) {
+    filter.next = 0;
+    filter.primed = false;
+}
+
+long filterUpdate(Filter& filter, long sample) {
+    if (filter.type == FILTER_NONE) {
+        return sample;
+    }
+    if (filter.type == FILTER_IIR) {
+        long& state = filter.window[0];
+        if (!filter.primed) {
+            state = sample * (1L << filter.length);
+            filter.primed = true;
+        }
+        state += sample - (state >> filter.length);
+        return state >> filter.length;
+    }
+
+    if (!filter.primed) {
+        for (uint8_t i = 0; i < filter.length; i++) {
+            filter.window[i] = sample;
+        }
+        filter.primed = true;
+    }
+    filter.window[filter.next] = sample;
+    if (++filter.next >= filter.length) {
+        filter.next = 0;
+    }
+
+    if (filter.type == FILTER_MEDIAN) {
+        long sorted[FILTER_MAX_TAPS];
+        for (uint8_t i = 0; i < filter.length; i++) {   // Insertion sort, at most 5 samples
+            long value = filter.window[i];
+            uint8_t j = i;
+            while (j > 0 && sorted[j - 1] > value) {
+                sorted[j] = sorted[j - 1];
+                j--;
+            }
+            sorted[j] = value;
+        }
+        return sorted[filter.length / 2];
+    }
+
+    // FIR, oldest sample first; the coefficients are symmetric so the order only matters for clarity
+    const uint8_t* coefficients = binomial[(filter.length - 3) / 2];
+    long sum = 0;
+    uint8_t index = filter.next;
+    for (uint8_t i = 0; i < filter.length; i++) {
+        sum += filter.window[index] * pgm_read_byte(&coefficients[i]);
+        if (++index >= filter.length) {
+            index = 0;
+        }
+    }
+    return sum >> (filter.length - 1);
+}
+
+unsigned int filterDelay(const Filter& filter) {
+    switch (filter.type) {
+    case FILTER_MEDIAN:
+    case FILTER_FIR:
+        return (filter.length - 1) / 2;
+    case FILTER_IIR:
+        return (1 << filter.length) - 1;
+    default:
+        return 0;
+    }
+}
+
+const __FlashStringHelper* filterTypeName(uint8_t type) {
+    return type <= FILTER_FIR ? reinterpret_cast<const __FlashStringHelper*>(typeNames[type]) : F("?");
+}
+
+bool filterTypeFromName(const char* name, uint8_t& type) {
+    for (uint8_t i = 0; i <= FILTER_FIR; i++) {
+        if (strcasecmp_P(name, typeNames[i]) == 0) {
+            type = i;
+            return true;
+        }
+    }
+    return false;
+}
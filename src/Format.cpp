@@ -0,0 +1,88 @@
+#include <Arduino.h>
+#include "Format.h"
+
+static const long POWERS_OF_TEN[] PROGMEM = { 1, 10, 100, 1000, 10000, 100000 };
+#define FORMAT_MAX_DECIMALS 5
+
+static uint8_t appendText(char* buf, uint8_t pos, uint8_t width, const __FlashStringHelper* text) {
+    const char* p = reinterpret_cast<const char*>(text);
+    char c;
+    while ((c = pgm_read_byte(p++)) != '\0' && pos < width) {
+        buf[pos++] = c;
+    }
+    return pos;
+}
+
+static long powerOfTen(uint8_t decimals) {
+    long power;
+    memcpy_P(&power, &POWERS_OF_TEN[decimals], sizeof(power));
+    return power;
+}
+
+// Appends magnitude with at least minDigits digits, zero padded
+static uint8_t appendDigits(char* buf, uint8_t pos, uint8_t width, unsigned long magnitude, uint8_t minDigits) {
+    char digits[10];
+    uint8_t count = 0;
+    do {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0 && count < sizeof(digits));
+    while (count < minDigits) {
+        digits[count++] = '0';
+    }
+    while (count > 0 && pos < width) {
+        buf[pos++] = digits[--count];
+    }
+    return pos;
+}
+
+static uint8_t appendFixed(char* buf, uint8_t pos, uint8_t width, long value, uint8_t decimals) {
+    if (decimals > FORMAT_MAX_DECIMALS) {
+        decimals = FORMAT_MAX_DECIMALS;
+    }
+    unsigned long magnitude = value < 0 ? -(unsigned long)value : value;
+    if (value < 0 && pos < width) {
+        buf[pos++] = '-';
+    }
+    pos = appendDigits(buf, pos, width, magnitude / powerOfTen(decimals), 1);
+    if (decimals > 0) {
+        if (pos < width) {
+            buf[pos++] = '.';
+        }
+        pos = appendDigits(buf, pos, width, magnitude % powerOfTen(decimals), decimals);
+    }
+    return pos;
+}
+
+static char* finish(char* buf, uint8_t pos, uint8_t width) {
+    while (pos < width) {
+        buf[pos++] = ' ';
+    }
+    buf[width] = '\0';
+    return buf;
+}
+
+char* formatTextField(char* buf, uint8_t width, const __FlashStringHelper* text) {
+    return finish(buf, appendText(buf, 0, width, text), width);
+}
+
+char* formatField(char* buf, uint8_t width, const __FlashStringHelper* prefix, long value, const __FlashStringHelper* unit) {
+    return formatFixedField(buf, width, prefix, value, 0, unit);
+}
+
+char* formatFixedField(char* buf, uint8_t width, const __FlashStringHelper* prefix, long value, uint8_t decimals, const __FlashStringHelper* unit) {
+    uint8_t pos = appendText(buf, 0, width, prefix);
+    pos = appendFixed(buf, pos, width, value, decimals);
+    pos = appendText(buf, pos, width, unit);
+    return finish(buf, pos, width);
+}
+
+char* formatFloatField(char* buf, uint8_t width, const __FlashStringHelper* prefix, float value, uint8_t decimals, const __FlashStringHelper* unit) {
+    if (decimals > FORMAT_MAX_DECIMALS) {
+        decimals = FORMAT_MAX_DECIMALS;
+    }
+    float scaled = value * powerOfTen(decimals);
+    scaled += scaled < 0 ? -0.5f : 0.5f;    // Round like String(float) does
+    long fixed = scaled > 2147483000.0f ? 2147483000L : scaled < -2147483000.0f ? -2147483000L : (long)scaled;
+    return formatFixedField(buf, width, prefix, fixed, decimals, unit);
+}
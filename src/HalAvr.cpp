@@ -0,0 +1,418 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+#include <util/twi.h>
+#include "Hal.h"
+#include "AdcSampler.h"
+#include "LoadCell.h"
+#include "SafetyMonitor.h"
+#include "Buttons.h"
+#include "LcdFrameBuffer.h"
+#include "WatmeterTestBench.h"
+
+/*
+ATmega328P implementation of the HAL. Timer0 keeps millis(), Timer1 times
+the ESC pulses, Timer2 drives the 1kHz tick and the TWI talks to the
+display.
+*/
+
+#define ESC_FRAME_US        20000   // Pulse period, as the Servo library
+
+static volatile uint8_t* escOut;
+static uint8_t escMask;
+static volatile unsigned int escTicks;  // Timer1 ticks of 0.5us
+static unsigned int escPulse;           // Ticks of the pulse in progress
+static int escMinPulse;
+static int escMaxPulse;
+
+static volatile uint8_t* doutIn;
+static uint8_t doutMask;
+static volatile uint8_t* sckOut;
+static uint8_t sckMask;
+
+#define BUTTON_PINS_MAX     8
+
+static volatile uint8_t* buttonInputs[BUTTON_PINS_MAX];
+static uint8_t buttonMasks[BUTTON_PINS_MAX];
+static uint8_t buttonCount;
+
+void halAdcBegin(const uint8_t* pins, uint8_t count) {
+    // Digital input buffers only add noise on analog inputs (A6/A7 have none)
+    for (uint8_t i = 0; i < count; i++) {
+        if (pins[i] < A6)
+            DIDR0 |= _BV(pins[i] - A0);
+    }
+    ADCSRB = 0;
+    ADCSRA = _BV(ADEN) | _BV(ADIE) | ADC_PRESCALER;
+}
+
+void halAdcStart(uint8_t pin) {
+    ADMUX = _BV(REFS0) | (pin - A0);    // AVcc reference, same as analogRead()
+    ADCSRA |= _BV(ADSC);
+}
+
+ISR(ADC_vect) {
+    adcConversionComplete(ADC);
+}
+
+/*
+The HX711 pulls DOUT low when a conversion is ready. A pin change interrupt
+on DOUT clocks the 24 data bits plus one gain pulse (channel A, gain 128)
+straight away, which takes ~30us with direct port access.
+
+DOUT has to be on port B (D8-D13), the pins served by PCINT0_vect.
+*/
+void halLoadCellBegin(uint8_t doutPin, uint8_t sckPin) {
+    pinMode(sckPin, OUTPUT);
+    pinMode(doutPin, INPUT);
+    digitalWrite(sckPin, LOW);
+
+    doutIn = portInputRegister(digitalPinToPort(doutPin));
+    doutMask = digitalPinToBitMask(doutPin);
+    sckOut = portOutputRegister(digitalPinToPort(sckPin));
+    sckMask = digitalPinToBitMask(sckPin);
+
+    *digitalPinToPCMSK(doutPin) |= _BV(digitalPinToPCMSKbit(doutPin));
+    PCIFR = _BV(digitalPinToPCICRbit(doutPin));
+    *digitalPinToPCICR(doutPin) |= _BV(digitalPinToPCICRbit(doutPin));
+}
+
+ISR(PCINT0_vect) {
+    if (*doutIn & doutMask) {   // Rising edge or some other pin on the port
+        return;
+    }
+
+    long value = 0;
+    for (uint8_t i = 0; i < 24; i++) {
+        *sckOut |= sckMask;
+        delayMicroseconds(1);
+        value <<= 1;
+        if (*doutIn & doutMask) {
+            value |= 1;
+        }
+        *sckOut &= ~sckMask;
+        delayMicroseconds(1);
+    }
+    *sckOut |= sckMask;     // 25th pulse keeps channel A with gain 128
+    delayMicroseconds(1);
+    *sckOut &= ~sckMask;
+
+    if (value & 0x800000L) {
+        value |= 0xFF000000L;   // Sign extend the 24 bit two's complement result
+    }
+    loadCellConversionComplete(value);
+
+    PCIFR = _BV(PCIF0);     // Data bits toggled DOUT while clocking, drop those edges
+}
+
+void halTickBegin() {
+    uint8_t oldSREG = SREG;
+    cli();
+    TCCR2A = _BV(WGM21);    // CTC
+    TCCR2B = _BV(CS22);     // 16MHz/64 = 250kHz
+    OCR2A = 249;            // 250kHz/250 = 1kHz
+    TCNT2 = 0;
+    TIMSK2 = _BV(OCIE2A);
+    SREG = oldSREG;
+}
+
+ISR(TIMER2_COMPA_vect) {
+    safetyTick();
+    buttonsTick();
+}
+
+/*
+One ESC needs none of the Servo library's 12 channel table: Timer1 runs free
+at 2MHz and its compare interrupt raises the pin, then drops it escTicks
+later and waits out the rest of the frame. The pin's own output latch tells
+the two apart.
+*/
+void halEscBegin(uint8_t pin, int minPulse, int maxPulse) {
+    pinMode(pin, OUTPUT);
+    digitalWrite(pin, LOW);
+    escOut = portOutputRegister(digitalPinToPort(pin));
+    escMask = digitalPinToBitMask(pin);
+    escMinPulse = minPulse;
+    escMaxPulse = maxPulse;
+    halEscWrite(minPulse);
+
+    uint8_t oldSREG = SREG;
+    cli();
+    TCCR1A = 0;             // Normal mode
+    TCCR1B = _BV(CS11);     // 16MHz/8 = 2MHz
+    TCNT1 = 0;
+    OCR1A = ESC_FRAME_US * 2;
+    TIFR1 = _BV(OCF1A);
+    TIMSK1 = _BV(OCIE1A);
+    SREG = oldSREG;
+}
+
+ISR(TIMER1_COMPA_vect) {
+    if (*escOut & escMask) {
+        *escOut &= ~escMask;
+        OCR1A += ESC_FRAME_US * 2 - escPulse;
+    }
+    else {
+        escPulse = escTicks;
+        *escOut |= escMask;
+        OCR1A += escPulse;
+    }
+}
+
+// Clamped to the pulse range like Servo::writeMicroseconds(); the next frame picks it up
+void halEscWrite(int pulse) {
+    unsigned int ticks = constrain(pulse, escMinPulse, escMaxPulse) * 2;
+    uint8_t oldSREG = SREG;
+    cli();
+    escTicks = ticks;
+    SREG = oldSREG;
+}
+
+int halEscRead() {
+    uint8_t oldSREG = SREG;
+    cli();
+    unsigned int ticks = escTicks;
+    SREG = oldSREG;
+    return ticks / 2;
+}
+
+/*
+The buttons sit between their own pin and the common pin, which is held
+low, so every button reads on its own pulled up pin and the tick can poll
+them without touching a pin mode. The port registers are looked up once, a
+scan is a few loads.
+*/
+void halButtonsBegin(uint8_t commonPin, const int* pins, uint8_t count) {
+    pinMode(commonPin, OUTPUT);
+    digitalWrite(commonPin, LOW);
+
+    buttonCount = min(count, (uint8_t)BUTTON_PINS_MAX);
+    for (uint8_t i = 0; i < buttonCount; i++) {
+        pinMode(pins[i], INPUT_PULLUP);
+        buttonInputs[i] = portInputRegister(digitalPinToPort(pins[i]));
+        buttonMasks[i] = digitalPinToBitMask(pins[i]);
+    }
+}
+
+uint8_t halButtonsScan() {
+    uint8_t pressed = 0;
+    for (uint8_t i = 0; i < buttonCount; i++) {
+        if (!(*buttonInputs[i] & buttonMasks[i])) {
+            pressed |= 1 << i;
+        }
+    }
+    return pressed;
+}
+
+/*
+The HD44780 sits behind a PCF8574 I2C port expander (P0 RS, P1 RW, P2 E,
+P3 backlight, P4-P7 D4-D7) and is only ever written. A byte goes out in one
+TWI transfer as four expander writes, each nibble with E high then low, so a
+character takes ~0.5ms at 100kHz. The TWI is polled directly: the Wire and
+LiquidCrystal_I2C libraries would cost over 200 bytes of SRAM in buffers
+this never needs.
+*/
+#define TWI_FREQUENCY       100000L
+#define TWI_TIMEOUT_US      1000    // A byte takes 90us at 100kHz, longer means the bus is stuck
+#define LCD_RS              0x01
+#define LCD_ENABLE          0x04
+#define LCD_BACKLIGHT       0x08
+#define LCD_CLEAR           0x01
+#define LCD_ENTRY_LEFT      0x06
+#define LCD_DISPLAY_ON      0x0C
+#define LCD_4BIT_2LINE      0x28
+#define LCD_SET_DDRAM       0x80
+
+static const uint8_t lcdRowOffsets[LCD_ROWS] PROGMEM = { 0x00, 0x40, 0x14, 0x54 };
+
+// SDA or SCL driven low, or released to the pull up, at about 100kHz
+static void twiLine(uint8_t pin, bool high) {
+    if (high) {
+        pinMode(pin, INPUT_PULLUP);
+    }
+    else {
+        digitalWrite(pin, LOW);
+        pinMode(pin, OUTPUT);
+    }
+    delayMicroseconds(5);
+}
+
+/*
+A slave that lost clocks holds SDA low and the TWI waits forever for the bus.
+Nine clocks finish any byte it is stuck in, a STOP releases it and the TWI
+starts again from idle; the transfer that timed out is lost.
+*/
+static void twiRecover() {
+    TWCR = 0;                   // The port drives the pins again
+    twiLine(SDA, true);
+    for (uint8_t i = 0; i < 9; i++) {
+        twiLine(SCL, false);
+        twiLine(SCL, true);
+    }
+    twiLine(SCL, false);
+    twiLine(SDA, false);
+    twiLine(SCL, true);
+    twiLine(SDA, true);
+    TWCR = _BV(TWEN);
+}
+
+// false, after recovering the bus, when the TWI does not finish within TWI_TIMEOUT_US
+static bool twiWait() {
+    unsigned long start = micros();
+    while (!(TWCR & _BV(TWINT))) {
+        if (micros() - start > TWI_TIMEOUT_US) {
+            twiRecover();
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool twiStart(uint8_t address) {
+    TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+    if (!twiWait()) {
+        return false;
+    }
+    TWDR = address << 1 | TW_WRITE;
+    TWCR = _BV(TWINT) | _BV(TWEN);
+    return twiWait() && TW_STATUS == TW_MT_SLA_ACK;
+}
+
+static bool twiWrite(uint8_t data) {
+    TWDR = data;
+    TWCR = _BV(TWINT) | _BV(TWEN);
+    return twiWait();
+}
+
+static void twiStop() {
+    TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+    unsigned long start = micros();
+    while (TWCR & _BV(TWSTO)) {
+        if (micros() - start > TWI_TIMEOUT_US) {
+            twiRecover();
+            return;
+        }
+    }
+}
+
+// The high nibble of bits on D4-D7, latched by the falling edge of E
+static bool lcdNibble(uint8_t bits) {
+    bits |= LCD_BACKLIGHT;
+    return twiWrite(bits | LCD_ENABLE) && twiWrite(bits);
+}
+
+// A display without acknowledge or a stuck bus is skipped, the firmware runs on without it
+static void lcdSend(uint8_t value, uint8_t mode) {
+    if (twiStart(LCD_I2C_ADDRESS) && lcdNibble((value & 0xF0) | mode)) {
+        lcdNibble((value << 4) | mode);
+    }
+    twiStop();
+}
+
+// Only the high nibble, while the controller may still be in 8 bit mode
+static void lcdSendNibble(uint8_t value) {
+    if (twiStart(LCD_I2C_ADDRESS)) {
+        lcdNibble(value);
+    }
+    twiStop();
+}
+
+void halLcdBegin() {
+    digitalWrite(SDA, HIGH);    // Internal pull ups, as Wire does
+    digitalWrite(SCL, HIGH);
+    TWSR = 0;                   // Prescaler 1
+    TWBR = (F_CPU / TWI_FREQUENCY - 16) / 2;
+    TWCR = _BV(TWEN);
+
+    delay(50);                  // HD44780 power on
+    lcdSendNibble(0x30);        // 8 bit mode three times resets the interface from any state
+    delayMicroseconds(4500);
+    lcdSendNibble(0x30);
+    delayMicroseconds(4500);
+    lcdSendNibble(0x30);
+    delayMicroseconds(150);
+    lcdSendNibble(0x20);        // Then 4 bit mode
+    lcdSend(LCD_4BIT_2LINE, 0);
+    lcdSend(LCD_DISPLAY_ON, 0);
+    lcdSend(LCD_ENTRY_LEFT, 0);
+    halLcdClear();
+}
+
+void halLcdClear() {
+    lcdSend(LCD_CLEAR, 0);
+    delayMicroseconds(2000);    // The only slow command
+}
+
+void halLcdSetCursor(uint8_t col, uint8_t row) {
+    if (row >= LCD_ROWS) {
+        row = LCD_ROWS - 1;
+    }
+    lcdSend(LCD_SET_DDRAM | (col + pgm_read_byte(&lcdRowOffsets[row])), 0);
+}
+
+void halLcdWrite(uint8_t c) {
+    lcdSend(c, LCD_RS);
+}
+
+uint8_t halEepromRead(int address) {
+    return EEPROM.read(address);
+}
+
+void halEepromWrite(int address, uint8_t value) {
+    EEPROM.write(address, value);
+}
+
+bool halEepromReady() {
+    return eeprom_is_ready();
+}
+
+/*
+Idle mode only stops the CPU core. ADC noise reduction mode would be quieter
+still, but it also stops Timer0 and Timer1, that is millis() and the ESC
+pulses. Any interrupt wakes the CPU, at the latest the 1kHz tick.
+*/
+void halSleep() {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
+}
+
+#if INSTRUMENTATION
+/*
+Stack high-water mark: before the C runtime sets up anything, .init3 fills
+the free SRAM from the end of .bss to the top of the stack with a canary.
+The bytes above the heap still holding it were never used by the stack.
+*/
+#define STACK_CANARY    0xC5
+
+extern uint8_t _end;
+extern uint8_t __stack;
+extern char* __brkval;
+
+void halStackPaint() __attribute__((naked, used, section(".init3")));
+void halStackPaint() {
+    uint8_t* p = &_end;
+    while (p <= &__stack) {
+        *p++ = STACK_CANARY;
+    }
+}
+
+static const uint8_t* heapEnd() {
+    return __brkval != 0 ? (const uint8_t*)__brkval : &_end;
+}
+
+unsigned int halFreeMemory() {
+    uint8_t top;
+    return &top - heapEnd();
+}
+
+unsigned int halStackUnused() {
+    const uint8_t* p = heapEnd();
+    unsigned int count = 0;
+    while (p <= &__stack && *p == STACK_CANARY) {
+        p++;
+        count++;
+    }
+    return count;
+}
+#endif
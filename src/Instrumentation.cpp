@@ -0,0 +1,92 @@
+#include <Arduino.h>
+#include "Instrumentation.h"
+
+#if INSTRUMENTATION
+
+/*
+Stage statistics are written from loop() and, for STAGE_SAFETY_TICK, from
+the tick interrupt. Every stage has a single writer, so only readers have
+to mask interrupts.
+*/
+
+static const char stageNames[STAGE_COUNT][10] PROGMEM = {
+    "ACQ", "STATS", "TICK", "SAFETY", "ESC", "AUTO", "SERIAL", "DISPLAY", "LCD", "TELEMETRY", "BUTTONS", "EEPROM"
+};
+
+static StageStats stages[STAGE_COUNT];
+static unsigned long loops;
+static unsigned long resetTime;
+static unsigned long lastLoop;
+static unsigned long loopGap;
+
+void instrumentReset() {
+    uint8_t oldSREG = SREG;
+    cli();
+    memset(stages, 0, sizeof(stages));
+    for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+        stages[i].minimum = 0xFFFF;
+    }
+    SREG = oldSREG;
+    loops = 0;
+    loopGap = 0;
+    resetTime = lastLoop = micros();
+}
+
+void instrumentRecord(uint8_t stage, unsigned long duration) {
+    StageStats& stats = stages[stage];
+    unsigned int clipped = duration > 0xFFFF ? 0xFFFF : duration;
+
+    stats.count++;
+    stats.total += duration;
+    if (clipped < stats.minimum) {
+        stats.minimum = clipped;
+    }
+    if (clipped > stats.maximum) {
+        stats.maximum = clipped;
+    }
+
+    uint8_t bin = 0;
+    for (unsigned int limit = 16; bin < INSTRUMENT_BINS - 1 && clipped >= limit; limit <<= 2) {
+        bin++;
+    }
+    if (stats.bins[bin] == 0xFFFF) {
+        for (uint8_t i = 0; i < INSTRUMENT_BINS; i++) {
+            stats.bins[i] >>= 1;
+        }
+    }
+    stats.bins[bin]++;
+}
+
+void instrumentLoop() {
+    unsigned long now = micros();
+    if (loops > 0 && now - lastLoop > loopGap) {
+        loopGap = now - lastLoop;
+    }
+    lastLoop = now;
+    loops++;
+}
+
+void instrumentRead(uint8_t stage, StageStats& stats) {
+    uint8_t oldSREG = SREG;
+    cli();
+    stats = stages[stage];
+    SREG = oldSREG;
+}
+
+const __FlashStringHelper* instrumentStageName(uint8_t stage) {
+    return stage < STAGE_COUNT ? reinterpret_cast<const __FlashStringHelper*>(stageNames[stage]) : F("?");
+}
+
+unsigned long instrumentLoops() {
+    return loops;
+}
+
+unsigned long instrumentElapsed() {
+    return micros() - resetTime;
+}
+
+unsigned long instrumentLoopGap() {
+    return loopGap;
+}
+
+#endif
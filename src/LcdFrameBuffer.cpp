@@ -0,0 +1,88 @@
+#include <Arduino.h>
+#include "LcdFrameBuffer.h"
+#include "Hal.h"
+
+// Unchanged cells between two changed ones that are cheaper to resend than a new setCursor()
+#define LCD_MERGE_GAP       1
+
+LcdFrameBuffer::LcdFrameBuffer() : cursorCol(0), cursorRow(0), refreshRow(0), lastRefresh(0), refreshInterval(LCD_REFRESH_MS) {
+    memset(frame, ' ', sizeof(frame));  // Matches the display after halLcdClear()
+    memset(changed, 0, sizeof(changed));
+}
+
+void LcdFrameBuffer::put(uint8_t col, uint8_t row, char c) {
+    if (frame[row][col] != c) {
+        frame[row][col] = c;
+        changed[row][col >> 3] |= 1 << (col & 7);
+    }
+}
+
+void LcdFrameBuffer::clear() {
+    for (uint8_t row = 0; row < LCD_ROWS; row++) {
+        for (uint8_t col = 0; col < LCD_COLUMNS; col++) {
+            put(col, row, ' ');
+        }
+    }
+    cursorCol = 0;
+    cursorRow = 0;
+}
+
+void LcdFrameBuffer::setCursor(uint8_t col, uint8_t row) {
+    cursorCol = col;
+    cursorRow = row;
+}
+
+size_t LcdFrameBuffer::write(uint8_t c) {
+    if (cursorRow >= LCD_ROWS || cursorCol >= LCD_COLUMNS) {
+        return 0;   // Clip instead of wrapping like the HD44780 does
+    }
+    put(cursorCol++, cursorRow, c);
+    return 1;
+}
+
+// Forget what is on the display so the next refresh redraws every cell
+void LcdFrameBuffer::invalidate() {
+    memset(changed, 0xFF, sizeof(changed));
+}
+
+bool LcdFrameBuffer::refresh(bool force) {
+    if (!force && millis() - lastRefresh < refreshInterval) {
+        return false;
+    }
+    lastRefresh = millis();
+
+    uint8_t budget = LCD_REFRESH_CELLS;
+    for (uint8_t rows = 0; rows < LCD_ROWS; rows++) {
+        uint8_t row = refreshRow;
+        uint8_t col = 0;
+        while (col < LCD_COLUMNS) {
+            if (!dirty(col, row)) {
+                col++;
+                continue;
+            }
+            if (budget == 0) {
+                return true;    // The rest of the row on the next refresh
+            }
+
+            // Extend the run while the next change is at most LCD_MERGE_GAP cells away
+            uint8_t end = col + 1;
+            uint8_t last = col;
+            while (end < LCD_COLUMNS && end - col < budget && end - last <= LCD_MERGE_GAP + 1) {
+                if (dirty(end, row)) {
+                    last = end;
+                }
+                end++;
+            }
+
+            halLcdSetCursor(col, row);
+            for (uint8_t i = col; i <= last; i++) {
+                halLcdWrite(frame[row][i]);
+                clean(i, row);
+            }
+            budget -= last - col + 1;
+            col = last + 1;
+        }
+        refreshRow = (row + 1) % LCD_ROWS;
+    }
+    return true;
+}
@@ -0,0 +1,106 @@
+#include <Arduino.h>
+#include "LoadCell.h"
+#include "Hal.h"
+
+/*
+Interrupt driven HX711 reader.
+
+The data ready interrupt clocks the conversion out straight away (see
+halLoadCellBegin()) and posts the result with its time stamp. loop() picks
+up the latest conversion instead of waiting for the 10/80 SPS converter.
+The thrust filter runs in the interrupt too, so the cutoff and loop() see
+the same filtered value.
+*/
+
+static volatile long latestRaw;
+static volatile long latestFiltered;
+static volatile unsigned long latestTimestamp;
+static volatile unsigned long period;
+static Filter filter;
+static volatile uint8_t sequence;
+static uint8_t readSequence;
+
+static float scale = 1;
+static long offset = 0;
+
+void loadCellBegin(uint8_t doutPin, uint8_t sckPin) {
+    halLoadCellBegin(doutPin, sckPin);
+}
+
+bool loadCellRead(ThrustSample& sample) {
+    uint8_t oldSREG = SREG;
+    cli();
+    bool available = sequence != readSequence;
+    readSequence = sequence;
+    sample.raw = latestRaw;
+    sample.filtered = latestFiltered;
+    sample.timestamp = latestTimestamp;
+    SREG = oldSREG;
+    return available;
+}
+
+// Latest conversion without marking it as read, false if there was none yet
+bool loadCellLatest(ThrustSample& sample) {
+    uint8_t oldSREG = SREG;
+    cli();
+    sample.raw = latestRaw;
+    sample.filtered = latestFiltered;
+    sample.timestamp = latestTimestamp;
+    SREG = oldSREG;
+    return sequence != 0;
+}
+
+void loadCellSetScale(float value) {
+    scale = value;
+}
+
+void loadCellSetOffset(long value) {
+    offset = value;
+}
+
+long loadCellGetOffset() {
+    return offset;
+}
+
+float loadCellUnits(long raw) {
+    return (raw - offset) / scale;
+}
+
+long loadCellRawFromUnits(float units) {
+    return (long)(units * scale) + offset;
+}
+
+// Restarts the filter from the next conversion
+bool loadCellSetFilter(uint8_t type, uint8_t length) {
+    uint8_t oldSREG = SREG;
+    cli();
+    bool valid = filterConfigure(filter, type, length);
+    SREG = oldSREG;
+    return valid;
+}
+
+const Filter& loadCellFilter() {
+    return filter;
+}
+
+// Time between the last two conversions, us
+unsigned long loadCellPeriod() {
+    uint8_t oldSREG = SREG;
+    cli();
+    unsigned long value = period;
+    SREG = oldSREG;
+    return value;
+}
+
+// HX711 data ready interrupt, after the HAL clocked out the conversion
+void loadCellConversionComplete(long raw) {
+    unsigned long now = micros();
+    latestRaw = raw;
+    latestFiltered = filterUpdate(filter, raw);
+    period = now - latestTimestamp;
+    latestTimestamp = now;
+    sequence++;
+    if (sequence == 0) {    // 0 is reserved for "no conversion yet"
+        sequence = 1;
+    }
+}
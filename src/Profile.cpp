@@ -0,0 +1,88 @@
+#include <Arduino.h>
+#include "Profile.h"
+#include "Storage.h"
+
+#define PROFILE_REST_DURATION   60      // 0.1s, throttle cut between the default test phases
+
+static const char segmentNames[][5] PROGMEM = { "STEP", "RAMP", "HOLD" };
+
+static_assert(PROFILE_EEPROM_ADDRESS + 2 + 4 * PROFILE_LEGACY_SEGMENTS + 2 <= STORAGE_SLOT_A, "Profile overlaps the settings slots");
+static_assert(3 + sizeof(Profile) <= STORAGE_QUEUE_SIZE, "Profile does not fit the write queue");
+
+static uint8_t profileCrc(const Profile& profile) {
+    return storageCrc(&profile, sizeof(Profile));
+}
+
+void profileClear(Profile& profile) {
+    memset(&profile, 0, sizeof(Profile));
+    profile.repeat = 1;
+}
+
+bool profileAdd(Profile& profile, uint8_t type, uint8_t throttle, uint16_t duration) {
+    if (profile.count >= PROFILE_MAX_SEGMENTS || type > SEGMENT_HOLD || throttle > 100) {
+        return false;
+    }
+    ProfileSegment& segment = profile.segments[profile.count++];
+    segment.type = type;
+    segment.throttle = type == SEGMENT_HOLD ? 0 : throttle;
+    segment.duration = duration;
+    return true;
+}
+
+// The original two phase test: half throttle, a rest, then full throttle (times in seconds)
+void profileDefault(Profile& profile, int warmUpTime, int midTestDuration, int maxTestDuration) {
+    profileClear(profile);
+    profileAdd(profile, SEGMENT_RAMP, 50, warmUpTime * 10);
+    profileAdd(profile, SEGMENT_HOLD, 0, midTestDuration * 10);
+    profileAdd(profile, SEGMENT_STEP, 0, PROFILE_REST_DURATION);
+    profileAdd(profile, SEGMENT_RAMP, 100, warmUpTime * 10);
+    profileAdd(profile, SEGMENT_HOLD, 0, maxTestDuration * 10);
+}
+
+/*
+Returns false and leaves the profile untouched when the EEPROM holds no valid
+profile. A profile stored with room for 16 or 8 segments starts with the same
+count, repeat and segments, so its first PROFILE_MAX_SEGMENTS segments are the
+profile when it uses no more.
+*/
+bool profileLoad(Profile& profile) {
+    uint8_t marker = storageReadByte(PROFILE_EEPROM_ADDRESS);
+    unsigned int size;
+    if (marker == PROFILE_EEPROM_MARKER) {
+        size = sizeof(Profile);
+    }
+    else if (marker == PROFILE_LEGACY_MARKER) {
+        size = 2 + 4 * PROFILE_LEGACY_SEGMENTS;
+    }
+    else if (marker == PROFILE_EIGHT_MARKER) {
+        size = 2 + 4 * PROFILE_EIGHT_SEGMENTS;
+    }
+    else {
+        return false;
+    }
+    uint8_t stored[2 + 4 * PROFILE_LEGACY_SEGMENTS];
+    storageRead(PROFILE_EEPROM_ADDRESS + 1, stored, size);
+    if (storageReadByte(PROFILE_EEPROM_ADDRESS + 1 + size) != storageCrc(stored, size)
+        || stored[0] > PROFILE_MAX_SEGMENTS || stored[1] == 0) {
+        return false;
+    }
+    memcpy(&profile, stored, sizeof(Profile));
+    return true;
+}
+
+void profileSave(const Profile& profile) {
+    uint8_t crc = profileCrc(profile);
+    uint8_t marker = PROFILE_EEPROM_MARKER;
+    storageWrite(PROFILE_EEPROM_ADDRESS + 1, &profile, sizeof(Profile));
+    storageWrite(PROFILE_EEPROM_ADDRESS + 1 + sizeof(Profile), &crc, 1);
+    storageWrite(PROFILE_EEPROM_ADDRESS, &marker, 1);
+}
+
+void profileErase() {
+    uint8_t erased = 0xFF;
+    storageWrite(PROFILE_EEPROM_ADDRESS, &erased, 1);
+}
+
+const __FlashStringHelper* profileSegmentName(uint8_t type) {
+    return type <= SEGMENT_HOLD ? reinterpret_cast<const __FlashStringHelper*>(segmentNames[type]) : F("?");
+}
@@ -0,0 +1,165 @@
+#include <Arduino.h>
+#include "SafetyMonitor.h"
+#include "AdcSampler.h"
+#include "LoadCell.h"
+#include "Conversion.h"
+#include "Calibration.h"
+#include "Hal.h"
+#include "Instrumentation.h"
+
+/*
+Over current and over thrust cutoff running from the 1kHz HAL tick
+(Timer2 on the ATmega328P).
+
+While armed, every tick compares the latest filtered current sum (every
+ADC_SAFETY_SAMPLES pairs) and the latest filtered HX711 conversion against
+limits pre-converted to raw counts, so the interrupt does no conversion
+math. A channel trips once it has been over its limit for its own
+persistence window; the ESC is then forced to the idle pulse directly and
+the fault is latched until safetyClearFault(). A load cell that has not
+converted for LOADCELL_STALE_MS while armed trips too, since the thrust
+limit can not be checked against a reading that no longer changes. While latched every tick
+forces the idle pulse again, so nothing in loop() can restart the motor.
+
+Worst case trip latency is the time of ADC_SAFETY_SAMPLES pairs (~3.4ms) or
+the HX711 conversion time, plus the group delay of the channel's filter,
+plus the persistence window, plus one 1ms tick.
+safetyTripLatency() reports the measured time from the time stamp of the
+first offending sample to the forced idle pulse.
+*/
+
+static bool started;
+static int escIdlePulse;
+
+static volatile unsigned long currentLimitSum = 0xFFFFFFFFUL;  // In units of an ADC_SAFETY_SAMPLES current sum, off until configured
+static volatile long thrustLimitRaw;
+static volatile bool thrustInverted;    // Negative load cell scale
+static volatile bool thrustEnabled;
+static volatile bool armed;
+static volatile unsigned int currentPersistTicks = SAFETY_CURRENT_PERSIST_MS;
+static volatile unsigned int thrustPersistTicks = SAFETY_THRUST_PERSIST_MS;
+
+static unsigned int currentTicks;
+static unsigned int thrustTicks;
+static unsigned long currentFirstOver;
+static unsigned long thrustFirstOver;
+
+static volatile uint8_t fault = FAULT_NONE;
+static volatile unsigned long tripLatency;
+
+void safetyBegin(int idlePulse) {
+    escIdlePulse = idlePulse;
+    started = true;
+    halTickBegin();
+}
+
+// Called from loop() whenever the settings, the calibration or a zero offset change
+void safetySetLimits(long maxMilliAmps, long maxGrams, long currentDriftQ) {
+    // The limits are calibrated values, the interrupt compares raw readings
+    long currentQ = calibrationInverse(CALIBRATION_CURRENT, CurrentChannel::adcQFrom(maxMilliAmps)) + currentDriftQ;
+    unsigned long currentSum = (unsigned long)currentQ * ADC_SAFETY_SAMPLES >> ADC_FRACTION_BITS;
+    long thrustRaw = loadCellRawFromUnits(calibrationInverse(CALIBRATION_THRUST, maxGrams));
+    bool inverted = loadCellRawFromUnits(1) < loadCellRawFromUnits(0);
+
+    uint8_t oldSREG = SREG;
+    cli();
+    currentLimitSum = currentSum;
+    thrustLimitRaw = thrustRaw;
+    thrustInverted = inverted;
+    thrustEnabled = true;
+    SREG = oldSREG;
+}
+
+void safetySetPersistence(unsigned int currentMs, unsigned int thrustMs) {
+    uint8_t oldSREG = SREG;
+    cli();
+    currentPersistTicks = currentMs;
+    thrustPersistTicks = thrustMs;
+    SREG = oldSREG;
+}
+
+// Limits are only enforced while the ESC may be driven
+void safetyArm(bool value) {
+    armed = value;
+}
+
+SafetyFault safetyFault() {
+    return (SafetyFault)fault;
+}
+
+void safetyClearFault() {
+    uint8_t oldSREG = SREG;
+    cli();
+    currentTicks = 0;
+    thrustTicks = 0;
+    fault = FAULT_NONE;
+    SREG = oldSREG;
+}
+
+unsigned long safetyTripLatency() {
+    uint8_t oldSREG = SREG;
+    cli();
+    unsigned long value = tripLatency;
+    SREG = oldSREG;
+    return value;
+}
+
+static void trip(SafetyFault reason, unsigned long firstOver) {
+    halEscWrite(escIdlePulse);
+    tripLatency = micros() - firstOver;
+    fault = reason;
+}
+
+// 1kHz tick interrupt
+void safetyTick() {
+    INSTRUMENT_SCOPE(STAGE_SAFETY_TICK);
+    if (!started) {
+        return;
+    }
+    if (fault != FAULT_NONE) {
+        halEscWrite(escIdlePulse);
+        return;
+    }
+    if (!armed) {
+        currentTicks = 0;
+        thrustTicks = 0;
+        return;
+    }
+
+    unsigned long currentSum;
+    unsigned long currentTimestamp;
+    adcLatestCurrent(currentSum, currentTimestamp);
+    if (currentSum > currentLimitSum) {
+        if (currentTicks == 0) {
+            currentFirstOver = currentTimestamp;
+        }
+        if (++currentTicks >= currentPersistTicks) {
+            trip(FAULT_CURRENT, currentFirstOver);
+            return;
+        }
+    }
+    else {
+        currentTicks = 0;
+    }
+
+    if (!thrustEnabled) {
+        return;
+    }
+    ThrustSample thrust;
+    if (!loadCellLatest(thrust) || micros() - thrust.timestamp > LOADCELL_STALE_MS * 1000UL) {
+        trip(FAULT_LOADCELL, thrust.timestamp);     // Latency counted from the last conversion
+        return;
+    }
+    bool over = thrustInverted ? thrust.filtered < thrustLimitRaw : thrust.filtered > thrustLimitRaw;
+    if (over) {
+        if (thrustTicks == 0) {
+            thrustFirstOver = thrust.timestamp;
+        }
+        if (++thrustTicks >= thrustPersistTicks) {
+            trip(FAULT_THRUST, thrustFirstOver);
+        }
+    }
+    else {
+        thrustTicks = 0;
+    }
+}
@@ -0,0 +1,80 @@
+#include <Arduino.h>
+#include "Scheduler.h"
+
+void schedulerBegin(TaskState* states, uint8_t count) {
+    unsigned long now = micros();
+    for (uint8_t i = 0; i < count; i++) {
+        states[i].nextRelease = now;
+        states[i].overruns = 0;
+#if INSTRUMENTATION
+        states[i].skipped = 0;
+        states[i].maxDuration = 0;
+#endif
+    }
+}
+
+bool schedulerRun(const Task* tasks, TaskState* states, uint8_t count) {
+    unsigned long now = micros();
+    for (uint8_t i = 0; i < count; i++) {
+        TaskState& state = states[i];
+        if ((long)(now - state.nextRelease) < 0) {
+            continue;
+        }
+
+        Task task;
+        memcpy_P(&task, &tasks[i], sizeof(Task));
+        unsigned long release = state.nextRelease;
+        task.run();
+        unsigned long finish = micros();
+
+        if (finish - release > task.deadline)
+            state.overruns++;
+#if INSTRUMENTATION
+        unsigned long duration = finish - now;
+        if (duration > state.maxDuration)
+            state.maxDuration = duration;
+#endif
+
+        unsigned long missed = (finish - release) / task.period;
+#if INSTRUMENTATION
+        state.skipped += missed;
+#endif
+        state.nextRelease = release + (missed + 1) * task.period;
+        return true;
+    }
+    return false;
+}
+
+void schedulerReport(Print& out, const Task* tasks, const TaskState* states, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        for (uint8_t field = 0; schedulerReportField(out, tasks[i], states[i], field); field++) {
+        }
+        out.println();
+    }
+}
+
+// One field of a task's report line, for a serial reply; false past the last. The task is in flash
+bool schedulerReportField(Print& out, const Task& task, const TaskState& state, uint8_t field) {
+    switch (field) {
+    case 0:
+        out.print(reinterpret_cast<const __FlashStringHelper*>(pgm_read_ptr(&task.name)));
+        return true;
+    case 1:
+        out.print(F(" overruns="));
+        out.print((unsigned long)state.overruns);
+        return true;
+#if INSTRUMENTATION
+    case 2:
+        out.print(F(" skipped="));
+        out.print((unsigned long)state.skipped);
+        return true;
+    case 3:
+        out.print(F(" max="));
+        out.print(state.maxDuration);
+        out.print(F("us"));
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
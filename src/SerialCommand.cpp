@@ -0,0 +1,147 @@
+#include <Arduino.h>
+#include "SerialCommand.h"
+
+static char line[SERIAL_COMMAND_LINE + 1];
+static uint8_t lineLength;
+static bool lineOverflow;
+static SerialReply reply;       // Pending output of the last command, NULL when there is none
+static uint8_t replyLine;
+static uint8_t replyField;
+
+static bool dispatch(const SerialCommand* commands, uint8_t count) {
+    char* argv[SERIAL_COMMAND_ARGS];
+    uint8_t argc = 0;
+    char* token = strtok(line, " \t");
+    while (token != NULL && argc < SERIAL_COMMAND_ARGS) {
+        argv[argc++] = token;
+        token = strtok(NULL, " \t");
+    }
+    if (argc == 0 || token != NULL) {
+        return false;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        if (strcasecmp_P(argv[0], commands[i].name) == 0) {
+            SerialHandler run = (SerialHandler)pgm_read_ptr(&commands[i].run);
+            return run(argc, argv);
+        }
+    }
+    return false;
+}
+
+// Prints fields of the pending reply while they fit the transmit buffer, true once it is out with its OK
+static bool sendReply(Print& port) {
+    while (port.availableForWrite() >= SERIAL_REPLY_FIELD) {
+        if (reply(port, replyLine, replyField)) {
+            replyField++;
+        }
+        else if (replyField > 0) {
+            port.println();
+            replyLine++;
+            replyField = 0;
+        }
+        else {
+            reply = NULL;
+            port.println(F("OK"));
+            return true;
+        }
+    }
+    return false;
+}
+
+void serialCommandPoll(Stream& port, const SerialCommand* commands, uint8_t count) {
+    if (reply != NULL && !sendReply(port)) {
+        return;
+    }
+    while (port.availableForWrite() >= SERIAL_REPLY_ROOM && port.available() > 0) {
+        char c = port.read();
+        if (c == '\r') {
+            continue;
+        }
+        if (c != '\n') {
+            if (lineLength < SERIAL_COMMAND_LINE) {
+                line[lineLength++] = c;
+            }
+            else {
+                lineOverflow = true;
+            }
+            continue;
+        }
+
+        if (lineLength == 0) {
+            continue;
+        }
+        line[lineLength] = '\0';
+        bool ok = !lineOverflow && dispatch(commands, count);
+        lineLength = 0;
+        lineOverflow = false;
+        if (!ok || reply == NULL) {
+            reply = NULL;
+            port.println(ok ? F("OK") : F("ERR"));
+        }
+        else if (!sendReply(port)) {
+            return;
+        }
+    }
+}
+
+// Called by a handler that succeeds, the reply is printed after it returns
+void serialCommandReply(SerialReply function) {
+    reply = function;
+    replyLine = 0;
+    replyField = 0;
+}
+
+// Prints a flash text longer than a reply field, SERIAL_REPLY_FIELD characters per part; false past its end
+bool serialCommandPrintPart(Print& port, const __FlashStringHelper* text, uint8_t part) {
+    const char* p = reinterpret_cast<const char*>(text);
+    size_t start = (size_t)part * SERIAL_REPLY_FIELD;
+    size_t length = strlen_P(p);
+    if (start >= length) {
+        return false;
+    }
+    for (size_t i = start; i < length && i < start + SERIAL_REPLY_FIELD; i++) {
+        port.write(pgm_read_byte(p + i));
+    }
+    return true;
+}
+
+bool serialCommandParseLong(const char* text, long& value) {
+    char* end;
+    value = strtol(text, &end, 10);
+    return end != text && *end == '\0';
+}
+
+// Parses a decimal number into an integer scaled by 10^decimals, extra digits are truncated
+bool serialCommandParseFixed(const char* text, uint8_t decimals, long& value) {
+    bool negative = *text == '-';
+    if (negative) {
+        text++;
+    }
+    long result = 0;
+    uint8_t fraction = 0;
+    bool digits = false;
+    bool point = false;
+    for (; *text != '\0'; text++) {
+        if (*text == '.' && !point) {
+            point = true;
+        }
+        else if (*text >= '0' && *text <= '9') {
+            digits = true;
+            if (!point) {
+                result = result * 10 + (*text - '0');
+            }
+            else if (fraction < decimals) {
+                result = result * 10 + (*text - '0');
+                fraction++;
+            }
+        }
+        else {
+            return false;
+        }
+    }
+    for (; fraction < decimals; fraction++) {
+        result *= 10;
+    }
+    value = negative ? -result : result;
+    return digits;
+}
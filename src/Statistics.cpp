@@ -0,0 +1,146 @@
+#include <Arduino.h>
+#include "Statistics.h"
+
+void statsReset(RunningStats& stats) {
+    stats.mean = 0;
+    stats.m2 = 0;
+    stats.minimum = 0;
+    stats.maximum = 0;
+}
+
+void statsAdd(RunningStats& stats, float value, unsigned long count) {
+    float delta = value - stats.mean;
+    stats.mean += delta / count;
+    stats.m2 += delta * (value - stats.mean);
+
+    if (count == 1 || value < stats.minimum)
+        stats.minimum = value;
+    if (count == 1 || value > stats.maximum)
+        stats.maximum = value;
+}
+
+float statsVariance(const RunningStats& stats, unsigned long count) {
+    if (count < 2) {
+        return 0;
+    }
+    return stats.m2 / (count - 1);
+}
+
+float statsStdDev(const RunningStats& stats, unsigned long count) {
+    return sqrt(statsVariance(stats, count));
+}
+
+void wattmeterStatsReset(WattmeterStats& stats) {
+    stats.count = 0;
+    statsReset(stats.throttle);
+    statsReset(stats.voltage);
+    statsReset(stats.current);
+    statsReset(stats.power);
+    statsReset(stats.thrust);
+    stats.consumption = 0;
+}
+
+void wattmeterStatsAdd(WattmeterStats& stats, const WattmeterValues& values) {
+    unsigned long count = ++stats.count;
+    statsAdd(stats.throttle, values.throttle, count);
+    statsAdd(stats.voltage, values.voltage, count);
+    statsAdd(stats.current, values.current, count);
+    statsAdd(stats.power, values.power, count);
+    statsAdd(stats.thrust, values.thrust, count);
+    stats.consumption = values.consumption;
+}
+
+void wattmeterStatsMean(const WattmeterStats& stats, WattmeterValues& values) {
+    values.throttle = lround(stats.throttle.mean);
+    values.voltage = lround(stats.voltage.mean);
+    values.current = lround(stats.current.mean);
+    values.power = lround(stats.power.mean);
+    values.consumption = stats.consumption;
+    values.thrust = lround(stats.thrust.mean);
+}
+
+void wattmeterStatsMaximum(const WattmeterStats& stats, WattmeterValues& values) {
+    values.throttle = lround(stats.throttle.maximum);
+    values.voltage = lround(stats.voltage.maximum);
+    values.current = lround(stats.current.maximum);
+    values.power = lround(stats.power.maximum);
+    values.consumption = stats.consumption;
+    values.thrust = lround(stats.thrust.maximum);
+}
+
+void wattmeterStatsStdDev(const WattmeterStats& stats, WattmeterValues& values) {
+    values.throttle = lround(statsStdDev(stats.throttle, stats.count));
+    values.voltage = lround(statsStdDev(stats.voltage, stats.count));
+    values.current = lround(statsStdDev(stats.current, stats.count));
+    values.power = lround(statsStdDev(stats.power, stats.count));
+    values.consumption = stats.consumption;
+    values.thrust = lround(statsStdDev(stats.thrust, stats.count));
+}
+
+void segmentResultReset(SegmentResult& result) {
+    memset(&result, 0, sizeof(SegmentResult));
+}
+
+// Running average of one field over the repeats, n is the number of repeats including this one
+static long mergeAverage(long average, long value, uint8_t n) {
+    return average + (value - average) / n;
+}
+
+void segmentResultMerge(SegmentResult& result, const WattmeterStats& stats, long consumption) {
+    uint8_t n = ++result.cycles;
+    long voltageMin = lround(stats.voltage.minimum / 10);
+    long currentMax = lround(stats.current.maximum / 10);
+    long currentSpread = lround(statsStdDev(stats.current, stats.count) / 10);
+    long powerMax = lround(stats.power.maximum / 100);
+    long thrustMax = lround(stats.thrust.maximum);
+    long thrustSpread = lround(statsStdDev(stats.thrust, stats.count));
+
+    result.throttle = mergeAverage(result.throttle, lround(stats.throttle.mean), n);
+    result.voltage = mergeAverage(result.voltage, lround(stats.voltage.mean / 10), n);
+    result.current = mergeAverage(result.current, lround(stats.current.mean / 10), n);
+    result.power = mergeAverage(result.power, lround(stats.power.mean / 100), n);
+    result.thrust = mergeAverage(result.thrust, lround(stats.thrust.mean), n);
+    result.consumption = mergeAverage(result.consumption, consumption, n);
+
+    if (n == 1 || voltageMin < result.voltageMin)
+        result.voltageMin = voltageMin;
+    if (n == 1 || currentMax > result.currentMax)
+        result.currentMax = currentMax;
+    if (n == 1 || currentSpread > result.currentSpread)
+        result.currentSpread = currentSpread;
+    if (n == 1 || powerMax > result.powerMax)
+        result.powerMax = powerMax;
+    if (n == 1 || thrustMax > result.thrustMax)
+        result.thrustMax = thrustMax;
+    if (n == 1 || thrustSpread > result.thrustSpread)
+        result.thrustSpread = thrustSpread;
+}
+
+void segmentResultMean(const SegmentResult& result, WattmeterValues& values) {
+    values.throttle = result.throttle;
+    values.voltage = result.voltage * 10L;
+    values.current = result.current * 10L;
+    values.power = result.power * 100L;
+    values.consumption = result.consumption;
+    values.thrust = result.thrust;
+}
+
+// The voltage field carries the minimum, the sag under load
+void segmentResultMaximum(const SegmentResult& result, WattmeterValues& values) {
+    values.throttle = result.throttle;
+    values.voltage = result.voltageMin * 10L;
+    values.current = result.currentMax * 10L;
+    values.power = result.powerMax * 100L;
+    values.consumption = result.consumption;
+    values.thrust = result.thrustMax;
+}
+
+// Only current and thrust spreads are kept
+void segmentResultStdDev(const SegmentResult& result, WattmeterValues& values) {
+    values.throttle = 0;
+    values.voltage = 0;
+    values.current = result.currentSpread * 10L;
+    values.power = 0;
+    values.consumption = result.consumption;
+    values.thrust = result.thrustSpread;
+}
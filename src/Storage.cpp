@@ -0,0 +1,220 @@
+#include <Arduino.h>
+#include "Storage.h"
+#include "TelemetryProtocol.h"
+#include "Hal.h"
+
+static int activeSlot = -1;     // Address of the newest valid settings slot, -1 when there is none
+static uint8_t slotSequence;
+static uint8_t logHead;         // Next ring entry to write
+static uint8_t logCount;
+static uint16_t logSequence;
+
+static uint8_t queue[STORAGE_QUEUE_SIZE];   // Pending writes, oldest first: address low and high byte, length, data
+static uint8_t queueLength;
+static uint8_t queueDone;       // Bytes of the oldest write that are done
+
+static bool readSlot(int address, SettingsRecord& record) {
+    storageRead(address, &record, sizeof(SettingsRecord));
+    return record.version == SETTINGS_VERSION
+        && record.crc == storageCrc(&record, sizeof(SettingsRecord) - 1);
+}
+
+static bool readLogEntry(uint8_t entry, RunSummary& summary) {
+    storageRead(STORAGE_LOG_ADDRESS + entry * sizeof(RunSummary), &summary, sizeof(RunSummary));
+    return summary.sequence != 0xFFFF
+        && summary.crc == storageCrc(&summary, sizeof(RunSummary) - 1);
+}
+
+// Finds the newest settings slot and the newest run log entry
+void storageBegin() {
+    SettingsRecord a, b;
+    bool validA = readSlot(STORAGE_SLOT_A, a);
+    bool validB = readSlot(STORAGE_SLOT_B, b);
+    if (validA && (!validB || (int8_t)(a.sequence - b.sequence) > 0)) {
+        activeSlot = STORAGE_SLOT_A;
+        slotSequence = a.sequence;
+    }
+    else if (validB) {
+        activeSlot = STORAGE_SLOT_B;
+        slotSequence = b.sequence;
+    }
+
+    RunSummary summary;
+    int newest = -1;
+    logCount = 0;
+    for (uint8_t i = 0; i < STORAGE_LOG_ENTRIES; i++) {
+        if (!readLogEntry(i, summary)) {
+            continue;
+        }
+        logCount++;
+        if (newest < 0 || (int16_t)(summary.sequence - logSequence) > 0) {
+            newest = i;
+            logSequence = summary.sequence;
+        }
+    }
+    logHead = newest < 0 ? 0 : (newest + 1) % STORAGE_LOG_ENTRIES;
+}
+
+uint8_t storageCrc(const void* data, unsigned int size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t crc = 0;
+    for (unsigned int i = 0; i < size; i++) {
+        crc = telemetryCrc8(crc, bytes[i]);
+    }
+    return crc;
+}
+
+static int queuedAddress(uint8_t at) {
+    return queue[at] | queue[at + 1] << 8;
+}
+
+void storageRead(int address, void* data, unsigned int size) {
+    uint8_t* bytes = (uint8_t*)data;
+    for (unsigned int i = 0; i < size; i++) {
+        bytes[i] = storageReadByte(address + i);
+    }
+}
+
+// The EEPROM as it will be once the queue is written, the newest queued write wins
+uint8_t storageReadByte(int address) {
+    uint8_t value = halEepromRead(address);
+    for (uint8_t at = 0; at < queueLength; at += 3 + queue[at + 2]) {
+        int offset = address - queuedAddress(at);
+        if (offset >= 0 && offset < queue[at + 2]) {
+            value = queue[at + 3 + offset];
+        }
+    }
+    return value;
+}
+
+// Writes the next queued byte that differs from the EEPROM; false when the queue is empty
+static bool writeNext() {
+    while (queueLength > 0) {
+        uint8_t length = queue[2];
+        if (queueDone < length) {
+            int address = queuedAddress(0) + queueDone;
+            uint8_t value = queue[3 + queueDone++];
+            if (halEepromRead(address) != value) {
+                halEepromWrite(address, value);
+                return true;
+            }
+            continue;
+        }
+        queueLength -= 3 + length;
+        memmove(queue, queue + 3 + length, queueLength);
+        queueDone = 0;
+    }
+    return false;
+}
+
+static void queueWrite(int address, const uint8_t* bytes, uint8_t length) {
+    while (queueLength + 3 + length > STORAGE_QUEUE_SIZE && writeNext()) {    // Full, waits for the oldest writes
+    }
+    if (queueLength + 3 + length > STORAGE_QUEUE_SIZE) {
+        for (uint8_t i = 0; i < length; i++) {      // Longer than the whole queue, written directly
+            halEepromWrite(address + i, bytes[i]);
+        }
+        return;
+    }
+    queue[queueLength++] = address & 0xFF;
+    queue[queueLength++] = address >> 8;
+    queue[queueLength++] = length;
+    memcpy(queue + queueLength, bytes, length);
+    queueLength += length;
+}
+
+// Queues the runs of bytes that differ; up to two unchanged bytes inside a run cost less than another header
+void storageWrite(int address, const void* data, unsigned int size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    unsigned int i = 0;
+    while (i < size) {
+        if (storageReadByte(address + i) == bytes[i]) {
+            i++;
+            continue;
+        }
+        unsigned int first = i;
+        unsigned int last = i;
+        for (i++; i < size && i - last <= 3 && i - first < 255; i++) {
+            if (storageReadByte(address + i) != bytes[i]) {
+                last = i;
+            }
+        }
+        queueWrite(address + first, bytes + first, last - first + 1);
+        i = last + 1;
+    }
+}
+
+// Writes one queued byte once the previous write is done, never waits
+void storagePoll() {
+    if (halEepromReady()) {
+        writeNext();
+    }
+}
+
+// Returns false when neither a slot nor legacy settings hold anything
+bool storageLoadSettings(Settings& settings) {
+    SettingsRecord record;
+    if (activeSlot >= 0 && readSlot(activeSlot, record)) {
+        settings = record.settings;
+        return true;
+    }
+    if (storageReadByte(STORAGE_LEGACY_ADDRESS) == 0xFF) {
+        return false;
+    }
+    storageRead(STORAGE_LEGACY_ADDRESS, &settings, sizeof(Settings));   // Written by older firmware, move it to a slot
+    storageSaveSettings(settings);
+    return true;
+}
+
+// Settings equal to the stored ones write nothing; the other slot would differ in its sequence and CRC
+void storageSaveSettings(const Settings& settings) {
+    if (!storageSettingsChanged(settings)) {
+        return;
+    }
+    SettingsRecord record;
+    record.version = SETTINGS_VERSION;
+    record.sequence = slotSequence + 1;
+    record.settings = settings;
+    record.crc = storageCrc(&record, sizeof(SettingsRecord) - 1);
+
+    int address = activeSlot == STORAGE_SLOT_A ? STORAGE_SLOT_B : STORAGE_SLOT_A;
+    storageWrite(address, &record, sizeof(SettingsRecord));
+    activeSlot = address;
+    slotSequence = record.sequence;
+}
+
+bool storageSettingsChanged(const Settings& settings) {
+    SettingsRecord record;
+    if (activeSlot < 0 || !readSlot(activeSlot, record)) {
+        return true;
+    }
+    return memcmp(&record.settings, &settings, sizeof(Settings)) != 0;
+}
+
+// Sets the sequence and CRC of the summary and writes it over the oldest entry
+void runLogAppend(RunSummary& summary) {
+    logSequence++;
+    if (logSequence == 0xFFFF) {    // Reserved for erased entries
+        logSequence = 0;
+    }
+    summary.sequence = logSequence;
+    summary.crc = storageCrc(&summary, sizeof(RunSummary) - 1);
+    storageWrite(STORAGE_LOG_ADDRESS + logHead * sizeof(RunSummary), &summary, sizeof(RunSummary));
+    logHead = (logHead + 1) % STORAGE_LOG_ENTRIES;
+    if (logCount < STORAGE_LOG_ENTRIES) {
+        logCount++;
+    }
+}
+
+uint8_t runLogCount() {
+    return logCount;
+}
+
+// Index 0 is the oldest run
+bool runLogRead(uint8_t index, RunSummary& summary) {
+    if (index >= logCount) {
+        return false;
+    }
+    uint8_t entry = (logHead + STORAGE_LOG_ENTRIES - logCount + index) % STORAGE_LOG_ENTRIES;
+    return readLogEntry(entry, summary);
+}
@@ -0,0 +1,205 @@
+#include <Arduino.h>
+#include "Telemetry.h"
+#include "Conversion.h"
+
+/*
+Writes telemetry frames to Serial without ever blocking. A frame is only
+queued when the whole frame fits in the transmit buffer; otherwise it is
+dropped and counted, and the gap in the sequence numbers tells the host.
+*/
+
+static uint8_t sequence;
+static unsigned int dropped;
+
+// The open sample batch, see TELEMETRY_SAMPLE_BATCH; batchLength is 0 when there is none
+static uint8_t batch[TELEMETRY_BATCH_PAYLOAD];
+static uint8_t batchLength;
+static uint8_t batchBlocks;             // ADC blocks from the first sample to the last
+static unsigned long batchLast;         // Time stamp of the last sample, us
+static TelemetrySample batchPrevious;   // Last sample, the deltas are taken against it
+
+bool telemetrySendFrame(uint8_t type, const uint8_t* payload, uint8_t length) {
+    uint8_t header[TELEMETRY_HEADER_SIZE];
+    uint8_t size = TELEMETRY_HEADER_SIZE + length + 1;
+
+    uint8_t seq = sequence++;
+    if (length > TELEMETRY_MAX_PAYLOAD || Serial.availableForWrite() < size) {
+        dropped++;
+        return false;
+    }
+
+    header[0] = TELEMETRY_SYNC;
+    header[1] = type;
+    header[2] = length;
+    header[3] = seq;
+
+    uint8_t crc = 0;
+    for (uint8_t i = 1; i < TELEMETRY_HEADER_SIZE; i++) {
+        crc = telemetryCrc8(crc, header[i]);
+    }
+    for (uint8_t i = 0; i < length; i++) {
+        crc = telemetryCrc8(crc, payload[i]);
+    }
+
+    // Written in place, the transmit buffer has room for all of it
+    Serial.write(header, TELEMETRY_HEADER_SIZE);
+    Serial.write(payload, length);
+    Serial.write(crc);
+    return true;
+}
+
+static TelemetrySample toSample(const WattmeterValues& values, unsigned long timestamp) {
+    TelemetrySample sample;
+    sample.timestamp = timestamp;
+    sample.throttle = values.throttle >= 0 ? values.throttle : TELEMETRY_THROTTLE_IDLE;
+    sample.voltage = (uint16_t)(values.voltage / 10);
+    sample.current = (uint16_t)(values.current / 10);
+    sample.power = (uint16_t)(values.power / 100);
+    sample.consumption = (uint16_t)values.consumption;
+    sample.thrust = (int16_t)values.thrust;
+    return sample;
+}
+
+// Adds an entry for sample to the open batch, false when it does not fit
+static bool batchAppend(const TelemetrySample& sample, uint8_t blocks) {
+    if (blocks == 0 || blocks > TELEMETRY_BATCH_BLOCKS_MAX || batchBlocks + blocks > 0xFF
+            || sample.timestamp - telemetryGet32(batch) > 0xFFFF) {
+        return false;
+    }
+    int16_t deltas[TELEMETRY_BATCH_FIELDS] = {
+        (int16_t)(sample.throttle - batchPrevious.throttle),
+        (int16_t)(sample.voltage - batchPrevious.voltage),
+        (int16_t)(sample.current - batchPrevious.current),
+        (int16_t)(sample.power - batchPrevious.power),
+        (int16_t)(sample.consumption - batchPrevious.consumption),
+        (int16_t)(sample.thrust - batchPrevious.thrust)
+    };
+    uint8_t entry[1 + TELEMETRY_BATCH_FIELDS];
+    uint8_t length = 1;
+    uint8_t flags = (blocks - 1) << TELEMETRY_BATCH_BLOCKS_SHIFT;
+    for (uint8_t i = 0; i < TELEMETRY_BATCH_FIELDS; i++) {
+        if (deltas[i] == 0) {
+            continue;
+        }
+        if (deltas[i] < -128 || deltas[i] > 127) {
+            return false;
+        }
+        flags |= 1 << i;
+        entry[length++] = (uint8_t)deltas[i];
+    }
+    if (batchLength + length > TELEMETRY_BATCH_PAYLOAD) {
+        return false;
+    }
+    entry[0] = flags;
+    memcpy(batch + batchLength, entry, length);
+    batchLength += length;
+    batchBlocks += blocks;
+    batchLast = sample.timestamp;
+    batchPrevious = sample;
+    return true;
+}
+
+/*
+Queues a streamed sample measured blocks ADC blocks after the previous one
+into the open batch. The batch is sent once the sample does not fit it, and
+the sample opens the next one.
+*/
+void telemetryBatchSample(const WattmeterValues& values, unsigned long timestamp, uint8_t blocks) {
+    TelemetrySample sample = toSample(values, timestamp);
+    if (batchLength > 0 && batchAppend(sample, blocks)) {
+        return;
+    }
+    telemetryFlushBatch();
+
+    telemetryEncodeSample(sample, batch);
+    batchLength = TELEMETRY_BATCH_HEADER_SIZE;
+    batchBlocks = 0;
+    batchLast = timestamp;
+    batchPrevious = sample;
+}
+
+// Sends the open batch, a batch of one sample as a TELEMETRY_SAMPLE frame
+bool telemetryFlushBatch() {
+    if (batchLength == 0) {
+        return true;
+    }
+    bool sent;
+    if (batchBlocks == 0) {
+        sent = telemetrySendFrame(TELEMETRY_SAMPLE, batch, TELEMETRY_SAMPLE_SIZE);
+    }
+    else {
+        telemetryPut16(batch + TELEMETRY_SAMPLE_SIZE, (uint16_t)(batchLast - telemetryGet32(batch)));
+        sent = telemetrySendFrame(TELEMETRY_SAMPLE_BATCH, batch, batchLength);
+    }
+    batchLength = 0;
+    return sent;
+}
+
+// Time stamp of the open batch's first sample, for flushing it after a while; false when there is none
+bool telemetryBatchStart(unsigned long& timestamp) {
+    if (batchLength == 0) {
+        return false;
+    }
+    timestamp = telemetryGet32(batch);
+    return true;
+}
+
+bool telemetrySendStatus(unsigned long timestamp) {
+    TelemetryStatus status;
+    uint8_t payload[TELEMETRY_STATUS_SIZE];
+    uint8_t bits = adcOversampling();
+
+    status.timestamp = timestamp;
+    status.adcBits = 10 + bits;
+    status.blockSamples = adcBlockSamples();
+    status.blockRate = adcBlockRate();
+    status.currentStep = (uint16_t)(CurrentChannel::microPerCount >> bits);
+    status.voltageStep = (uint16_t)(VoltageChannel::microPerCount >> bits);
+    status.flags = adcSleep() ? TELEMETRY_STATUS_SLEEP : 0;
+    status.adcOverruns = adcOverruns();
+    status.dropped = dropped;
+    telemetryEncodeStatus(status, payload);
+
+    return telemetrySendFrame(TELEMETRY_STATUS, payload, TELEMETRY_STATUS_SIZE);
+}
+
+bool telemetrySendRawAdc(const AdcBlock& block, int throttle) {
+    TelemetryRawAdc raw;
+    uint8_t payload[TELEMETRY_RAW_ADC_SIZE];
+
+    raw.timestamp = block.timestamp;
+    raw.currentSum = block.currentSum;
+    raw.voltageSum = block.voltageSum;
+    raw.samples = block.samples;
+    raw.throttle = (uint16_t)throttle;
+    telemetryEncodeRawAdc(raw, payload);
+
+    return telemetrySendFrame(TELEMETRY_RAW_ADC, payload, TELEMETRY_RAW_ADC_SIZE);
+}
+
+bool telemetrySendRawLoadCell(const ThrustSample& sample) {
+    TelemetryRawLoadCell raw;
+    uint8_t payload[TELEMETRY_RAW_LOADCELL_SIZE];
+
+    raw.timestamp = sample.timestamp;
+    raw.raw = sample.raw;
+    telemetryEncodeRawLoadCell(raw, payload);
+
+    return telemetrySendFrame(TELEMETRY_RAW_LOADCELL, payload, TELEMETRY_RAW_LOADCELL_SIZE);
+}
+
+bool telemetrySendRawEvent(uint8_t type, unsigned long timestamp, long value) {
+    TelemetryRawEvent raw;
+    uint8_t payload[TELEMETRY_RAW_EVENT_SIZE];
+
+    raw.timestamp = timestamp;
+    raw.type = type;
+    raw.value = value;
+    telemetryEncodeRawEvent(raw, payload);
+
+    return telemetrySendFrame(TELEMETRY_RAW_EVENT, payload, TELEMETRY_RAW_EVENT_SIZE);
+}
+
+unsigned int telemetryDropped() {
+    return dropped;
+}
@@ -0,0 +1,45 @@
+#include <Arduino.h>
+#include "ThrustCurve.h"
+
+void curveReset(ThrustCurve& curve) {
+    memset(&curve, 0, sizeof(ThrustCurve));
+}
+
+// Samples with the throttle disabled are not part of the curve
+void curveAdd(ThrustCurve& curve, const WattmeterValues& values) {
+    if (values.throttle < 0 || values.throttle > 100) {
+        return;
+    }
+    CurveBin& bin = curve.bins[(values.throttle + THROTTLE_BIN_PERCENT / 2) / THROTTLE_BIN_PERCENT];
+    if (bin.count == 0xFFFF) {
+        return;
+    }
+    bin.count++;
+    bin.voltage += values.voltage / 10;
+    bin.current += values.current / 10;
+    bin.power += values.power / 100;
+    bin.thrust += values.thrust;
+}
+
+// Returns false for a bin without samples
+bool curveMean(const ThrustCurve& curve, uint8_t bin, WattmeterValues& values) {
+    const CurveBin& sums = curve.bins[bin];
+    if (sums.count == 0) {
+        return false;
+    }
+    values.throttle = bin * THROTTLE_BIN_PERCENT;
+    values.voltage = (sums.voltage + sums.count / 2) / sums.count * 10;
+    values.current = (sums.current + sums.count / 2) / sums.count * 10;
+    values.power = (sums.power + sums.count / 2) / sums.count * 100;
+    values.thrust = sums.thrust / (long)sums.count;
+    values.consumption = 0;
+    return true;
+}
+
+// Efficiency in 0.1 g/W, 0 without power
+long curveGramsPerWatt(const WattmeterValues& values) {
+    if (values.power <= 0 || values.thrust <= 0) {
+        return 0;
+    }
+    return (long)values.thrust * 10000L / values.power;
+}
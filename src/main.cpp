@@ -1,10 +1,26 @@
 #include <Arduino.h>
 #include "WatmeterTestBench.h"
-#include <LiquidCrystal_I2C.h>
-#include <Wire.h>
-#include <HX711.h>
-#include <Servo.h>
-#include <EEPROM.h>
+#include "AdcSampler.h"
+#include "LoadCell.h"
+#include "Telemetry.h"
+#include "LcdFrameBuffer.h"
+#include "Format.h"
+#include "Conversion.h"
+#include "EnergyCounter.h"
+#include "Statistics.h"
+#include "Scheduler.h"
+#include "SafetyMonitor.h"
+#include "AutoTest.h"
+#include "Profile.h"
+#include "SerialCommand.h"
+#include "ThrustCurve.h"
+#include "Storage.h"
+#include "Hal.h"
+#include "Instrumentation.h"
+#include "Filter.h"
+#include "Calibration.h"
+#include "AutoZero.h"
+#include "Buttons.h"
 
 /* This sketch describes how to connect a ACS715 Current Sense Carrier 
 (http://www.pololu.com/catalog/product/1186) to the Arduino, 
@@ -12,9 +28,7 @@ and read current flowing through the sensor.
 
 */
 
-LiquidCrystal_I2C lcd(0x27, 20, 4);
-HX711 loadcell;
-Servo esc;
+LcdFrameBuffer screen;
 
 /*
 
@@ -36,27 +50,29 @@ Ratio 2.5238
 
 
 */
-#define MAX_SAMPLES         10
-#define LOADCELL_TIMEOUT    10
 #define LOADCELL_CALIBRATION 139
 #define LOADCELL_OFFSET     0
-#define CURRSENSOR_OFFSET   124.00F             // Reading value of Current sensor at 0A - measuriung arouund 0.5V
-#define CURRSENSOR_VPP      0.1220703125F    // or 0.1221896383186706 Current sensor sensitivity amps per point
-                                            // Calculation: (Total Port Read in Volts/sensor sensitivity V/A)/Total Points
-#define VOLTSENSOR_OFFSET   15              // Reading value from voltage Divider at 0V
-#define VOLTSENSOR_VPP      0.1741   // Voltage Divider output voltage per point
-
-#undef  EXPORT_VALUES
+#define TARE_SAMPLES        16              // HX711 conversions averaged by a tare, 0.2s at 80 SPS
+#define CURRENT_ZERO_SAMPLES 64             // Idle acquisition passes averaged for the current zero at startup
+
+#define AUTO_ZERO_SETTLE_MS         3000    // Prop spin-down after the throttle is disabled, before zeros are tracked
+#define AUTO_ZERO_THRUST_LIMIT_G    50      // Drift tracked away from the last tare
+#define AUTO_ZERO_THRUST_WINDOW_G   10      // Larger changes while idle are a load, not drift
+#define AUTO_ZERO_THRUST_SHIFT      6       // Time constant 64 conversions, 0.8s
+#define AUTO_ZERO_CURRENT_LIMIT_MA  500     // Drift tracked away from the startup zero
+#define AUTO_ZERO_CURRENT_WINDOW_MA 250
+#define AUTO_ZERO_CURRENT_SHIFT     8       // Time constant 256 acquisition passes
+
+#undef  EXPORT_VALUES   // Stream the sample frames from reset, otherwise STREAM starts them
+#undef  RECORD_RAW      // Raw sensor frames for replay in the native simulator, see README
 #undef _DEBUG_
 
-#define PIN_VIN                     A3
-#define PIN_AIN                     A1 // originally A0
 #define PIN_LOADCELL_DOUT           9
 #define PIN_LOADCELL_SCK            10
 #define PIN_THROTTLE_IN             A7
 #define PIN_THROTTLE_OUT            11 // Was originally 6
 
-#define PIN_BUTTON_ISR              3 // Was originally 2
+#define PIN_BUTTON_COMMON           3 // Held low, was the button interrupt (originally 2)
 
 #define PIN_BUTTON_SCREEN_MODE      4
 #define PIN_BUTTON_TEST_MODE        7
@@ -71,316 +87,567 @@ Ratio 2.5238
 #define DEFAULT_SETTING_CYCLES      1
 #define DEFAULT_SETTING_WARMUP      2
 
+// Ranges of the settings, on the settings screen and for SET
+#define SETTING_CURRENT_MIN         10      // A
+#define SETTING_CURRENT_MAX         120
+#define SETTING_THRUST_MIN          500     // g
+#define SETTING_THRUST_MAX          10000
+#define SETTING_TEST_MIN            1       // s
+#define SETTING_TEST_MAX            60
+#define SETTING_WARMUP_MIN          1       // s
+#define SETTING_WARMUP_MAX          6
+
+#define DEFAULT_FILTER_THRUST       FILTER_MEDIAN   // Prop vibration spikes, also for the thrust cutoff
+#define DEFAULT_FILTER_THRUST_LENGTH 3
+
+#define AUTO_TEST_PAGES_PER_SEGMENT 3       // Average, maximum and spread
+#define CURVE_ROWS                  3       // Throttle bins per page on the curve screen
+
+#define ACQUISITION_PERIOD_US       1000
+#define SAFETY_PERIOD_US            1000
+#define ESC_PERIOD_US               20000   // 50Hz, the pulse frame of halEscBegin(); running faster only rewrites the next pulse sooner
+#define AUTO_TEST_PERIOD_US         10000
+#define SERIAL_PERIOD_US            5000    // Drains the 64 byte receive buffer before it fills at 115200 baud
+#define DISPLAY_PERIOD_US           (LCD_REFRESH_MS * 1000UL / LCD_ROWS)    // A row of cells per run, the screen is redrawn every LCD_REFRESH_MS
+#define TELEMETRY_PERIOD_US         10000
+#define BUTTON_PERIOD_US            10000
+#define STORAGE_PERIOD_US           1000    // Polls for the end of an EEPROM byte write, which takes 3.4ms
+#define TELEMETRY_STATUS_MS         1000
+#define TELEMETRY_BATCH_US          50000   // A sample batch goes out at the latest this long after its first sample
+#define STREAM_RATE_MAX             1000    // Sample frames per second asked for, at most one per ADC block goes out
+#define STREAM_ALL                  0xFFFF  // streamRate that sends every block
+#define STREAM_RATE_EXPORT          100     // From reset with EXPORT_VALUES
+#define MESSAGE_DURATION_MS         1500
+
 #define PWM_MIN                     1000
 #define PWM_MAX                     2000
 
-// Current sensor constrants
-const float VCC = 3.3; // Supply voltage
-const float QOV = 0.12 * VCC; // quiescent voltage of sensor
-const float current_offset = 0.007; //Value to set sensor voltage value to 0 when no current
-const float sensor_sensitivity = 40.0 / 1000.00; //Current sensor sensitivity 
-
-struct TestCollection {
-    AverageValues averageValues;
-    WattmeterValues maximumValues;
-} midThrottleTest, maxThrottleTest;
-
-//struct CycleTestValues {
-//    int cycles;
-//    TestCollection midThrottleTests[3];
-//    TestCollection maxThrottleTests[3];
-//} automaticTestCycles;
-
 const int buttonPins[] = { PIN_BUTTON_SCREEN_MODE, PIN_BUTTON_TEST_MODE, PIN_BUTTON_THROTTLE_CUT, PIN_BUTTON_OK, PIN_BUTTON_PREVIOUS };
 
-enum ScreenMode { RUNNING_VALUES, AVERAGE_VALUES, MAXIMUM_VALUES, AUTO_TEST1, AUTO_TEST2, SETTINGS, CALIBRATION, CURRENT_CUTOFF, THRUST_CUTOFF, AUTO_START, AUTO_RESULTS, AUTO_END } screenMode;
+enum ScreenMode { RUNNING_VALUES, AVERAGE_VALUES, MAXIMUM_VALUES, CURVE_VALUES, AUTO_TEST, SETTINGS, CALIBRATION, CURRENT_CUTOFF, THRUST_CUTOFF, AUTO_START, AUTO_RESULTS, AUTO_END } screenMode;
 enum TestMode { MANUAL, AUTOMATIC }  testMode;
+enum FilterChannel { CHANNEL_CURRENT, CHANNEL_VOLTAGE, CHANNEL_THRUST };
 enum TestCycle { OFF, TEST1, TEST2 } testCycle;
 
 WattmeterValues runningValues;
-AverageValues averageValues = { 0, {0,0,0,0,0,0 } };
-WattmeterValues maximumValues = { 0,0,0,0,0,0 };
+WattmeterStats runStats;    // Backs the AVERAGE and MAXIMUM screens and the automatic test phases
+ThrustCurve curve;          // Means per throttle bin, backs the CURVE screen
 
 Settings settings;
 
 bool enableThrottle = false;
-bool cutoffChecking = false;
-long cutoffTimer;
+bool faultReported = false;
 bool saveSettings = false;
 bool collectData;
 
-unsigned long ahTimer;
+EnergyCounter energy;
+AutoZero thrustZero;        // Raw HX711 counts, applied as the load cell offset
+AutoZero currentZero;       // Q4 counts of the current sensor at 0A
+volatile bool tareRequested = false;    // Set by the buttons, the tare runs from acquisitionTask()
+unsigned long idleSince;    // millis() when the throttle was last enabled
+Filter currentFilter;       // Current and voltage blocks for the running values, in Q4 counts
+Filter voltageFilter;
+volatile bool resetMeasurements = false;   // Set by the buttons, consumption and statistics are reset from loop()
+int throttlePercent = -1;   // Throttle sent to the ESC, -1 when disabled
+int serialThrottle = -1;    // Manual throttle set with THR, -1 when the pot sets it
+#ifdef EXPORT_VALUES
+uint16_t streamRate = STREAM_RATE_EXPORT;   // Sample frames per second or STREAM_ALL, 0 when not streaming
+#else
+uint16_t streamRate = 0;
+#endif
+int autoTestThrottle = 0;   // Throttle requested by the automatic test
+AutoTest autoTest;
+Profile profile;
+bool profileCustom = false; // Set once a profile was loaded or uploaded, otherwise the settings give the default test
+SegmentResult segmentResults[PROFILE_MAX_SEGMENTS];
+long segmentConsumption;    // Consumption when the running segment started, mAh
+int autoTestResultPages = 0;
+volatile bool startAutoTest = false;    // Set by the buttons, the sequencer is started and stopped from loop()
+volatile bool abortAutoTest = false;
+
+bool messageActive = false;
+unsigned long messageTimer;
+unsigned long displayRedrawTimer;
+const __FlashStringHelper* messageLine1;
+const __FlashStringHelper* messageLine2;
+
+static const char TASK_ACQ[] PROGMEM = "ACQ";
+static const char TASK_SAFETY[] PROGMEM = "SAFETY";
+static const char TASK_ESC[] PROGMEM = "ESC";
+static const char TASK_AUTO[] PROGMEM = "AUTO";
+static const char TASK_SERIAL[] PROGMEM = "SERIAL";
+static const char TASK_BUTTONS[] PROGMEM = "BUTTONS";
+static const char TASK_TELEMETRY[] PROGMEM = "TELEMETRY";
+static const char TASK_LCD[] PROGMEM = "LCD";
+static const char TASK_STORAGE[] PROGMEM = "EEPROM";
+
+static const Task tasks[] PROGMEM = {
+    { TASK_ACQ, acquisitionTask, ACQUISITION_PERIOD_US, ACQUISITION_PERIOD_US },
+    { TASK_SAFETY, safetyTask, SAFETY_PERIOD_US, SAFETY_PERIOD_US },
+    { TASK_ESC, escTask, ESC_PERIOD_US, ESC_PERIOD_US },
+    { TASK_AUTO, autoTestTask, AUTO_TEST_PERIOD_US, AUTO_TEST_PERIOD_US },
+    { TASK_SERIAL, serialTask, SERIAL_PERIOD_US, SERIAL_PERIOD_US },
+    { TASK_BUTTONS, buttonTask, BUTTON_PERIOD_US, BUTTON_PERIOD_US },
+    { TASK_TELEMETRY, telemetryTask, TELEMETRY_PERIOD_US, TELEMETRY_PERIOD_US },
+    { TASK_LCD, displayTask, DISPLAY_PERIOD_US, DISPLAY_PERIOD_US },
+    { TASK_STORAGE, storageTask, STORAGE_PERIOD_US, STORAGE_PERIOD_US },
+};
+#define TASK_COUNT  (sizeof(tasks) / sizeof(Task))
+TaskState taskStates[TASK_COUNT];
 
 void setup() {
     // initialize serial communications at 9600 bps:
-    char line1[] = "********************";
-    char line2[] = "*Thrust&Watt Meter *";
-    char line3[] = "*  For Prop & EDF  *";
-    char line4[] = "********************";
-    char* welcomeScreen[] = { line1, line2, line3, line4 };
+    static const char welcomeScreen[4][LCD_COLUMNS + 1] PROGMEM = {
+        "********************",
+        "*Thrust&Watt Meter *",
+        "*  For Prop & EDF  *",
+        "********************"
+    };
     Serial.begin(115200);
 
-    lcd.init();                      // initialize the lcd 
-    lcd.backlight();
+    halLcdBegin();                   // initialize the lcd 
     for (int x = 0; x < 4;x++) {
-        for (int y = 0;y < 20;y++) {
-            lcd.setCursor(y, x);
-            lcd.print(welcomeScreen[x][y]);
-        }
+        screen.setCursor(0, x);
+        screen.print(reinterpret_cast<const __FlashStringHelper*>(welcomeScreen[x]));
+        screen.refresh(true);
         delay(50);
     }
 
-    loadcell.begin(PIN_LOADCELL_DOUT, PIN_LOADCELL_SCK);
-    loadcell.set_scale(LOADCELL_CALIBRATION);
-    loadcell.set_offset(LOADCELL_OFFSET);
-    loadcell.tare();
+    setFilter(CHANNEL_CURRENT, CurrentChannel::filterType, CurrentChannel::filterLength);
+    setFilter(CHANNEL_VOLTAGE, VoltageChannel::filterType, VoltageChannel::filterLength);
+    setFilter(CHANNEL_THRUST, DEFAULT_FILTER_THRUST, DEFAULT_FILTER_THRUST_LENGTH);
+    adcBegin(CurrentChannel::pin, VoltageChannel::pin, PIN_THROTTLE_IN);
 
-    esc.attach(PIN_THROTTLE_OUT, PWM_MIN, PWM_MAX);
-    esc.writeMicroseconds(PWM_MIN);
-    pinMode(PIN_THROTTLE_IN, INPUT);
+    loadCellBegin(PIN_LOADCELL_DOUT, PIN_LOADCELL_SCK);
+    loadCellSetScale(LOADCELL_CALIBRATION);
+    loadCellSetOffset(LOADCELL_OFFSET);
+    autoZeroBegin(thrustZero, LOADCELL_OFFSET, labs(loadCellRawFromUnits(AUTO_ZERO_THRUST_LIMIT_G) - LOADCELL_OFFSET),
+        labs(loadCellRawFromUnits(AUTO_ZERO_THRUST_WINDOW_G) - LOADCELL_OFFSET), AUTO_ZERO_THRUST_SHIFT);
+    autoZeroBegin(currentZero, -CurrentChannel::offsetQ, CurrentChannel::adcQFrom(AUTO_ZERO_CURRENT_LIMIT_MA) + CurrentChannel::offsetQ,
+        CurrentChannel::adcQFrom(AUTO_ZERO_CURRENT_WINDOW_MA) + CurrentChannel::offsetQ, AUTO_ZERO_CURRENT_SHIFT);
+
+    halEscBegin(PIN_THROTTLE_OUT, PWM_MIN, PWM_MAX);
+    safetyBegin(PWM_MIN);
 
-    lcd.setCursor(0, 0);
     delay(2500);
-    lcd.clear();
+    screen.clear();
+    autoZeroTare(thrustZero, TARE_SAMPLES);     // Both finish in the background once the tasks run
+    autoZeroTare(currentZero, CURRENT_ZERO_SAMPLES);
     screenMode = ScreenMode::RUNNING_VALUES;
     testMode = TestMode::MANUAL;
 
+    storageBegin();
+    calibrationBegin();
     settings = readEepromSettings();
+    profileCustom = profileLoad(profile);
 
-    configureCommon(); // Setup pins for interrupt
-    attachInterrupt(digitalPinToInterrupt(PIN_BUTTON_ISR), pressInterrupt, FALLING);
+    halButtonsBegin(PIN_BUTTON_COMMON, buttonPins, sizeof(buttonPins) / sizeof(int));
+    buttonsBegin(sizeof(buttonPins) / sizeof(int));
 
-    esc.writeMicroseconds(PWM_MIN);
+    halEscWrite(PWM_MIN);
 
-    ahTimer = millis();
+    energyReset(energy);
+    wattmeterStatsReset(runStats);
+    schedulerBegin(taskStates, TASK_COUNT);
+#if INSTRUMENTATION
+    instrumentReset();
+#endif
 }
 
 void loop() {
+    INSTRUMENT_LOOP();
+    if (!schedulerRun(tasks, taskStates, TASK_COUNT) && adcSleep()) {
+        halSleep();     // Nothing due, keep the CPU quiet until the next interrupt
+    }
+}
 
-    //int batMonPin = A4;    // input pin for the voltage divider
-    int batVal = 0;       // variable for the A/D value
-
-    //int analogInPin = A0;  // Analog input pin that the carrier board OUT is connected to
-    int sensorValue = 0;        // value read from the carrier board
+// Drains the ADC and load cell queues and updates the running values
+void acquisitionTask() {
+    INSTRUMENT_SCOPE(STAGE_ACQUISITION);
+    static long weightRead = -1;
+    static unsigned long weightTimestamp;
 
-    float R1 = 47000.00; // 11660; // Resistance of R1 in ohms
-    float R2 = 10000.00; // 4620; // Resistance of R2 in ohms
+    long currentQSum = 0;
+    long voltageQSum = 0;
+    uint8_t blocks = 0;
+    AdcBlock block;
 
-    int sampleBVal = 0;
-    long sampleAmpVal = 0;
- 
-    if (saveSettings) {
-        writeEepromSettings(settings);
-        lcd.clear();
-        lcd.setCursor(0, 1);
-        lcd.print("   Settings Saved   ");
-        delay(1500);
-        saveSettings = false;
+    if (tareRequested) {
+        tareRequested = false;
+        autoZeroTare(thrustZero, TARE_SAMPLES);
+    }
+    if (enableThrottle) {
+        idleSince = millis();
+    }
+    bool idle = millis() - idleSince > AUTO_ZERO_SETTLE_MS;
+    long currentDriftQ = currentZero.zero + CurrentChannel::offsetQ;   // Q4 counts the sensor's zero moved
+
+    if (resetMeasurements) {
+        energyReset(energy);
+        wattmeterStatsReset(runStats);
+        curveReset(curve);
+        resetMeasurements = false;
     }
-    //Get measurements only when in screens required
-    if (screenMode < ScreenMode::SETTINGS) {
-        printDebugNewLine();
-
-        // Get input measurements for current and voltage
-        for (int x = 0; x < MAX_SAMPLES; x++) { // run through loop 10x
-
-         // read the analog in value:
-            sensorValue = analogRead(PIN_AIN);
-            sampleAmpVal = sampleAmpVal + sensorValue; // add samples together
 
-            batVal = analogRead(PIN_VIN);    // read the voltage on the divider 
-            sampleBVal = sampleBVal + batVal; // add samples together
+    // Collect the current and voltage blocks sampled by the ADC interrupt since the last pass
+    while (adcReadBlock(block)) {
+        long blockCurrentQ = adcAverageQ(block.currentSum, block.samples) - currentDriftQ;
+        long blockVoltageQ = adcAverageQ(block.voltageSum, block.samples);
+
+        // Integrate every block with its own time stamp, unfiltered since a median would bias the charge
+        long blockCurrent = CurrentChannel::fromAdcQ(calibrationApply(CALIBRATION_CURRENT, blockCurrentQ));
+        long blockVoltage = VoltageChannel::fromAdcQ(calibrationApply(CALIBRATION_VOLTAGE, blockVoltageQ));
+        energyAddSample(energy, blockCurrent, powerFromCurrentVoltage(blockCurrent, blockVoltage), block.timestamp);
+#ifdef RECORD_RAW
+        telemetrySendRawAdc(block, adcThrottleValue());
+#endif
 
-            if (MAX_SAMPLES > 1)
-                delayMicroseconds(2); // let ADC settle before next sample
+        // Running values, statistics and maxima only see filtered blocks
+        blockCurrentQ = filterUpdate(currentFilter, blockCurrentQ);
+        blockVoltageQ = filterUpdate(voltageFilter, blockVoltageQ);
+        currentQSum += blockCurrentQ;
+        voltageQSum += blockVoltageQ;
+        blocks++;
+        streamBlock(blockCurrentQ, blockVoltageQ, weightRead, block.timestamp);
+    }
 
+    ThrustSample thrustSample;
+    if (loadCellRead(thrustSample)) {   // Latest thrust measurement posted by the HX711 interrupt
+        if (autoZeroUpdate(thrustZero, thrustSample.filtered, idle)) {
+            loadCellSetOffset(thrustZero.zero);
         }
+        long grams = loadCellUnits(thrustSample.filtered);
+        calibrationFeed(CALIBRATION_THRUST, grams);
+        weightRead = autoZeroTaring(thrustZero) ? -1 : calibrationApply(CALIBRATION_THRUST, grams);
+        weightTimestamp = thrustSample.timestamp;
+#ifdef RECORD_RAW
+        telemetrySendRawLoadCell(thrustSample);
+#endif
+    }
+    else if (micros() - weightTimestamp > LOADCELL_STALE_MS * 1000UL) {
+        weightRead = -1;
+    }
 
+#ifdef RECORD_RAW
+    recordRawEvents();
+#endif
 
+    if (blocks == 0) { // Nothing new since the last release
+        return;
+    }
+    long currentQ = currentQSum / blocks;   // Average of the filtered blocks, Q4 counts
+    long voltageQ = voltageQSum / blocks;
 
-        int throttle = -1;
-        int val;
-        if (!enableThrottle) { // Disable throttle control
-            esc.writeMicroseconds(PWM_MIN);
-        }
-        else if (testMode == TestMode::MANUAL && enableThrottle) { // Get throttle measurment for manual tests and map to % value
-            val = analogRead(PIN_THROTTLE_IN);
-            throttle = map(val, 0, 1023, 0, 100);
-            val = map(val, 0, 1023, PWM_MIN, PWM_MAX);
-            esc.writeMicroseconds(val);
-        }
-        else if (testMode == TestMode::AUTOMATIC) { //Set Throttle to the value set by the autmatic testing at the time
-            throttle = runningValues.throttle;
-            val = map(throttle, 0, 100, PWM_MIN, PWM_MAX);
-            esc.writeMicroseconds(val);
-        }
+    autoZeroUpdate(currentZero, currentQ + currentDriftQ, idle);
+    calibrationFeed(CALIBRATION_CURRENT, currentQ);
+    calibrationFeed(CALIBRATION_VOLTAGE, voltageQ);
+
+    runningValues = valuesFromQ(currentQ, voltageQ, weightRead);
+    if (((screenMode == ScreenMode::RUNNING_VALUES || screenMode == ScreenMode::AVERAGE_VALUES || screenMode == ScreenMode::MAXIMUM_VALUES || screenMode == ScreenMode::CURVE_VALUES)&& enableThrottle) 
+        || (testMode == TestMode::AUTOMATIC && collectData)) {
+        processStatistics();
+    }
 
 #ifdef _DEBUG_
-        printDebug("I:" + String(avgSAV));
-        printDebug("THR:" + String(analogRead(PIN_THROTTLE_IN)));
-        printDebug("ESC:" + String(esc.readMicroseconds()));
+    printDebugNewLine();
+    printDebug(F("I:"), currentQ);
+    printDebug(F("THR:"), adcThrottleValue());
+    printDebug(F("ESC:"), halEscRead());
+    printDebug(F("W:"), weightRead);
 #endif
+}
 
-        //Calculate reading for Voltage, Amps, Power and consumption
-        long avgSAV = sampleAmpVal / MAX_SAMPLES;
-        long avgBVal = sampleBVal / MAX_SAMPLES;
-
-        float amps = (float)((avgSAV - CURRSENSOR_OFFSET) * CURRSENSOR_VPP); // Calculate amps on A/D pin
-        //float amps = (((5.0 / 1023) * (float)avgSAV) - (QOV + current_offset)) / sensor_sensitivity; // Alternative way to calculate current
-        amps = amps > 0 ? amps : 0;
-        float batteryVoltage = (avgBVal + VOLTSENSOR_OFFSET) * 0.00459 * (float)(R1 / R2);       //  Calculate the voltage on the A/D pin
-        float watts = amps * batteryVoltage;
+// Voltage, current, power and consumption of filtered Q4 readings, with the throttle and a thrust
+WattmeterValues valuesFromQ(long currentQ, long voltageQ, long thrust) {
+    long milliAmps = CurrentChannel::fromAdcQ(calibrationApply(CALIBRATION_CURRENT, currentQ));
+    long milliVolts = VoltageChannel::fromAdcQ(calibrationApply(CALIBRATION_VOLTAGE, voltageQ));
+    long milliWatts = powerFromCurrentVoltage(milliAmps, milliVolts);
+    WattmeterValues values = { throttlePercent, milliVolts, milliAmps, milliWatts, energyMilliAmpHours(energy), (int)thrust };
+    return values;
+}
 
-        float time = (float)(millis() - ahTimer) / 1000.0;
-        float ampHours = amps * 1000.00 * time / 3600.00;
+/*
+Streams streamRate samples a second with the blocks they were measured in,
+spread evenly over the blocks by a phase accumulator against the block rate.
+A rate at or above the block rate takes every block. The samples are queued
+into delta coded batches, so even every block fits the link.
+*/
+void streamBlock(long currentQ, long voltageQ, long thrust, unsigned long timestamp) {
+    static uint16_t streamPhase;
+    static uint8_t streamBlocks;    // Blocks since the last streamed sample
+    if (streamBlocks < 0xFF) {
+        streamBlocks++;
+    }
+    if (streamRate == 0) {
+        return;
+    }
+    uint16_t blockRate = adcBlockRate();    // 0.1 blocks/s
+    streamPhase += min(streamRate * 10UL, (unsigned long)blockRate);
+    if (streamPhase < blockRate) {
+        return;
+    }
+    streamPhase -= blockRate;
+    telemetryBatchSample(valuesFromQ(currentQ, voltageQ, thrust), timestamp, streamBlocks);
+    streamBlocks = 0;
+}
 
-        long weightRead = -1;
-        if (loadcell.wait_ready_timeout(LOADCELL_TIMEOUT)) {    // Get Thrust measurement
-            weightRead = loadcell.get_units();
-        }
-        printDebug("W:" + String(weightRead));
+#ifdef RECORD_RAW
+// Tare results, the input a replay needs besides the sensors and the button events
+void recordRawEvents() {
+    static bool offsetSent = false;
+    static long sentOffset;
 
-        // Store value measurements
-        runningValues = { throttle, batteryVoltage , amps, (int)watts, ampHours > 0.00 ? (int)ampHours : maximumValues.consumption, (int)weightRead };
-        if (((screenMode == ScreenMode::RUNNING_VALUES || screenMode == ScreenMode::AVERAGE_VALUES || screenMode == ScreenMode::MAXIMUM_VALUES)&& enableThrottle) 
-            || (testMode == TestMode::AUTOMATIC && collectData)) {
-            processAverageValues();
-        }
-        processMaxValues();
+    // Tares only, the replay tracks the drift itself from the recorded conversions
+    if (!offsetSent || thrustZero.centre != sentOffset) {
+        sentOffset = thrustZero.centre;
+        offsetSent = telemetrySendRawEvent(RAW_EVENT_TARE, micros(), sentOffset);
+    }
+}
+#endif
 
+// Keep the cutoff interrupt's limits up to date and report a cutoff it latched
+void safetyTask() {
+    INSTRUMENT_SCOPE(STAGE_SAFETY);
+    static int limitCurrent = -1;
+    static int limitThrust = -1;
+    static long limitOffset;
+    static uint8_t limitCalibration;
+    static long limitCurrentZero;
+
+    if (settings.maxCurrent != limitCurrent || settings.maxThrust != limitThrust || loadCellGetOffset() != limitOffset
+        || calibrationChanges() != limitCalibration || currentZero.zero != limitCurrentZero) {
+        limitCurrent = settings.maxCurrent;
+        limitThrust = settings.maxThrust;
+        limitOffset = loadCellGetOffset();
+        limitCalibration = calibrationChanges();
+        limitCurrentZero = currentZero.zero;
+        safetySetLimits(limitCurrent * 1000L, limitThrust, limitCurrentZero + CurrentChannel::offsetQ);
+    }
 
-        // Make sure that the Current or thrust is not above the cuttof value
-        if (runningValues.current > settings.maxCurrent) {  // Current is over the cutoff setting
-            if (!cutoffChecking) {  // First time here so record the time
-                cutoffChecking = !cutoffChecking;
-                cutoffTimer = millis();
-            }
-            else {
-                if (millis() - cutoffTimer > 500 && screenMode != ScreenMode::CURRENT_CUTOFF && screenMode != ScreenMode::SETTINGS) { // Disable throttle control if cuttof persit for over 500ms
-                    esc.writeMicroseconds(PWM_MIN);
-                    enableThrottle = !enableThrottle;
-                    screenMode = ScreenMode::CURRENT_CUTOFF;
-                    lcd.clear();
-                    enableThrottle = false;
-                    esc.writeMicroseconds(PWM_MIN);
-                    cutoffChecking = !cutoffChecking;
-                }
-            }
-        }
-        else if (runningValues.thrust > settings.maxThrust) {
-            if (!cutoffChecking) {  // First time here so record the time
-                cutoffChecking = !cutoffChecking;
-                cutoffTimer = millis();
-            }
-            else {
-                if (millis() - cutoffTimer > 500 && screenMode != ScreenMode::THRUST_CUTOFF && screenMode != ScreenMode::SETTINGS) { // Disable throttle control if cuttof persit for over 500ms
-                    esc.writeMicroseconds(PWM_MIN);
-                    enableThrottle = !enableThrottle;
-                    screenMode = ScreenMode::THRUST_CUTOFF;
-                    lcd.clear();
-                    enableThrottle = false;
-                    esc.writeMicroseconds(PWM_MIN);
-                    cutoffChecking = !cutoffChecking;
-                }
-            }
-        }
-    } // if(screenMode < ScreenMode::SETTINGS)
+    SafetyFault fault = safetyFault();
+    if (fault == FAULT_NONE) {
+        faultReported = false;
+    }
+    else if (!faultReported) {  // The interrupt already forced PWM_MIN, switch to the error screen
+        enableThrottle = false;
+        screenMode = fault == FAULT_CURRENT ? ScreenMode::CURRENT_CUTOFF : ScreenMode::THRUST_CUTOFF;
+        screen.clear();
+        faultReported = true;
+        printDebug(F("TRIP us:"), safetyTripLatency());
+    }
+}
 
-    switch (screenMode) {
-    case ScreenMode::RUNNING_VALUES:
-        displayValues("***RUNNING VALUES***", runningValues);
-        break;
-    case ScreenMode::AVERAGE_VALUES:
-        displayAverageValues("***AVERAGE VALUES***", averageValues);
-        break;
-    case ScreenMode::MAXIMUM_VALUES:
-        displayValues("***MAXIMUM VALUES***", maximumValues);
-        break;
-    case ScreenMode::SETTINGS:
-        settingsValues();
-        break;
-    case ScreenMode::CALIBRATION:
-        calibrationValues();
-        break;
-    case ScreenMode::CURRENT_CUTOFF:
-        displayCurrentCutoffError();
-        break;
-    case ScreenMode::THRUST_CUTOFF:
-        displayThrustCutoffError();
-        break;
-    case ScreenMode::AUTO_START:
-        displayAutoTestStart();
-        break;
-    case ScreenMode::AUTO_TEST1:
-        displayAutoTestPage1();
-        break;
-    case ScreenMode::AUTO_TEST2:
-        displayAutoTestPage2();
-        break;
-    case ScreenMode::AUTO_RESULTS:
-        displayAutoTestResultMenu();
-        break;
-    case ScreenMode::AUTO_END:
-        displayAutoTestEnd();
-        break;
-    //default:
-    //    displayValues("***RUNNING VALUES***", runningValues);
+// All ESC writes go through here so a latched cutoff can not be overridden
+void setEscOutput(int pulse) {
+    if (safetyFault() != FAULT_NONE) {
+        pulse = PWM_MIN;
     }
+    halEscWrite(pulse);
+}
 
-#ifdef EXPORT_VALUES
-    String dataLine = String(runningValues.throttle) + "," + String(runningValues.voltage) + ',' + 
-        String(runningValues.current) + ',' + String(runningValues.power) + ',' + 
-        String(runningValues.consumption) + ',' + String(runningValues.thrust);
-    Serial.println(dataLine);
-#endif
+// Drive the ESC from the throttle pot in manual tests or from the automatic test
+void escTask() {
+    INSTRUMENT_SCOPE(STAGE_ESC);
+    static bool manualRun = false;
+    static unsigned long runStart;
+    int val;
+    safetyArm(enableThrottle);  // Arm before the first pulse goes out
+
+    if (testMode == TestMode::MANUAL && enableThrottle && !manualRun) {
+        manualRun = true;
+        runStart = millis();
+    }
+    else if (manualRun && !enableThrottle) {
+        manualRun = false;
+        logRun(safetyFault() != FAULT_NONE ? RUN_ABORTED : 0, millis() - runStart);
+    }
+    if (!enableThrottle) { // Disable throttle control
+        throttlePercent = -1;
+        setEscOutput(PWM_MIN);
+    }
+    else if (testMode == TestMode::MANUAL && enableThrottle && serialThrottle >= 0) { // Throttle set over the serial port
+        throttlePercent = serialThrottle;
+        setEscOutput(map(throttlePercent, 0, 100, PWM_MIN, PWM_MAX));
+    }
+    else if (testMode == TestMode::MANUAL && enableThrottle) { // Get throttle measurment for manual tests and map to % value
+        val = adcThrottleValue();
+        throttlePercent = map(val, 0, 1023, 0, 100);
+        val = map(val, 0, 1023, PWM_MIN, PWM_MAX);
+        setEscOutput(val);
+    }
+    else if (testMode == TestMode::AUTOMATIC) { //Set Throttle to the value set by the autmatic testing at the time
+        throttlePercent = autoTestThrottle;
+        val = map(throttlePercent, 0, 100, PWM_MIN, PWM_MAX);
+        setEscOutput(val);
+    }
 }
 
-unsigned long lastFire = 0;
-bool settingEditMode = false;
-bool blink;
-void pressInterrupt() { // ISR
-    if (millis() - lastFire < 200) { // Debounce
+void displayTask() {
+    INSTRUMENT_SCOPE(STAGE_DISPLAY);
+    {
+        INSTRUMENT_SCOPE(STAGE_LCD_REFRESH);
+        screen.refresh(true);   // At most LCD_REFRESH_CELLS of the last redraw per run
+    }
+    if (millis() - displayRedrawTimer < LCD_REFRESH_MS) {
         return;
     }
+    displayRedrawTimer = millis();
 
-    lastFire = millis();
-
-    configureDistinct(); // Setup pins for testing individual buttons
+    if (saveSettings) {
+        writeEepromSettings(settings);
+        showMessage(F("*  Settings Saved  *"), F("*                  *"));
+    }
 
-    for (int i = 0; i < sizeof(buttonPins) / sizeof(int); i++) { // Test each button for press
-        if (!digitalRead(buttonPins[i])) {
-            buttonPressed(buttonPins[i]);
+    if (!displayMessage()) {
+        switch (screenMode) {
+        case ScreenMode::RUNNING_VALUES:
+            displayValues(F("***RUNNING VALUES***"), runningValues);
+            break;
+        case ScreenMode::AVERAGE_VALUES:
+            displayAverageValues(F("***AVERAGE VALUES***"), runStats);
+            break;
+        case ScreenMode::MAXIMUM_VALUES:
+            displayMaximumValues(F("***MAXIMUM VALUES***"), runStats);
+            break;
+        case ScreenMode::CURVE_VALUES:
+            displayCurve();
+            break;
+        case ScreenMode::SETTINGS:
+            settingsValues();
+            break;
+        case ScreenMode::CALIBRATION:
+            calibrationValues();
+            break;
+        case ScreenMode::CURRENT_CUTOFF:
+            displayCurrentCutoffError();
+            break;
+        case ScreenMode::THRUST_CUTOFF:
+            displayThrustCutoffError();
+            break;
+        case ScreenMode::AUTO_START:
+            displayAutoTestStart();
+            break;
+        case ScreenMode::AUTO_TEST:
+            displayAutoTestSegment();
+            break;
+        case ScreenMode::AUTO_RESULTS:
+            displayAutoTestResultMenu();
+            break;
+        case ScreenMode::AUTO_END:
+            displayAutoTestEnd();
+            break;
+        //default:
+        //    displayValues("***RUNNING VALUES***", runningValues);
         }
     }
-
-    configureCommon(); // Return to original state
+#ifdef _DEBUG_
+    static unsigned long reportTimer;
+    if (millis() - reportTimer > 5000) {
+        reportTimer = millis();
+        printDebugNewLine();
+        schedulerReport(Serial, tasks, taskStates, TASK_COUNT);
+    }
+#endif
 }
 
-void configureCommon() {
-    pinMode(PIN_BUTTON_ISR, INPUT_PULLUP);
+// The status frame of a stream and its last sample batch, the batches fill from acquisitionTask() with the blocks
+void telemetryTask() {
+    INSTRUMENT_SCOPE(STAGE_TELEMETRY);
+    static unsigned long statusTimer;
+    static uint8_t statusBits;
+    static bool statusSleep;
+    static bool statusSent = false;
+    unsigned long batchStart;
+
+    if (telemetryBatchStart(batchStart) && (streamRate == 0 || micros() - batchStart >= TELEMETRY_BATCH_US)) {
+        telemetryFlushBatch();
+    }
+    if (streamRate == 0) {
+        statusSent = false;     // A new stream starts with the status
+        return;
+    }
 
-    for (int i = 0; i < sizeof(buttonPins) / sizeof(int); i++) {
-        pinMode(buttonPins[i], OUTPUT);
-        digitalWrite(buttonPins[i], LOW);
+    // Acquisition settings once a second and right after a change
+    if (!statusSent || millis() - statusTimer >= TELEMETRY_STATUS_MS || adcOversampling() != statusBits || adcSleep() != statusSleep) {
+        statusTimer = millis();
+        statusBits = adcOversampling();
+        statusSleep = adcSleep();
+        statusSent = telemetrySendStatus(micros());
     }
 }
 
-void configureDistinct() {
-    pinMode(PIN_BUTTON_ISR, OUTPUT);
-    digitalWrite(PIN_BUTTON_ISR, LOW);
+// Show a framed two line message for MESSAGE_DURATION_MS without blocking
+void showMessage(const __FlashStringHelper* line1, const __FlashStringHelper* line2) {
+    messageLine1 = line1;
+    messageLine2 = line2;
+    messageTimer = millis();
+    messageActive = true;
+}
+
+bool displayMessage() {
+    if (!messageActive) {
+        return false;
+    }
+    if (millis() - messageTimer > MESSAGE_DURATION_MS) {
+        messageActive = false;
+        screen.clear();
+        return false;
+    }
+    screen.setCursor(0, 0);
+    screen.print(F("********************"));
+    screen.setCursor(0, 1);
+    screen.print(messageLine1);
+    screen.setCursor(0, 2);
+    screen.print(messageLine2);
+    screen.setCursor(0, 3);
+    screen.print(F("********************"));
+    return true;
+}
 
-    for (int i = 0; i < sizeof(buttonPins) / sizeof(int); i++) {
-        pinMode(buttonPins[i], INPUT_PULLUP);
+bool settingEditMode = false;
+bool blink;
+// Handles the debounced button events posted by the tick interrupt
+void buttonTask() {
+    INSTRUMENT_SCOPE(STAGE_BUTTONS);
+    ButtonEvent event;
+    while (buttonsRead(event)) {
+#ifdef RECORD_RAW
+        telemetrySendRawEvent(RAW_EVENT_BUTTON, event.timestamp, event.button | (long)event.type << 8);
+#endif
+        int button = buttonPins[event.button];
+        switch (event.type) {
+        case BUTTON_PRESS:
+            buttonPressed(button);
+            break;
+        case BUTTON_REPEAT:     // Holding next or previous scrolls through the settings
+            if ((screenMode == ScreenMode::SETTINGS || screenMode == ScreenMode::CALIBRATION) && !settingEditMode
+                && (button == PIN_BUTTON_TEST_MODE || button == PIN_BUTTON_PREVIOUS)) {
+                buttonPressed(button);
+            }
+            break;
+        case BUTTON_LONG_PRESS: // Tare without resetting the averages and maxima
+            if (button == PIN_BUTTON_PREVIOUS && screenMode == ScreenMode::RUNNING_VALUES && !enableThrottle) {
+                tareRequested = true;
+                showMessage(F("*   Taring Scale   *"), F("*                  *"));
+            }
+            break;
+        }
     }
 }
 
-long autoTestTimer;
+// Writes the queued EEPROM bytes, one per run once the previous write is done
+void storageTask() {
+    INSTRUMENT_SCOPE(STAGE_STORAGE);
+    storagePoll();
+}
+
 long settingEditBlinkTimer;
 bool settingSelectNext = false;
 bool settingSelectPrevious = false;
 bool isAborted = false;
 bool viewResult = false;
 int autoTestResultsPage = 1;
+int curvePage = 0;
 bool clearScreen;
 void buttonPressed(int button) { // Our handler
     switch (button) {
@@ -392,7 +659,7 @@ void buttonPressed(int button) { // Our handler
         else if (screenMode == ScreenMode::AUTO_RESULTS) {
             clearScreen = true;
             autoTestResultsPage++;
-            if (autoTestResultsPage > 4) {
+            if (autoTestResultsPage > autoTestResultPages) {
                 autoTestResultsPage = 1;
             }
         }
@@ -402,7 +669,7 @@ void buttonPressed(int button) { // Our handler
         if (testMode == TestMode::MANUAL && (screenMode != ScreenMode::SETTINGS && screenMode!=ScreenMode::CALIBRATION)) { // If in Manual test Toggle to first page for Autotmatic Test and start timer
             testMode = TestMode::AUTOMATIC;
             screenMode = ScreenMode::AUTO_START;
-            autoTestTimer = micros()/1000 + 6000;
+            startAutoTest = true;
         }
         else if ((screenMode == ScreenMode::SETTINGS || screenMode == ScreenMode::CALIBRATION) && !settingEditMode) {
             settingSelectNext = true;
@@ -413,14 +680,14 @@ void buttonPressed(int button) { // Our handler
         }
         break;
     case PIN_BUTTON_PREVIOUS:
-        if (screenMode == ScreenMode::AVERAGE_VALUES || screenMode == ScreenMode::MAXIMUM_VALUES) {
+        if (screenMode == ScreenMode::AVERAGE_VALUES || screenMode == ScreenMode::MAXIMUM_VALUES || screenMode == ScreenMode::CURVE_VALUES) {
             // Reset average and maximum values for new manual tests
-            averageValues = { 0,{0,0,0,0,0,0} };
-            maximumValues = { 0,0,0,0,0,0 };
-            // Reset scale back to zero
-            loadcell.tare();
-            //Reset AH timer
-            ahTimer = millis();
+            // Reset scale back to zero, never under thrust: the cutoff and every later reading would shift
+            if (!enableThrottle) {
+                tareRequested = true;
+            }
+            //Reset averages, maximums and consumption
+            resetMeasurements = true;
         }
         if ((screenMode != ScreenMode::SETTINGS || screenMode != ScreenMode::CALIBRATION) && !settingEditMode) {
             settingSelectPrevious = true;
@@ -429,27 +696,27 @@ void buttonPressed(int button) { // Our handler
     case PIN_BUTTON_THROTTLE_CUT:   // Button to control throttle cut
                                     // Also used to decrease values in settings when in edit mode
         if (screenMode == ScreenMode::RUNNING_VALUES) { // Controll throttle engagement when in Manual
-            if (!enableThrottle && analogRead(PIN_THROTTLE_IN)==0) { // Enable throttle only if throttle value is 0%
+            if (!enableThrottle && throttleAtZero()) { // Enable throttle only if throttle value is 0%
                 enableThrottle = !enableThrottle;
             }
             else if (enableThrottle)
                 enableThrottle = !enableThrottle;
         }
-        else if (testMode == TestMode::AUTOMATIC && (screenMode == ScreenMode::AUTO_TEST1 || screenMode == ScreenMode::AUTO_TEST2)) {
+        else if (testMode == TestMode::AUTOMATIC && screenMode == ScreenMode::AUTO_TEST) {
             // if throttle cut is pressed during autot testing, stop the test
-            enableThrottle = false;
-            screenMode = ScreenMode::AUTO_END;
-            isAborted = true;
+            abortAutomaticTest();
         }
         break;
     case PIN_BUTTON_OK:
         if (testMode == TestMode::MANUAL && (screenMode == ScreenMode::CURRENT_CUTOFF || screenMode == ScreenMode::THRUST_CUTOFF)) {
             // Goto to first page in manual test when pressed ok in error screens
+            safetyClearFault();
             screenMode = ScreenMode::RUNNING_VALUES;
             isAborted = true;
         }
         else if (testMode == TestMode::AUTOMATIC && (screenMode == ScreenMode::CURRENT_CUTOFF || screenMode == ScreenMode::THRUST_CUTOFF)) {
             // Goto to last page in auto test when pressed ok in error screens
+            safetyClearFault();
             screenMode = ScreenMode::AUTO_END;
             isAborted = true;
         }
@@ -458,10 +725,14 @@ void buttonPressed(int button) { // Our handler
             settingEditMode = !settingEditMode;
             settingEditBlinkTimer = micros() / 1000;
         }
+        else if (screenMode == ScreenMode::CURVE_VALUES) {
+            clearScreen = true;
+            curvePage++;
+        }
         else if (screenMode == ScreenMode::AUTO_RESULTS) {
             clearScreen = true;
                  autoTestResultsPage++;
-                if (autoTestResultsPage > 4) {
+                if (autoTestResultsPage > autoTestResultPages) {
                     autoTestResultsPage = 1;
                 }
         }
@@ -469,6 +740,25 @@ void buttonPressed(int button) { // Our handler
     }
 }
 
+// The throttle may only be enabled from zero, from the pot or the serial port, whichever sets it
+bool throttleAtZero() {
+    return serialThrottle >= 0 ? serialThrottle == 0 : adcThrottleValue() == 0;
+}
+
+// Running, average, maximum or curve, the screens the measurements are taken on
+bool onValuesScreen() {
+    return screenMode == ScreenMode::RUNNING_VALUES || screenMode == ScreenMode::AVERAGE_VALUES
+        || screenMode == ScreenMode::MAXIMUM_VALUES || screenMode == ScreenMode::CURVE_VALUES;
+}
+
+// Cut the throttle and end a running automatic test as aborted
+void abortAutomaticTest() {
+    enableThrottle = false;
+    abortAutoTest = true;
+    screenMode = ScreenMode::AUTO_END;
+    isAborted = true;
+}
+
 void toggleScreenMode() {
     if (testMode == TestMode::MANUAL) {
         switch (screenMode) {
@@ -479,6 +769,10 @@ void toggleScreenMode() {
             screenMode = ScreenMode::MAXIMUM_VALUES;
             break;
         case ScreenMode::MAXIMUM_VALUES:
+            screenMode = ScreenMode::CURVE_VALUES;
+            curvePage = 0;
+            break;
+        case ScreenMode::CURVE_VALUES:
             if (enableThrottle) {
                 screenMode = ScreenMode::RUNNING_VALUES;
             }
@@ -495,9 +789,11 @@ void toggleScreenMode() {
             saveSettings = settingsDiff(settings);
             break;
         case ScreenMode::CURRENT_CUTOFF:
+            safetyClearFault();
             screenMode = ScreenMode::RUNNING_VALUES;
             break;
         case ScreenMode::THRUST_CUTOFF:
+            safetyClearFault();
             screenMode = ScreenMode::RUNNING_VALUES;
             break;
         default:
@@ -508,6 +804,7 @@ void toggleScreenMode() {
     else if (testMode == TestMode::AUTOMATIC) {
         switch (screenMode) {
          default:
+            abortAutoTest = true;
             testMode = TestMode::MANUAL;
             screenMode = ScreenMode::RUNNING_VALUES;
             isAborted = false;
@@ -516,113 +813,125 @@ void toggleScreenMode() {
 }
 
 
-String fixedLength(String str, int len) {
-    String spaces = "";
-
-    if (len > str.length())
-        for (int i = 0; i < len - str.length(); i++)
-            spaces += " ";
-    return str + spaces;
-}
-
-void  processMaxValues() {
-    if (runningValues.throttle > maximumValues.throttle)
-        maximumValues.throttle = runningValues.throttle;
-    if (runningValues.voltage > maximumValues.voltage)
-        maximumValues.voltage = runningValues.voltage;
-    if (runningValues.current > maximumValues.current)
-        maximumValues.current = runningValues.current;
-    if (runningValues.power > maximumValues.power)
-        maximumValues.power = runningValues.power;
-    if (runningValues.consumption > maximumValues.consumption)
-        maximumValues.consumption = runningValues.consumption;
-    if (runningValues.thrust > maximumValues.thrust)
-        maximumValues.thrust = runningValues.thrust;
-}
-
-void processAverageValues() {
-    if (averageValues.samples == 100) {
-        averageValues.values.throttle = averageValues.values.throttle / averageValues.samples;
-        averageValues.values.voltage = averageValues.values.voltage / averageValues.samples;
-        averageValues.values.current = averageValues.values.current / averageValues.samples;
-        averageValues.values.power = averageValues.values.power / averageValues.samples;
-        averageValues.values.thrust = averageValues.values.thrust / averageValues.samples;
-        averageValues.values.consumption = runningValues.consumption;
-        averageValues.samples = 1;
-    }
-    averageValues.samples += 1;
-    averageValues.values.throttle += runningValues.throttle;
-    averageValues.values.voltage += runningValues.voltage;
-    averageValues.values.current += runningValues.current;
-    averageValues.values.power += runningValues.power;
-    averageValues.values.consumption = runningValues.consumption;
-    averageValues.values.thrust += runningValues.thrust;
+void processStatistics() {
+    INSTRUMENT_SCOPE(STAGE_STATISTICS);
+    wattmeterStatsAdd(runStats, runningValues);
+    curveAdd(curve, runningValues);
 }
 
 long seconds;
-void displayValues(String header, WattmeterValues readings) {
+void displayValues(const char* header, WattmeterValues readings) {
+    char field[LCD_COLUMNS + 1];   // Scratch buffer for the formatted fields, on the stack only while a screen draws
     if (clearScreen) {
-        lcd.clear();
+        screen.clear();
         clearScreen = false;
     }
-    lcd.setCursor(0, 0);
-    lcd.print(header);
+    screen.setCursor(0, 0);
+    screen.print(header);
 
-    lcd.setCursor(0, 1);
-    lcd.print(fixedLength("V=" + String(readings.voltage) + "V", 10));
+    screen.setCursor(0, 1);
+    screen.print(formatFixedField(field, 10, F("V="), readings.voltage / 10, 2, F("V")));
 
-    lcd.setCursor(10, 1);
-    lcd.print(fixedLength("I=" + String(readings.current) + "A", 10));
+    screen.setCursor(10, 1);
+    screen.print(formatFixedField(field, 10, F("I="), readings.current / 10, 2, F("A")));
 
-    lcd.setCursor(0, 2);
-    lcd.print(fixedLength("P=" + String(readings.power) + "W", 10));
-    lcd.setCursor(10, 2);
+    screen.setCursor(0, 2);
+    screen.print(formatFixedField(field, 10, F("P="), readings.power / 100, 1, F("W")));
+    screen.setCursor(10, 2);
     if (screenMode == ScreenMode::RUNNING_VALUES) {
-        lcd.print(fixedLength("Q=" + String(readings.consumption) + "mAh", 10));
+        screen.print(formatField(field, 10, F("Q="), readings.consumption, F("mAh")));
     }
     else if(testMode==TestMode::AUTOMATIC){
-        lcd.print(fixedLength("t=" + String(seconds) + "s", 10));
+        screen.print(formatField(field, 10, F("t="), seconds, F("s")));
+    }
+    else if (screenMode == ScreenMode::AVERAGE_VALUES) {
+        screen.print(formatFixedField(field, 10, F("E="), energyMilliWattHours(energy) / 100, 1, F("Wh")));
     }
     else {
-        lcd.print("          ");
+        screen.print(F("          "));
     }
 
-    lcd.setCursor(0, 3);
+    screen.setCursor(0, 3);
     if (readings.thrust > 0) {
-        lcd.print(fixedLength("T=" + String(readings.thrust) + "g", 10));
+        screen.print(formatField(field, 10, F("T="), readings.thrust, F("g")));
     }
     else {
-        lcd.print(fixedLength("T=" + String(0) + "g", 10));
+        screen.print(formatField(field, 10, F("T="), 0, F("g")));
     }
-    lcd.setCursor(10, 3);
+    screen.setCursor(10, 3);
     if (readings.throttle >= 0) {
-        lcd.print(fixedLength("THR=" + String(readings.throttle) + "%", 10));
+        screen.print(formatField(field, 10, F("THR="), readings.throttle, F("%")));
     }
     else {
-        lcd.print(fixedLength("THR=(IDLE)", 10));
+        screen.print(formatTextField(field, 10, F("THR=(IDLE)")));
     }
 
 }
 
-void displayAverageValues(String header, AverageValues val) {
-    WattmeterValues newAverage = { 0,0,0,0,0,0 };
-
-    if (val.samples > 0) {
-        newAverage.throttle = val.values.throttle / val.samples;
-        newAverage.voltage = val.values.voltage / val.samples;
-        newAverage.current = val.values.current / val.samples;
-        newAverage.power = val.values.power / val.samples;
-        newAverage.thrust = val.values.thrust / val.samples;
-        newAverage.consumption = val.values.consumption;
+// Power, thrust and efficiency of the throttle bins that have samples, CURVE_ROWS per page
+void displayCurve() {
+    char field[LCD_COLUMNS + 1];
+    if (clearScreen) {
+        screen.clear();
+        clearScreen = false;
+    }
+    screen.setCursor(0, 0);
+    screen.print(F("THR W     g     g/W "));
+
+    WattmeterValues values;
+    int first = curvePage * CURVE_ROWS;
+    int shown = 0;
+    int row = 1;
+    for (uint8_t bin = 0; bin < THROTTLE_BINS && row <= CURVE_ROWS; bin++) {
+        if (!curveMean(curve, bin, values) || shown++ < first) {
+            continue;
+        }
+        screen.setCursor(0, row);
+        screen.print(formatField(field, 4, F(""), values.throttle, F("")));
+        screen.setCursor(4, row);
+        screen.print(formatField(field, 6, F(""), values.power / 1000, F("")));
+        screen.setCursor(10, row);
+        screen.print(formatField(field, 6, F(""), values.thrust, F("")));
+        screen.setCursor(16, row);
+        screen.print(formatFixedField(field, 4, F(""), curveGramsPerWatt(values), 1, F("")));
+        row++;
+    }
+    if (row == 1 && curvePage > 0) {    // Paged past the last bin, start over
+        curvePage = 0;
+        return;
     }
-    displayValues(header, newAverage);
+    for (; row <= CURVE_ROWS; row++) {
+        screen.setCursor(0, row);
+        screen.print(formatTextField(field, LCD_COLUMNS, row == 1 ? F("NO SAMPLES") : F("")));
+    }
+}
+
+// Headers from flash, copied for the segment headers built in RAM
+void displayValues(const __FlashStringHelper* header, WattmeterValues readings) {
+    char text[LCD_COLUMNS + 1];
+    strncpy_P(text, reinterpret_cast<const char*>(header), LCD_COLUMNS);
+    text[LCD_COLUMNS] = '\0';
+    displayValues(text, readings);
+}
+
+void displayAverageValues(const __FlashStringHelper* header, const WattmeterStats& stats) {
+    WattmeterValues average;
+    wattmeterStatsMean(stats, average);
+    displayValues(header, average);
+}
+
+void displayMaximumValues(const __FlashStringHelper* header, const WattmeterStats& stats) {
+    WattmeterValues maximum;
+    wattmeterStatsMaximum(stats, maximum);
+    displayValues(header, maximum);
 }
 
 int cursor = 1;
 void settingsValues() {
+    char field[LCD_COLUMNS + 1];
 
-    lcd.setCursor(0, 0);
-    lcd.print("******SETTINGS******");
+    screen.setCursor(0, 0);
+    screen.print(F("******SETTINGS******"));
     
     if (settingEditMode) {
         if (millis() - settingEditBlinkTimer > 500) {
@@ -648,37 +957,37 @@ void settingsValues() {
     }
     selected = cursor % 3;
     if (cursor / 3.00 <= 1) {
-        lcd.setCursor(1, 1);
+        screen.setCursor(1, 1);
         if (settingEditMode && blink && selected == 1) {
-            lcd.print(fixedLength("Max Current=", 18));
+            screen.print(formatTextField(field, 18, F("Max Current=")));
         }
         else {
-            lcd.print(fixedLength("Max Current=" + String(settings.maxCurrent) + "A", 18));
+            screen.print(formatField(field, 18, F("Max Current="), settings.maxCurrent, F("A")));
         }
-        lcd.setCursor(1, 2);
+        screen.setCursor(1, 2);
         if (settingEditMode && blink && selected == 2) {
-            lcd.print(fixedLength("Max Thrust=", 18));
+            screen.print(formatTextField(field, 18, F("Max Thrust=")));
         }
         else {
-            lcd.print(fixedLength("Max Thrust=" + String(settings.maxThrust) + "gr", 18));
+            screen.print(formatField(field, 18, F("Max Thrust="), settings.maxThrust, F("gr")));
         }
-        lcd.setCursor(1, 3);
+        screen.setCursor(1, 3);
         if (settingEditMode && blink && selected == 0) {
-            lcd.print(fixedLength("Half THR Test=", 18));
+            screen.print(formatTextField(field, 18, F("Half THR Test=")));
         }
         else {
-            lcd.print(fixedLength("Half THR Test=" + String(settings.midTestDuration) + "s", 18));
+            screen.print(formatField(field, 18, F("Half THR Test="), settings.midTestDuration, F("s")));
         }
         if (settingEditMode) {
            switch (selected) {
             case 1:
-                settings.maxCurrent = map(analogRead(PIN_THROTTLE_IN), 0, 1023, 10, 120);
+                settings.maxCurrent = map(adcThrottleValue(), 0, 1023, SETTING_CURRENT_MIN, SETTING_CURRENT_MAX);
                 break;
             case 2:
-                settings.maxThrust = map(analogRead(PIN_THROTTLE_IN), 0, 1023, 500, 10000);
+                settings.maxThrust = map(adcThrottleValue(), 0, 1023, SETTING_THRUST_MIN, SETTING_THRUST_MAX);
                 break;
             case 0:
-                settings.midTestDuration = map(analogRead(PIN_THROTTLE_IN), 0, 1023, 1, 60);
+                settings.midTestDuration = map(adcThrottleValue(), 0, 1023, SETTING_TEST_MIN, SETTING_TEST_MAX);
                 break;
             }
 
@@ -686,30 +995,30 @@ void settingsValues() {
     }
 
     if (cursor / 3.00 > 1 && cursor / 3.00 <= 2) {
-        lcd.setCursor(1, 1);
+        screen.setCursor(1, 1);
         if (settingEditMode && blink && selected == 1) {
-            lcd.print(fixedLength("Full THR Test=", 18));
+            screen.print(formatTextField(field, 18, F("Full THR Test=")));
         }
         else {
-            lcd.print(fixedLength("Full THR Test=" + String(settings.maxTestDuration) + "s", 18));
+            screen.print(formatField(field, 18, F("Full THR Test="), settings.maxTestDuration, F("s")));
         }
-        lcd.setCursor(1, 2);
+        screen.setCursor(1, 2);
         if (settingEditMode && blink && selected == 2) {
-            lcd.print(fixedLength("Warm Up Time=", 18));
+            screen.print(formatTextField(field, 18, F("Warm Up Time=")));
         }
         else {
-            lcd.print(fixedLength("Warm Up Time=" + String(settings.warmUptime) + "s", 18));
+            screen.print(formatField(field, 18, F("Warm Up Time="), settings.warmUptime, F("s")));
         }
-        lcd.setCursor(1, 3);
-        lcd.print(fixedLength(" ", 18));
+        screen.setCursor(1, 3);
+        screen.print(formatTextField(field, 18, F("")));
 
         if (settingEditMode) {
             switch (selected) {
             case 1:
-                settings.maxTestDuration = map(analogRead(PIN_THROTTLE_IN), 0, 1023, 1, 60);
+                settings.maxTestDuration = map(adcThrottleValue(), 0, 1023, SETTING_TEST_MIN, SETTING_TEST_MAX);
                 break;
             case 2:
-                settings.warmUptime = map(analogRead(PIN_THROTTLE_IN), 0, 1023, 1, 6);
+                settings.warmUptime = map(adcThrottleValue(), 0, 1023, SETTING_WARMUP_MIN, SETTING_WARMUP_MAX);
                 break;
             case 0:
                 break;
@@ -725,64 +1034,71 @@ void settingsValues() {
 
     switch (selected) {
     case 1:
-        lcd.setCursor(0, 1);
-        lcd.print(">");
-        lcd.setCursor(19, 1);
-        lcd.print("<");
-        lcd.setCursor(0, 2);
-        lcd.print(" ");
-        lcd.setCursor(19, 2);
-        lcd.print(" ");
-        lcd.setCursor(0,3);
-        lcd.print(" ");
-        lcd.setCursor(19, 3);
-        lcd.print(" ");
+        screen.setCursor(0, 1);
+        screen.print('>');
+        screen.setCursor(19, 1);
+        screen.print('<');
+        screen.setCursor(0, 2);
+        screen.print(' ');
+        screen.setCursor(19, 2);
+        screen.print(' ');
+        screen.setCursor(0,3);
+        screen.print(' ');
+        screen.setCursor(19, 3);
+        screen.print(' ');
         break;
     case 2:
-        lcd.setCursor(0, 1);
-        lcd.print(" ");
-        lcd.setCursor(19, 1);
-        lcd.print(" ");
-        lcd.setCursor(0, 2);
-        lcd.print(">");
-        lcd.setCursor(19, 2);
-        lcd.print("<");
-        lcd.setCursor(0, 3);
-        lcd.print(" ");
-        lcd.setCursor(19, 3);
-        lcd.print(" ");
+        screen.setCursor(0, 1);
+        screen.print(' ');
+        screen.setCursor(19, 1);
+        screen.print(' ');
+        screen.setCursor(0, 2);
+        screen.print('>');
+        screen.setCursor(19, 2);
+        screen.print('<');
+        screen.setCursor(0, 3);
+        screen.print(' ');
+        screen.setCursor(19, 3);
+        screen.print(' ');
         break;
     case 0:
-        lcd.setCursor(0, 1);
-        lcd.print(" ");
-        lcd.setCursor(19, 1);
-        lcd.print(" ");
-        lcd.setCursor(0, 2);
-        lcd.print(" ");
-        lcd.setCursor(19, 2);
-        lcd.print(" ");
-        lcd.setCursor(0, 3);
-        lcd.print(">");
-        lcd.setCursor(19, 3);
-        lcd.print("<");
+        screen.setCursor(0, 1);
+        screen.print(' ');
+        screen.setCursor(19, 1);
+        screen.print(' ');
+        screen.setCursor(0, 2);
+        screen.print(' ');
+        screen.setCursor(19, 2);
+        screen.print(' ');
+        screen.setCursor(0, 3);
+        screen.print('>');
+        screen.setCursor(19, 3);
+        screen.print('<');
         break;
     default:
-        lcd.setCursor(0, 1);
-        lcd.print(" ");
-        lcd.setCursor(19, 1);
-        lcd.print(" ");
-        lcd.setCursor(0, 2);
-        lcd.print(" ");
-        lcd.setCursor(19, 2);
-        lcd.print(" ");
-        lcd.setCursor(0, 3);
-        lcd.print(" ");
-        lcd.setCursor(19, 3);
-        lcd.print(" ");
+        screen.setCursor(0, 1);
+        screen.print(' ');
+        screen.setCursor(19, 1);
+        screen.print(' ');
+        screen.setCursor(0, 2);
+        screen.print(' ');
+        screen.setCursor(19, 2);
+        screen.print(' ');
+        screen.setCursor(0, 3);
+        screen.print(' ');
+        screen.setCursor(19, 3);
+        screen.print(' ');
     }
 }
 bool throttleCheck = true;
+long calibrationReference[CALIBRATION_CHANNELS];   // mA, mV and g, set with the throttle pot
+
+// Editing a line sets its reference with the pot, leaving the edit captures a point at it
 void calibrationValues() {
+    char field[LCD_COLUMNS + 1];
+    static bool wasEditing = false;
+    static uint8_t shownCapture = CAPTURE_IDLE;
+    static const uint8_t channels[] = { CALIBRATION_THRUST, CALIBRATION_CURRENT, CALIBRATION_VOLTAGE };  // By selected line
 
     if (settingEditMode) {
         if (millis() - settingEditBlinkTimer > 500) {
@@ -790,17 +1106,10 @@ void calibrationValues() {
             settingEditBlinkTimer = millis();
         }
         if (cursor == 1 && throttleCheck) {
-            if (analogRead(PIN_THROTTLE_IN) > 0) {
-                lcd.setCursor(0, 0);
-                lcd.print("********************");
-                lcd.setCursor(0, 1);
-                lcd.print("* THROTTLE IS NOT  *");
-                lcd.setCursor(0, 2);
-                lcd.print("*       IDLE       *");
-                lcd.setCursor(0, 3);
-                lcd.print("********************");
+            if (adcThrottleValue() > 0) {
+                showMessage(F("* THROTTLE IS NOT  *"), F("*       IDLE       *"));
                 settingEditMode = false;
-                delay(1500);
+                wasEditing = false;
                 return;
             }
             else {
@@ -822,48 +1131,66 @@ void calibrationValues() {
 
     }
 
-    lcd.setCursor(0, 0);
-    lcd.print("****CALIBRATION*****");
-
     int selected;
     selected = cursor % 3;
+    if (wasEditing && !settingEditMode) {
+        captureCalibration(channels[selected], calibrationReference[channels[selected]]);
+    }
+    wasEditing = settingEditMode;
+
+    uint8_t capture = calibrationCaptureState();
+    if (capture != shownCapture) {
+        shownCapture = capture;
+        if (capture == CAPTURE_DONE) {
+            showMessage(F("*  Point Captured  *"), F("*                  *"));
+            return;
+        }
+        if (capture == CAPTURE_FAILED) {
+            showMessage(F("*  Point Rejected  *"), F("* Check References *"));
+            return;
+        }
+    }
+
+    screen.setCursor(0, 0);
+    screen.print(capture == CAPTURE_RUNNING ? F("**** CAPTURING *****") : F("****CALIBRATION*****"));
+
     if (cursor / 3.00 <= 1) {
-        lcd.setCursor(1, 1);
-        lcd.print(fixedLength("I=" + String(runningValues.current) + "A", 9));
-        lcd.setCursor(10, 1);
+        screen.setCursor(1, 1);
+        screen.print(formatFixedField(field, 9, F("I="), runningValues.current / 10, 2, F("A")));
+        screen.setCursor(10, 1);
         if (settingEditMode && blink && selected == 1) {
 
-            lcd.print(fixedLength("f=", 8));
+            screen.print(formatTextField(field, 9, F("r=")));
         }
         else {
-            lcd.print(fixedLength("f=" + String(settings.currentOffset), 9));
+            screen.print(formatFixedField(field, 9, F("r="), calibrationReference[CALIBRATION_CURRENT] / 10, 2, F("A")));
         }
-        lcd.setCursor(1, 2);
-        lcd.print(fixedLength("V=" + String(runningValues.voltage) + "V", 9));
+        screen.setCursor(1, 2);
+        screen.print(formatFixedField(field, 9, F("V="), runningValues.voltage / 10, 2, F("V")));
         if (settingEditMode && blink && selected == 2) {
-            lcd.print(fixedLength("f=", 8));
+            screen.print(formatTextField(field, 9, F("r=")));
         }
         else {
-            lcd.print(fixedLength("f=" + String(settings.voltageOffset), 9));
+            screen.print(formatFixedField(field, 9, F("r="), calibrationReference[CALIBRATION_VOLTAGE] / 10, 2, F("V")));
         }
-        lcd.setCursor(1, 3);
-        lcd.print(fixedLength("W=" + String(runningValues.thrust) + "Kg", 9));
+        screen.setCursor(1, 3);
+        screen.print(formatField(field, 9, F("W="), runningValues.thrust, F("g")));
         if (settingEditMode && blink && selected == 0) {
-            lcd.print(fixedLength("f=", 8));
+            screen.print(formatTextField(field, 9, F("r=")));
         }
         else {
-            lcd.print(fixedLength("f=" + String(settings.thrustOffset), 9));
+            screen.print(formatField(field, 9, F("r="), calibrationReference[CALIBRATION_THRUST], F("g")));
         }
         if (settingEditMode) {
             switch (selected) {
             case 1:
-                settings.currentOffset = map(analogRead(PIN_THROTTLE_IN), 0, 1023, 0, 1000) / 10.00;
+                calibrationReference[CALIBRATION_CURRENT] = map(adcThrottleValue(), 0, 1023, 0, 1200) * 100;    // 0.1A steps to 120A
                 break;
             case 2:
-                settings.voltageOffset = map(analogRead(PIN_THROTTLE_IN), 0, 1023, 0, 1000) / 10.00;
+                calibrationReference[CALIBRATION_VOLTAGE] = map(adcThrottleValue(), 0, 1023, 0, 3000) * 10;     // 10mV steps to 30V
                 break;
             case 0:
-                settings.thrustOffset = map(analogRead(PIN_THROTTLE_IN), 0, 1023, 0, 1000) / 10.00;
+                calibrationReference[CALIBRATION_THRUST] = map(adcThrottleValue(), 0, 1023, 0, 1000) * 10;      // 10g steps to 10kg
                 break;
             }
 
@@ -871,278 +1198,1136 @@ void calibrationValues() {
     }
     switch (selected) {
     case 1:
-        lcd.setCursor(0, 1);
-        lcd.print(">");
-        lcd.setCursor(19, 1);
-        lcd.print("<");
-        lcd.setCursor(0, 2);
-        lcd.print(" ");
-        lcd.setCursor(19, 2);
-        lcd.print(" ");
-        lcd.setCursor(0, 3);
-        lcd.print(" ");
-        lcd.setCursor(19, 3);
-        lcd.print(" ");
+        screen.setCursor(0, 1);
+        screen.print('>');
+        screen.setCursor(19, 1);
+        screen.print('<');
+        screen.setCursor(0, 2);
+        screen.print(' ');
+        screen.setCursor(19, 2);
+        screen.print(' ');
+        screen.setCursor(0, 3);
+        screen.print(' ');
+        screen.setCursor(19, 3);
+        screen.print(' ');
         break;
     case 2:
-        lcd.setCursor(0, 1);
-        lcd.print(" ");
-        lcd.setCursor(19, 1);
-        lcd.print(" ");
-        lcd.setCursor(0, 2);
-        lcd.print(">");
-        lcd.setCursor(19, 2);
-        lcd.print("<");
-        lcd.setCursor(0, 3);
-        lcd.print(" ");
-        lcd.setCursor(19, 3);
-        lcd.print(" ");
+        screen.setCursor(0, 1);
+        screen.print(' ');
+        screen.setCursor(19, 1);
+        screen.print(' ');
+        screen.setCursor(0, 2);
+        screen.print('>');
+        screen.setCursor(19, 2);
+        screen.print('<');
+        screen.setCursor(0, 3);
+        screen.print(' ');
+        screen.setCursor(19, 3);
+        screen.print(' ');
         break;
     case 0:
-        lcd.setCursor(0, 1);
-        lcd.print(" ");
-        lcd.setCursor(19, 1);
-        lcd.print(" ");
-        lcd.setCursor(0, 2);
-        lcd.print(" ");
-        lcd.setCursor(19, 2);
-        lcd.print(" ");
-        lcd.setCursor(0, 3);
-        lcd.print(">");
-        lcd.setCursor(19, 3);
-        lcd.print("<");
+        screen.setCursor(0, 1);
+        screen.print(' ');
+        screen.setCursor(19, 1);
+        screen.print(' ');
+        screen.setCursor(0, 2);
+        screen.print(' ');
+        screen.setCursor(19, 2);
+        screen.print(' ');
+        screen.setCursor(0, 3);
+        screen.print('>');
+        screen.setCursor(19, 3);
+        screen.print('<');
         break;
     }
 
 }
 
 void displayCurrentCutoffError() {
-    lcd.setCursor(0, 0);
-    lcd.print("********************");
-    lcd.setCursor(0, 1);
-    lcd.print("* CURRENT OVERLOAD *");
-    lcd.setCursor(0, 2);
-    lcd.print("* PRESS OK BUTTON  *");
-    lcd.setCursor(0, 3);
-    lcd.print("********************");
+    screen.setCursor(0, 0);
+    screen.print(F("********************"));
+    screen.setCursor(0, 1);
+    screen.print(F("* CURRENT OVERLOAD *"));
+    screen.setCursor(0, 2);
+    screen.print(F("* PRESS OK BUTTON  *"));
+    screen.setCursor(0, 3);
+    screen.print(F("********************"));
 }
 
+// Over thrust, or no thrust reading: the HX711 stopped converting while armed
 void displayThrustCutoffError() {
-    lcd.setCursor(0, 0);
-    lcd.print("********************");
-    lcd.setCursor(0, 1);
-    lcd.print("* THRUST OVERLOAD  *");
-    lcd.setCursor(0, 2);
-    lcd.print("* PRESS OK BUTTON  *");
-    lcd.setCursor(0, 3);
-    lcd.print("********************");
+    screen.setCursor(0, 0);
+    screen.print(F("********************"));
+    screen.setCursor(0, 1);
+    screen.print(safetyFault() == FAULT_LOADCELL ? F("* LOAD CELL FAILED *") : F("* THRUST OVERLOAD  *"));
+    screen.setCursor(0, 2);
+    screen.print(F("* PRESS OK BUTTON  *"));
+    screen.setCursor(0, 3);
+    screen.print(F("********************"));
 }
 
 Settings readEepromSettings() {
-    if (EEPROM.read(0x00) == 0xFF) {
-        settings = { DEFAULT_SETTING_CURRENT, DEFAULT_SETTING_TRUST, DEFAULT_SETTING_TEST1, DEFAULT_SETTING_TEST2, DEFAULT_SETTING_WARMUP,0, 0, 0 };
-    }
-    else {
-        EEPROM.get(0x00, settings);
+    if (!storageLoadSettings(settings)) {
+        settings = { DEFAULT_SETTING_CURRENT, DEFAULT_SETTING_TRUST, DEFAULT_SETTING_TEST1, DEFAULT_SETTING_TEST2, DEFAULT_SETTING_WARMUP, { 0 } };
     }
     return settings;
 }
 
 void writeEepromSettings(Settings values) {
-        EEPROM.put(0x00, values);
+        storageSaveSettings(values);
         saveSettings = false;
 }
 
 bool settingsDiff(Settings values) {
-    bool retval = false;
-    Settings val2;
-    if (EEPROM.read(0x00) == 0xFF) {
-        retval = true;
-    }
-    else{
-        EEPROM.get(0x00, val2);
-    }
-    if (!retval)
-        retval = values.maxCurrent != val2.maxCurrent;
-    if (!retval)
-        retval = values.maxThrust != val2.maxThrust;
-    if (!retval)
-        retval = values.midTestDuration != val2.midTestDuration;
-    if (!retval)
-        retval = values.maxTestDuration != val2.maxTestDuration;
-    //if (!retval)
-    //    retval = values.testCycles != val2.testCycles;
-    if (!retval)
-        retval = values.warmUptime != val2.warmUptime;
-    if (!retval)
-        retval = values.currentOffset != val2.currentOffset;
-    if (!retval)
-        retval = values.voltageOffset != val2.voltageOffset;
-    if (!retval)
-        retval = values.thrustOffset != val2.thrustOffset;
-    return retval;
+    return storageSettingsChanged(values);
 }
 
+// Three pages per profile segment: average, maximum and spread
 void displayAutoTestResultMenu() {
+    char header[sizeof("SEG 255 MAX (V MIN)")];   // Longest header for any uint8_t segment
+    WattmeterValues values;
+    if (autoTestResultsPage < 1 || autoTestResultsPage > profile.count * AUTO_TEST_PAGES_PER_SEGMENT) {
+        return;
+    }
+    uint8_t segment = (autoTestResultsPage - 1) / AUTO_TEST_PAGES_PER_SEGMENT;
 
-    switch (autoTestResultsPage) {
-    case 1:
-        displayAverageValues("MID THROTTLE AVERAGE", midThrottleTest.averageValues);
-        break;
-    case 2:
-        displayValues("MID THROTTLE MAXIMUM", midThrottleTest.maximumValues);
+    const SegmentResult& result = segmentResults[segment];
+    switch ((autoTestResultsPage - 1) % AUTO_TEST_PAGES_PER_SEGMENT) {
+    case 0:
+        snprintf_P(header, sizeof(header), PSTR("SEG %02d AVERAGE"), segment + 1);
+        segmentResultMean(result, values);
         break;
-    case 3:
-        displayAverageValues(" FULL THROTTLE AVG ", maxThrottleTest.averageValues);
+    case 1:
+        snprintf_P(header, sizeof(header), PSTR("SEG %02d MAX (V MIN)"), segment + 1);
+        segmentResultMaximum(result, values);
         break;
-    case 4:
-        displayValues(" FULL THROTTLE MAX  ", maxThrottleTest.maximumValues);
+    default:
+        snprintf_P(header, sizeof(header), PSTR("SEG %02d STDDEV"), segment + 1);
+        segmentResultStdDev(result, values);
         break;
     }
+    displayValues(header, values);
 }
+
 void displayAutoTestStart() {
-    int seconds = (int)(autoTestTimer - millis()) / 1000;
+    char field[LCD_COLUMNS + 1];
+    int seconds = (autoTestRemaining(autoTest, millis()) + 999) / 1000;
+
+    screen.setCursor(0, 0);
+    screen.print(F("********************"));
+    screen.setCursor(0, 1);
+    screen.print(F("* Automatic test   *"));
+    screen.setCursor(0, 2);
+    screen.print(formatField(field, LCD_COLUMNS, F("* will start in "), seconds, F("s *")));
+    screen.setCursor(0, 3);
+    screen.print(F("********************"));
+}
 
-    lcd.setCursor(0, 0);
-    lcd.print("********************");
-    lcd.setCursor(0, 1);
-    lcd.print("* Automatic test   *");
-    lcd.setCursor(0, 2);
-    lcd.print("* will start in " + String(seconds) + "s *");
-    lcd.setCursor(0, 3);
-    lcd.print("********************");
+WattmeterValues freezeValues;
+unsigned long autoTestStart;
+// Advance the automatic test one step and run the entry actions of its states
+void autoTestTask() {
+    INSTRUMENT_SCOPE(STAGE_AUTO_TEST);
+    if (startAutoTest) {
+        startAutoTest = false;
+        if (!profileCustom) {
+            profileDefault(profile, settings.warmUptime, settings.midTestDuration, settings.maxTestDuration);
+        }
+        for (uint8_t i = 0; i < PROFILE_MAX_SEGMENTS; i++) {
+            segmentResultReset(segmentResults[i]);
+        }
+        curveReset(curve);
+        autoTestResultPages = profile.count * AUTO_TEST_PAGES_PER_SEGMENT;
+        autoTestResultsPage = 1;
+        isAborted = false;
+        autoTestBegin(autoTest, profile, millis());
+        autoTestStart = millis();
+    }
+    if (abortAutoTest || safetyFault() != FAULT_NONE) {
+        abortAutoTest = false;
+        if (autoTest.state != AUTO_IDLE && autoTest.state != AUTO_DONE) {
+            logRun(RUN_AUTOMATIC | RUN_ABORTED, millis() - autoTestStart);
+        }
+        autoTestAbort(autoTest);
+    }
 
-    if (seconds == 0) {
-        screenMode = ScreenMode::AUTO_TEST1;
-        enableThrottle = true;
-        averageValues = { 0,{0,0,0,0,0,0} };
-        maximumValues = { 0,0,0,0,0,0 };
+    AutoTestState state = autoTestStep(autoTest, millis());
+    autoTestThrottle = autoTest.throttle;
+    collectData = state == AUTO_RAMP || state == AUTO_HOLD;
+    if (!autoTestEntered(autoTest)) {
+        return;
+    }
+
+    switch (state) {
+    case AUTO_RAMP:
+    case AUTO_HOLD: // A new segment starts
+        if (screenMode != ScreenMode::AUTO_TEST) {
+            screenMode = ScreenMode::AUTO_TEST;
+            enableThrottle = true;
+            energyReset(energy);
+        }
+        segmentConsumption = energyMilliAmpHours(energy);
+        wattmeterStatsReset(runStats);
+        break;
+    case AUTO_NEXT_SEGMENT:
+        segmentResultMerge(segmentResults[autoTest.segment], runStats, energyMilliAmpHours(energy) - segmentConsumption);
+        break;
+    case AUTO_FREEZE:
+        freezeValues = runningValues;
+        enableThrottle = false;
+        break;
+    case AUTO_DONE:
+        logRun(RUN_AUTOMATIC, millis() - autoTestStart);
+        screenMode = ScreenMode::AUTO_END;
+        cursor = 1;
+        break;
+    default:
+        break;
     }
 }
 
-bool freeze = false;
-long autoTestFreezeTimer;
-bool warmup = true;
-WattmeterValues freezeValues;
-void displayAutoTestPage1() {
-    collectData = !warmup && !freeze;
-    if (warmup) {
-        runningValues.throttle = 0;
-        displayValues(" HALF THROTTLE TEST ", runningValues);
-        long warmupTime = millis();
-        int pwmThrottle;
-        while (millis() - warmupTime < settings.warmUptime * 1000) {
-            runningValues.throttle = map(millis(), warmupTime, warmupTime + (settings.warmUptime * 1000), 0, 50);
-            pwmThrottle = map(runningValues.throttle, 0, 100, PWM_MIN, PWM_MAX);
-            esc.writeMicroseconds(pwmThrottle);
-            lcd.setCursor(10, 3);
-            lcd.print(fixedLength("THR=" + String(runningValues.throttle) + "%", 10));
-            delayMicroseconds(10);
-        }
-        warmup = false;
-        autoTestTimer = ((settings.midTestDuration + 1) * 1000) + millis();
-    }
-    if (freeze) {
+// Running values of the current segment, the last values while the motor spins down
+void displayAutoTestSegment() {
+    char header[LCD_COLUMNS + 1];
+    seconds = (autoTestRemaining(autoTest, millis()) + 999) / 1000;
+    if (autoTest.state == AUTO_FREEZE) {
         freezeValues.throttle = -1;
-        displayValues(" HALF THROTTLE TEST ", freezeValues);
+        displayValues(F("   TEST FINISHED    "), freezeValues);
+        return;
+    }
+
+    const ProfileSegment& segment = profile.segments[autoTest.segment];
+    strcpy_P(header, reinterpret_cast<const char*>(profileSegmentName(segment.type)));
+    size_t name = strlen(header);
+    snprintf_P(header + name, sizeof(header) - name, PSTR(" %3d%% S%02d C%02d  "),
+        segment.type == SEGMENT_HOLD ? autoTest.throttle : segment.throttle, autoTest.segment + 1, autoTest.cycle + 1);
+    displayValues(header, runningValues);
+}
+
+// Appends a summary of the run that just ended to the EEPROM run log
+void logRun(uint8_t flags, unsigned long duration) {
+    RunSummary summary;
+    summary.flags = flags;
+    summary.duration = min(duration / 1000, 0xFFFFUL);
+    summary.consumption = energyMilliAmpHours(energy);
+    summary.energy = energyMilliWattHours(energy) / 100;
+    if (flags & RUN_AUTOMATIC) {    // The statistics only hold the last segment, use the segment results
+        summary.currentMax = 0;
+        summary.voltageMin = 0xFFFF;
+        summary.thrustMax = 0;
+        for (uint8_t i = 0; i < profile.count; i++) {
+            const SegmentResult& result = segmentResults[i];
+            if (result.cycles == 0) {
+                continue;
+            }
+            summary.currentMax = max(summary.currentMax, result.currentMax);
+            summary.voltageMin = min(summary.voltageMin, result.voltageMin);
+            summary.thrustMax = max(summary.thrustMax, result.thrustMax);
+        }
+        if (summary.voltageMin == 0xFFFF) {
+            summary.voltageMin = 0;
+        }
     }
     else {
-        runningValues.throttle = 50;
-        displayValues(" HALF THROTTLE TEST ", runningValues);
+        summary.currentMax = lround(runStats.current.maximum / 10);
+        summary.voltageMin = lround(runStats.voltage.minimum / 10);
+        summary.thrustMax = lround(runStats.thrust.maximum);
     }
+    runLogAppend(summary);
+}
 
-    seconds = (long)(autoTestTimer - millis()) / 1000;
-    if (seconds == 0) {
-        freeze = true;
-        autoTestFreezeTimer = millis() + 6000;
-        freezeValues = runningValues;
-        enableThrottle = false;
-    } else if(freeze){
-        seconds = (long)(autoTestFreezeTimer - millis())/1000;
-        if (seconds <= 0) {
-            screenMode = ScreenMode::AUTO_TEST2;
-            enableThrottle = true;
-            freeze = false;
-            warmup = true;
-            midThrottleTest.averageValues = averageValues;
-            midThrottleTest.maximumValues = maximumValues;
-            averageValues = { 0,{0,0,0,0,0,0} };
-            maximumValues = { 0,0,0,0,0,0 };
-        }
-    }
-}
-
-void displayAutoTestPage2() {
-    collectData = !warmup && !freeze;
-    if (warmup) {
-        runningValues.throttle = 0;
-        displayValues(" HALF THROTTLE TEST ", runningValues);
-        long warmupTime = millis();
-        int pwmThrottle;
-        while (millis() - warmupTime < settings.warmUptime * 1000) {
-            runningValues.throttle = map(millis(), warmupTime, warmupTime + (settings.warmUptime * 1000), 0, 100);
-            pwmThrottle = map(runningValues.throttle, 0, 100, PWM_MIN, PWM_MAX);
-            esc.writeMicroseconds(pwmThrottle);
-            lcd.setCursor(10, 3);
-            lcd.print(fixedLength("THR=" + String(runningValues.throttle) + "%", 10));
-            delayMicroseconds(10);
-        }
-        warmup = false;
-        autoTestTimer = ((settings.maxTestDuration + 1) * 1000) + millis();
-    }    if (freeze) {
-        freezeValues.throttle = -1;
-        displayValues(" FULL THROTTLE TEST ", freezeValues);
+void serialTask() {
+    INSTRUMENT_SCOPE(STAGE_SERIAL);
+    static const SerialCommand commands[] PROGMEM = {
+        { "THR", throttleCommand },
+        { "ARM", armCommand },
+        { "DISARM", disarmCommand },
+        { "TARE", tareCommand },
+        { "VALUES", valuesCommand },
+        { "STREAM", streamCommand },
+        { "GET", getCommand },
+        { "SET", setCommand },
+        { "PROFILE", profileCommand },
+        { "RESULTS", resultsCommand },
+        { "CURVE", curveCommand },
+        { "LOG", logCommand },
+        { "ADC", adcCommand },
+        { "FILTER", filterCommand },
+        { "CAL", calibrationCommand },
+#if INSTRUMENTATION
+        { "PERF", perfCommand },
+#endif
+    };
+    calibrationCaptureSave();   // A finished capture's EEPROM writes, kept out of the acquisition task
+    serialCommandPoll(Serial, commands, sizeof(commands) / sizeof(SerialCommand));
+}
+
+// Field f of a CSV line of numbers, for a serial reply; false past the last
+static bool printCsvField(Print& port, const long* fields, uint8_t count, uint8_t f) {
+    if (f >= count) {
+        return false;
+    }
+    if (f > 0) {
+        port.print(',');
+    }
+    port.print(fields[f]);
+    return true;
+}
+
+/*
+THR                 print the throttle, what sets it and whether it is enabled
+THR percent         set the manual test's throttle from the serial port, 0 to 100
+THR POT             hand the throttle back to the pot, not while it would jump
+*/
+bool throttleCommand(uint8_t argc, char** argv) {
+    if (argc == 1) {
+        Serial.print(F("throttle="));
+        Serial.print(throttlePercent);
+        Serial.print(F(" source="));
+        Serial.print(serialThrottle >= 0 ? F("SERIAL") : F("POT"));
+        Serial.print(F(" armed="));
+        Serial.println(enableThrottle ? F("YES") : F("NO"));
+        return true;
+    }
+    if (argc != 2) {
+        return false;
+    }
+    if (strcasecmp_P(argv[1], PSTR("POT")) == 0) {
+        if (enableThrottle && adcThrottleValue() > 0) {
+            return false;
+        }
+        serialThrottle = -1;
+        return true;
+    }
+    long percent;
+    if (!serialCommandParseLong(argv[1], percent) || percent < 0 || percent > 100) {
+        return false;
+    }
+    serialThrottle = percent;
+    return true;
+}
+
+// ARM enables the manual test's throttle like THROTTLE CUT, from zero, without a cutoff and on a values screen
+bool armCommand(uint8_t argc, char** argv) {
+    if (argc != 1 || testMode != TestMode::MANUAL || !onValuesScreen() || safetyFault() != FAULT_NONE || !throttleAtZero()) {
+        return false;
+    }
+    enableThrottle = true;
+    return true;
+}
+
+// DISARM cuts the throttle, aborts a running automatic test and acknowledges a cutoff like OK on its screen
+bool disarmCommand(uint8_t argc, char** argv) {
+    if (argc != 1) {
+        return false;
+    }
+    enableThrottle = false;
+    if (screenMode == ScreenMode::CURRENT_CUTOFF || screenMode == ScreenMode::THRUST_CUTOFF) {
+        safetyClearFault();
+        screenMode = testMode == TestMode::MANUAL ? ScreenMode::RUNNING_VALUES : ScreenMode::AUTO_END;
+        isAborted = true;
+    }
+    else if (testMode == TestMode::AUTOMATIC && (screenMode == ScreenMode::AUTO_START || screenMode == ScreenMode::AUTO_TEST)) {
+        abortAutomaticTest();
+    }
+    return true;
+}
+
+// TARE [THRUST|CURRENT] zeroes the scale like a long press of PREVIOUS, or the current sensor, with the throttle disabled
+bool tareCommand(uint8_t argc, char** argv) {
+    uint8_t channel = CHANNEL_THRUST;
+    if (argc > 2 || enableThrottle || (argc == 2 && !channelFromName(argv[1], channel))) {
+        return false;
+    }
+    switch (channel) {
+    case CHANNEL_THRUST:
+        tareRequested = true;
+        return true;
+    case CHANNEL_CURRENT:
+        autoZeroTare(currentZero, CURRENT_ZERO_SAMPLES);
+        return true;
+    default:
+        return false;
+    }
+}
+
+static WattmeterValues replyValues;     // Taken when VALUES runs, its reply prints them over several polls
+
+static bool valuesReply(Print& port, uint8_t line, uint8_t field) {
+    static const char names[][14] PROGMEM = { "throttle=", " voltage=", " current=", " power=", " consumption=", " thrust=" };
+    long fields[] = { replyValues.throttle, replyValues.voltage / 10, replyValues.current / 10, replyValues.power / 100,
+        replyValues.consumption, replyValues.thrust };
+    if (line > 0 || field >= sizeof(fields) / sizeof(long)) {
+        return false;
+    }
+    port.print(reinterpret_cast<const __FlashStringHelper*>(names[field]));
+    port.print(fields[field]);
+    return true;
+}
+
+// VALUES [RUNNING|AVERAGE|MAXIMUM] prints the values of a screen in the telemetry units, throttle -1 when disabled
+bool valuesCommand(uint8_t argc, char** argv) {
+    replyValues = runningValues;
+    if (argc == 2 && strcasecmp_P(argv[1], PSTR("AVERAGE")) == 0) {
+        wattmeterStatsMean(runStats, replyValues);
+    }
+    else if (argc == 2 && strcasecmp_P(argv[1], PSTR("MAXIMUM")) == 0) {
+        wattmeterStatsMaximum(runStats, replyValues);
+    }
+    else if (argc > 2 || (argc == 2 && strcasecmp_P(argv[1], PSTR("RUNNING")) != 0)) {
+        return false;
+    }
+    serialCommandReply(valuesReply);
+    return true;
+}
+
+/*
+STREAM              print the sample frame rate and the ADC block rate, which bounds it
+STREAM rate         send rate sample frames a second, 1 to 1000, with a status frame every second;
+                    at most one per ADC block (~290 a second with 16 pairs)
+STREAM ALL          send every ADC block
+STREAM OFF          stop the frames
+*/
+bool streamCommand(uint8_t argc, char** argv) {
+    if (argc == 1) {
+        Serial.print(F("rate="));
+        if (streamRate == STREAM_ALL) {
+            Serial.print(F("ALL"));
+        }
+        else {
+            Serial.print(streamRate);
+        }
+        Serial.print(F(" block_rate="));
+        Serial.print(adcBlockRate() / 10);
+        Serial.print('.');
+        Serial.println(adcBlockRate() % 10);
+        return true;
+    }
+    if (argc != 2) {
+        return false;
+    }
+    long rate;
+    if (strcasecmp_P(argv[1], PSTR("OFF")) == 0) {
+        rate = 0;
+    }
+    else if (strcasecmp_P(argv[1], PSTR("ALL")) == 0) {
+        rate = STREAM_ALL;
+    }
+    else if (!serialCommandParseLong(argv[1], rate) || rate < 1 || rate > (long)STREAM_RATE_MAX) {
+        return false;
+    }
+    streamRate = rate;
+    return true;
+}
+
+#define SETTING_NAME    12  // Longest setting name plus its terminator
+
+struct SettingField {
+    char name[SETTING_NAME];
+    int16_t* value;
+    int minimum;
+    int maximum;
+};
+
+// Settings by name for GET and SET, in the units of the settings screen
+static const SettingField settingFields[] PROGMEM = {
+    { "MAX_CURRENT", &settings.maxCurrent, SETTING_CURRENT_MIN, SETTING_CURRENT_MAX },
+    { "MAX_THRUST", &settings.maxThrust, SETTING_THRUST_MIN, SETTING_THRUST_MAX },
+    { "HALF_TEST", &settings.midTestDuration, SETTING_TEST_MIN, SETTING_TEST_MAX },
+    { "FULL_TEST", &settings.maxTestDuration, SETTING_TEST_MIN, SETTING_TEST_MAX },
+    { "WARMUP", &settings.warmUptime, SETTING_WARMUP_MIN, SETTING_WARMUP_MAX },
+};
+
+static bool settingFromName(const char* name, SettingField& field) {
+    for (uint8_t i = 0; i < sizeof(settingFields) / sizeof(SettingField); i++) {
+        if (strcasecmp_P(name, settingFields[i].name) == 0) {
+            memcpy_P(&field, &settingFields[i], sizeof(SettingField));
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool settingsReply(Print& port, uint8_t line, uint8_t field) {
+    if (line > 0 || field >= sizeof(settingFields) / sizeof(SettingField)) {
+        return false;
+    }
+    if (field > 0) {
+        port.print(' ');
+    }
+    port.print(reinterpret_cast<const __FlashStringHelper*>(settingFields[field].name));
+    port.print('=');
+    port.print(*(int16_t*)pgm_read_ptr(&settingFields[field].value));
+    return true;
+}
+
+// GET [name] prints one setting, or all of them as name=value
+bool getCommand(uint8_t argc, char** argv) {
+    if (argc == 2) {
+        SettingField field;
+        if (!settingFromName(argv[1], field)) {
+            return false;
+        }
+        Serial.println(*field.value);
+        return true;
+    }
+    if (argc != 1) {
+        return false;
+    }
+    serialCommandReply(settingsReply);
+    return true;
+}
+
+/*
+SET name value      change a setting and store it, MAX_CURRENT 10-120A, MAX_THRUST 500-10000g,
+                    HALF_TEST and FULL_TEST 1-60s, WARMUP 1-6s; not while it is edited on screen
+*/
+bool setCommand(uint8_t argc, char** argv) {
+    if (argc != 3 || (screenMode == ScreenMode::SETTINGS && settingEditMode)) {
+        return false;
+    }
+    SettingField field;
+    long value;
+    if (!settingFromName(argv[1], field) || !serialCommandParseLong(argv[2], value) || value < field.minimum || value > field.maximum) {
+        return false;
+    }
+    *field.value = value;
+    saveSettings = settingsDiff(settings);  // Written by the display task
+    return true;
+}
+
+static bool profileStatusReply(Print& port, uint8_t line, uint8_t field) {
+    static const char states[][13] PROGMEM = { "IDLE", "COUNTDOWN", "RAMP", "HOLD", "NEXT_SEGMENT", "FREEZE", "DONE" };
+    if (line > 0) {
+        return false;
+    }
+    switch (field) {
+    case 0:
+        port.print(F("state="));
+        port.print(reinterpret_cast<const __FlashStringHelper*>(states[autoTest.state]));
+        return true;
+    case 1:
+        port.print(F(" segment="));
+        port.print(autoTest.segment + 1);
+        return true;
+    case 2:
+        port.print(F(" cycle="));
+        port.print(autoTest.cycle + 1);
+        return true;
+    case 3:
+        port.print(F(" remaining_ms="));
+        port.print(autoTestRemaining(autoTest, millis()));
+        return true;
+    case 4:
+        port.print(F(" aborted="));
+        port.print(isAborted ? F("YES") : F("NO"));
+        return true;
+    default:
+        return false;
+    }
+}
+
+// REPEAT, then one line per segment
+static bool profileReply(Print& port, uint8_t line, uint8_t field) {
+    if (field > 0 || line > profile.count) {
+        return false;
+    }
+    if (line == 0) {
+        port.print(F("REPEAT "));
+        port.print((int)profile.repeat);
+        return true;
+    }
+    const ProfileSegment& segment = profile.segments[line - 1];
+    port.print(profileSegmentName(segment.type));
+    port.print(' ');
+    port.print((int)segment.throttle);
+    port.print(' ');
+    port.print((int)(segment.duration / 10));
+    port.print('.');
+    port.print((int)(segment.duration % 10));
+    return true;
+}
+
+/*
+PROFILE                         list the profile
+PROFILE CLEAR                   start a new profile
+PROFILE ADD STEP|RAMP|HOLD throttle seconds
+PROFILE REPEAT count
+PROFILE SAVE | LOAD | ERASE     store, reload or forget the profile in EEPROM
+PROFILE DEFAULT                 go back to the test given by the settings
+PROFILE START                   run the automatic test like TEST MODE, also again from its results
+PROFILE ABORT                   abort the running test, or leave its results for the manual test
+PROFILE STATUS                  print the sequencer state, segment, repeat and time left in it
+*/
+bool profileCommand(uint8_t argc, char** argv) {
+    if (argc == 2 && strcasecmp_P(argv[1], PSTR("START")) == 0) {
+        bool ready = (testMode == TestMode::MANUAL && onValuesScreen()) || screenMode == ScreenMode::AUTO_RESULTS;
+        if (!ready || enableThrottle || safetyFault() != FAULT_NONE) {
+            return false;
+        }
+        testMode = TestMode::AUTOMATIC;
+        screenMode = ScreenMode::AUTO_START;
+        startAutoTest = true;
+        return true;
+    }
+    if (argc == 2 && strcasecmp_P(argv[1], PSTR("ABORT")) == 0) {
+        if (testMode == TestMode::AUTOMATIC && (screenMode == ScreenMode::AUTO_START || screenMode == ScreenMode::AUTO_TEST)) {
+            abortAutomaticTest();
+            return true;
+        }
+        if (screenMode == ScreenMode::AUTO_RESULTS) {
+            testMode = TestMode::MANUAL;
+            screenMode = ScreenMode::RUNNING_VALUES;
+            return true;
+        }
+        return false;
+    }
+    if (argc == 2 && strcasecmp_P(argv[1], PSTR("STATUS")) == 0) {
+        serialCommandReply(profileStatusReply);
+        return true;
+    }
+    if (argc == 1) {
+        serialCommandReply(profileReply);
+        return true;
+    }
+    if (testMode == TestMode::AUTOMATIC) {  // The running test reads the profile
+        return false;
+    }
+
+    long throttle, duration;
+    if (argc == 2 && strcasecmp_P(argv[1], PSTR("CLEAR")) == 0) {
+        profileClear(profile);
+    }
+    else if (argc == 5 && strcasecmp_P(argv[1], PSTR("ADD")) == 0) {
+        uint8_t type;
+        for (type = SEGMENT_STEP; type <= SEGMENT_HOLD; type++) {
+            if (strcasecmp_P(argv[2], reinterpret_cast<const char*>(profileSegmentName(type))) == 0) {
+                break;
+            }
+        }
+        if (!serialCommandParseLong(argv[3], throttle) || throttle < 0 || throttle > 100
+            || !serialCommandParseFixed(argv[4], 1, duration) || duration < 0 || duration > 0xFFFF
+            || !profileAdd(profile, type, throttle, duration)) {
+            return false;
+        }
+    }
+    else if (argc == 3 && strcasecmp_P(argv[1], PSTR("REPEAT")) == 0) {
+        long repeat;
+        if (!serialCommandParseLong(argv[2], repeat) || repeat < 1 || repeat > PROFILE_MAX_REPEAT) {
+            return false;
+        }
+        profile.repeat = repeat;
+    }
+    else if (argc == 2 && strcasecmp_P(argv[1], PSTR("SAVE")) == 0) {
+        profileSave(profile);
+    }
+    else if (argc == 2 && strcasecmp_P(argv[1], PSTR("LOAD")) == 0) {
+        return profileCustom = profileLoad(profile);
+    }
+    else if (argc == 2 && strcasecmp_P(argv[1], PSTR("ERASE")) == 0) {
+        profileErase();
+        profileCustom = false;
+        return true;
+    }
+    else if (argc == 2 && strcasecmp_P(argv[1], PSTR("DEFAULT")) == 0) {
+        profileDefault(profile, settings.warmUptime, settings.midTestDuration, settings.maxTestDuration);
+        profileCustom = false;
+        return true;
     }
     else {
-        runningValues.throttle = 100;
-        displayValues(" FULL THROTTLE TEST ", runningValues);
+        return false;
     }
+    profileCustom = true;
+    return true;
+}
 
-    seconds = (long)(autoTestTimer - millis()) / 1000;
-    if (seconds == 0) {
-        freeze = true;
-        autoTestFreezeTimer = millis() + 6000;
-        freezeValues = runningValues;
-        enableThrottle = false;
+// The header, then one line per throttle bin with samples
+static bool curveReply(Print& port, uint8_t line, uint8_t field) {
+    if (line == 0) {
+        return serialCommandPrintPart(port, F("throttle,samples,voltage,current,power,thrust,grams_per_watt_x10"), field);
     }
-    else if (freeze) {
-        seconds = (long)(autoTestFreezeTimer - millis()) / 1000;
-            screenMode = ScreenMode::AUTO_END;
-            autoTestTimer = (settings.midTestDuration * 1000) + millis();
-            enableThrottle = false;
-            freeze = false;
-            warmup = true;
-            cursor = 1;
-            maxThrottleTest.averageValues = averageValues;
-            maxThrottleTest.maximumValues = maximumValues;
-            averageValues = { 0,{0,0,0,0,0,0} };
-            maximumValues = { 0,0,0,0,0,0 };
-        //}
+    WattmeterValues values;
+    uint8_t bin;
+    uint8_t row = 0;
+    for (bin = 0; bin < THROTTLE_BINS; bin++) {
+        if (curveMean(curve, bin, values) && ++row == line) {
+            break;
+        }
+    }
+    if (bin == THROTTLE_BINS) {
+        return false;
     }
+    long fields[] = { values.throttle, curve.bins[bin].count, values.voltage / 10, values.current / 10,
+        values.power / 100, values.thrust, curveGramsPerWatt(values) };
+    return printCsvField(port, fields, sizeof(fields) / sizeof(long), field);
 }
 
+// CURVE prints one CSV line per throttle bin with samples, in the telemetry units; CURVE RESET clears it
+bool curveCommand(uint8_t argc, char** argv) {
+    if (argc == 2 && strcasecmp_P(argv[1], PSTR("RESET")) == 0) {
+        resetMeasurements = true;
+        return true;
+    }
+    if (argc != 1) {
+        return false;
+    }
+    serialCommandReply(curveReply);
+    return true;
+}
+
+static uint8_t logSkipped;     // Entries the LOG reply passed over because they no longer read back
+
+static bool logReply(Print& port, uint8_t line, uint8_t field) {
+    if (line == 0) {
+        return serialCommandPrintPart(port, F("run,automatic,aborted,duration,consumption,energy,current_max,voltage_min,thrust_max"), field);
+    }
+    RunSummary summary;
+    for (;;) {
+        uint8_t index = line - 1 + logSkipped;
+        if (index >= runLogCount()) {
+            return false;
+        }
+        if (runLogRead(index, summary)) {
+            break;
+        }
+        logSkipped++;
+    }
+    long fields[] = { summary.sequence, (summary.flags & RUN_AUTOMATIC) != 0, (summary.flags & RUN_ABORTED) != 0,
+        summary.duration, summary.consumption, summary.energy, summary.currentMax, summary.voltageMin, summary.thrustMax };
+    return printCsvField(port, fields, sizeof(fields) / sizeof(long), field);
+}
 
+// One CSV line per logged run, oldest first
+bool logCommand(uint8_t argc, char** argv) {
+    logSkipped = 0;
+    serialCommandReply(logReply);
+    return true;
+}
+
+static bool resultsReply(Print& port, uint8_t line, uint8_t field) {
+    if (line == 0) {
+        return serialCommandPrintPart(port, F("segment,cycles,throttle,voltage,voltage_min,current,current_max,current_sd,power,power_max,thrust,thrust_max,thrust_sd,consumption"), field);
+    }
+    if (line > profile.count) {
+        return false;
+    }
+    const SegmentResult& result = segmentResults[line - 1];
+    long fields[] = { line, result.cycles, result.throttle, result.voltage, result.voltageMin, result.current,
+        result.currentMax, result.currentSpread, result.power, result.powerMax, result.thrust,
+        result.thrustMax, result.thrustSpread, result.consumption };
+    return printCsvField(port, fields, sizeof(fields) / sizeof(long), field);
+}
+
+// One CSV line per segment of the last automatic test, in the telemetry units
+bool resultsCommand(uint8_t argc, char** argv) {
+    serialCommandReply(resultsReply);
+    return true;
+}
+
+// CURRENT, VOLTAGE or THRUST, numbered the same for the filters and the calibration
+bool channelFromName(const char* name, uint8_t& channel) {
+    static const char channels[][8] PROGMEM = { "CURRENT", "VOLTAGE", "THRUST" };
+    for (uint8_t i = 0; i < sizeof(channels) / sizeof(channels[0]); i++) {
+        if (strcasecmp_P(name, channels[i]) == 0) {
+            channel = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Current configures both the running value filter and the cutoff's filter
+bool setFilter(uint8_t channel, uint8_t type, uint8_t length) {
+    switch (channel) {
+    case CHANNEL_CURRENT:
+        return filterConfigure(currentFilter, type, length) && adcSetCurrentFilter(type, length);
+    case CHANNEL_VOLTAGE:
+        return filterConfigure(voltageFilter, type, length);
+    case CHANNEL_THRUST:
+        return loadCellSetFilter(type, length);
+    default:
+        return false;
+    }
+}
+
+// The header, then the current, cutoff current, voltage and thrust filters
+static bool filterReply(Print& port, uint8_t line, uint8_t field) {
+    if (line == 0) {
+        return serialCommandPrintPart(port, F("channel,type,length,delay_samples,delay_us"), field);
+    }
+
+    // Sample periods: the current blocks, the cutoff's current sums and the HX711 conversions
+    unsigned long blockUs = 10000000UL / adcBlockRate();
+    unsigned long cutoffUs = (2 * ADC_SAFETY_SAMPLES + 1) * ADC_CONVERSION_US;
+    static const char names[][15] PROGMEM = { "current", "current_cutoff", "voltage", "thrust" };
+    const Filter* const filters[] = { &currentFilter, &adcCurrentFilter(), &voltageFilter, &loadCellFilter() };
+    const unsigned long periods[] = { blockUs, cutoffUs, blockUs, loadCellPeriod() };
+
+    uint8_t i = line - 1;
+    if (i >= sizeof(filters) / sizeof(filters[0])) {
+        return false;
+    }
+    switch (field) {
+    case 0:
+        port.print(reinterpret_cast<const __FlashStringHelper*>(names[i]));
+        return true;
+    case 1:
+        port.print(',');
+        port.print(filterTypeName(filters[i]->type));
+        return true;
+    case 2:
+        port.print(',');
+        port.print((int)filters[i]->length);
+        return true;
+    case 3:
+        port.print(',');
+        port.print(filterDelay(*filters[i]));
+        return true;
+    case 4:
+        port.print(',');
+        port.print(filterDelay(*filters[i]) * periods[i]);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+FILTER                              one CSV line per filter with its group delay
+FILTER CURRENT|VOLTAGE|THRUST type [length]
+                                    NONE, MEDIAN or FIR with an odd length of 3 or 5,
+                                    or IIR with a shift of 1 to 6
+*/
+bool filterCommand(uint8_t argc, char** argv) {
+    if (argc == 3 || argc == 4) {
+        uint8_t channel;
+        uint8_t type;
+        long length = 1;
+        if (!channelFromName(argv[1], channel) || !filterTypeFromName(argv[2], type) || (argc == 4 && (!serialCommandParseLong(argv[3], length) || length < 0 || length > 0xFF))) {
+            return false;
+        }
+        return setFilter(channel, type, length);
+    }
+    if (argc != 1) {
+        return false;
+    }
+    serialCommandReply(filterReply);
+    return true;
+}
+
+// Starts averaging a point at a reference in mA, mV or g
+void captureCalibration(uint8_t channel, long reference) {
+    switch (channel) {
+    case CALIBRATION_CURRENT:
+        reference = CurrentChannel::adcQFrom(reference);
+        break;
+    case CALIBRATION_VOLTAGE:
+        reference = VoltageChannel::adcQFrom(reference);
+        break;
+    }
+    calibrationCaptureStart(channel, reference);
+}
+
+// A calibration input, Q4 counts for current and voltage, in mA, mV or g
+long calibrationUnits(uint8_t channel, long input) {
+    switch (channel) {
+    case CALIBRATION_CURRENT:
+        return CurrentChannel::fromAdcQ(input);
+    case CALIBRATION_VOLTAGE:
+        return VoltageChannel::fromAdcQ(input);
+    default:
+        return input;
+    }
+}
+
+// The header, a line per stored point of each channel, then the state of the last capture
+static bool calibrationReply(Print& port, uint8_t line, uint8_t field) {
+    static const char names[][8] PROGMEM = { "current", "voltage", "thrust" };
+    static const char captures[][8] PROGMEM = { "IDLE", "RUNNING", "DONE", "FAILED" };
+    if (line == 0) {
+        return serialCommandPrintPart(port, F("channel,mode,point,reading,reference"), field);
+    }
+    CalibrationTable table;
+    uint8_t point = line - 1;
+    uint8_t channel;
+    for (channel = 0; channel < CALIBRATION_CHANNELS; channel++) {
+        calibrationLoad(channel, table);
+        if (point < table.count) {
+            break;
+        }
+        point -= table.count;
+    }
+    if (channel == CALIBRATION_CHANNELS) {
+        if (point > 0 || field > 0) {
+            return false;
+        }
+        port.print(F("capture="));
+        port.print(reinterpret_cast<const __FlashStringHelper*>(captures[calibrationCaptureState()]));
+        return true;
+    }
+    switch (field) {
+    case 0:
+        port.print(reinterpret_cast<const __FlashStringHelper*>(names[channel]));
+        return true;
+    case 1:
+        port.print(',');
+        port.print(calibrationModeName(table.mode));
+        return true;
+    case 2:
+        port.print(',');
+        port.print((int)point);
+        return true;
+    case 3:
+        port.print(',');
+        port.print(calibrationUnits(channel, table.points[point].input));
+        return true;
+    case 4:
+        port.print(',');
+        port.print(calibrationUnits(channel, table.points[point].reference));
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+CAL                                 one CSV line per stored point, reading and reference in mA, mV
+                                    or g, then the state of the last capture
+CAL CURRENT|VOLTAGE|THRUST value    capture a point at the reference in A or V (up to 3 decimals)
+                                    or g, the average of the next 64 readings; check with CAL
+CAL channel LINEAR|TABLE|OFF        least squares gain and offset, piecewise linear, or no correction
+CAL channel CLEAR                   erase the channel's points
+*/
+bool calibrationCommand(uint8_t argc, char** argv) {
+    if (argc == 3) {
+        uint8_t channel;
+        uint8_t mode;
+        long reference;
+        if (!channelFromName(argv[1], channel)) {
+            return false;
+        }
+        if (strcasecmp_P(argv[2], PSTR("CLEAR")) == 0) {
+            calibrationClear(channel);
+            return true;
+        }
+        if (calibrationModeFromName(argv[2], mode)) {
+            return calibrationSetMode(channel, mode);
+        }
+        if (calibrationCaptureState() == CAPTURE_RUNNING
+            || !serialCommandParseFixed(argv[2], channel == CALIBRATION_THRUST ? 0 : 3, reference)) {
+            return false;
+        }
+        captureCalibration(channel, reference);
+        return true;
+    }
+    if (argc != 1) {
+        return false;
+    }
+    serialCommandReply(calibrationReply);
+    return true;
+}
+
+static bool adcReply(Print& port, uint8_t line, uint8_t field) {
+    uint8_t bits = adcOversampling();
+    if (line > 0) {
+        return false;
+    }
+    switch (field) {
+    case 0:
+        port.print(F("bits="));
+        port.print(10 + bits);
+        return true;
+    case 1:
+        port.print(F(" samples="));
+        port.print(adcBlockSamples());
+        return true;
+    case 2:
+        port.print(F(" rate="));
+        port.print(adcBlockRate() / 10);
+        port.print('.');
+        port.print(adcBlockRate() % 10);
+        port.print(F("Hz"));
+        return true;
+    case 3:
+        port.print(F(" current_step="));
+        port.print(CurrentChannel::microPerCount >> bits);
+        port.print(F("uA"));
+        return true;
+    case 4:
+        port.print(F(" voltage_step="));
+        port.print(VoltageChannel::microPerCount >> bits);
+        port.print(F("uV"));
+        return true;
+    case 5:
+        port.print(F(" sleep="));
+        port.print(adcSleep() ? F("ON") : F("OFF"));
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ADC                 print the oversampling, resolution and block rate
+ADC BITS n          average 4^n current/voltage pairs per block for n extra bits, 1 to 4
+ADC SLEEP ON|OFF    idle the CPU between tasks while the ADC converts
+*/
+bool adcCommand(uint8_t argc, char** argv) {
+    if (argc == 3 && strcasecmp_P(argv[1], PSTR("BITS")) == 0) {
+        long bits;
+        return serialCommandParseLong(argv[2], bits) && bits >= 0 && bits <= 0xFF && adcSetOversampling(bits);
+    }
+    if (argc == 3 && strcasecmp_P(argv[1], PSTR("SLEEP")) == 0) {
+        if (strcasecmp_P(argv[2], PSTR("ON")) == 0 || strcasecmp_P(argv[2], PSTR("OFF")) == 0) {
+            adcSetSleep(strcasecmp_P(argv[2], PSTR("ON")) == 0);
+            return true;
+        }
+        return false;
+    }
+    if (argc != 1) {
+        return false;
+    }
+    serialCommandReply(adcReply);
+    return true;
+}
+
+#if INSTRUMENTATION
+// Field of a stage's CSV line: name, count, min, avg and max, then the histogram
+static bool perfStageField(Print& port, uint8_t stage, const StageStats& stats, uint8_t field) {
+    long fields[] = { (long)stats.count, stats.minimum, (long)(stats.total / stats.count), stats.maximum };
+    if (field == 0) {
+        port.print(instrumentStageName(stage));
+        return true;
+    }
+    field--;
+    if (field < sizeof(fields) / sizeof(long)) {
+        port.print(',');
+        port.print(fields[field]);
+        return true;
+    }
+    field -= sizeof(fields) / sizeof(long);
+    if (field < INSTRUMENT_BINS) {
+        port.print(',');
+        port.print(stats.bins[field]);
+        return true;
+    }
+    return false;
+}
+
+// The header, a line per stage that ran, the loop, a line per task, then the counters and memory
+static bool perfReply(Print& port, uint8_t line, uint8_t field) {
+    if (line == 0) {
+        return serialCommandPrintPart(port, F("stage,count,min_us,avg_us,max_us,lt16,lt64,lt256,lt1024,lt4096,longer"), field);
+    }
+    line--;
+    StageStats stats;
+    for (uint8_t stage = 0; stage < STAGE_COUNT; stage++) {
+        instrumentRead(stage, stats);
+        if (stats.count == 0) {
+            continue;
+        }
+        if (line == 0) {
+            return perfStageField(port, stage, stats, field);
+        }
+        line--;
+    }
+
+    const uint8_t taskCount = TASK_COUNT;
+    if (line == 0) {
+        unsigned long elapsed = instrumentElapsed();    // Wraps after ~71 minutes, PERF RESET before a measurement
+        switch (field) {
+        case 0:
+            port.print(F("loops_per_s="));
+            port.print(elapsed > 0 ? (unsigned long)(instrumentLoops() * 1e6 / elapsed) : 0UL);
+            return true;
+        case 1:
+            port.print(F(" loop_gap_max_us="));
+            port.print(instrumentLoopGap());
+            return true;
+        default:
+            return false;
+        }
+    }
+    if (line <= taskCount) {
+        return schedulerReportField(port, tasks[line - 1], taskStates[line - 1], field);
+    }
+    if (line == taskCount + 1) {
+        switch (field) {
+        case 0:
+            port.print(F("adc_overruns="));
+            port.print(adcOverruns());
+            return true;
+        case 1:
+            port.print(F(" telemetry_dropped="));
+            port.print(telemetryDropped());
+            return true;
+        default:
+            return false;
+        }
+    }
+    if (line == taskCount + 2) {
+        switch (field) {
+        case 0:
+            port.print(F("sram_free="));
+            port.print(halFreeMemory());
+            return true;
+        case 1:
+            port.print(F(" stack_unused="));
+            port.print(halStackUnused());
+            return true;
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+/*
+PERF        one CSV line per stage, then loop, scheduler, queue and memory counters
+PERF RESET  clear the stage and loop counters
+*/
+bool perfCommand(uint8_t argc, char** argv) {
+    if (argc == 2 && strcasecmp_P(argv[1], PSTR("RESET")) == 0) {
+        instrumentReset();
+        return true;
+    }
+    if (argc != 1) {
+        return false;
+    }
+    serialCommandReply(perfReply);
+    return true;
+}
+#endif
+
+bool autoTestEnding = false;
+unsigned long autoTestEndTimer;
 void displayAutoTestEnd() {
-    lcd.setCursor(0, 0);
-    lcd.print("********************");
-    lcd.setCursor(0, 1);
-    lcd.print("*  Automatic test  *");
-    lcd.setCursor(0, 2);
+    screen.setCursor(0, 0);
+    screen.print(F("********************"));
+    screen.setCursor(0, 1);
+    screen.print(F("*  Automatic test  *"));
+    screen.setCursor(0, 2);
     if (isAborted) {
-        lcd.print("*     aborted      *");
+        screen.print(F("*     aborted      *"));
     }
     else {
-        lcd.print("*    successful    *");
+        screen.print(F("*    successful    *"));
     }
-    lcd.setCursor(0, 3);
-    lcd.print("********************");
-    freeze = false;
-    warmup = true;
+    screen.setCursor(0, 3);
+    screen.print(F("********************"));
     enableThrottle = false;
-    delay(1500);
+    if (!autoTestEnding) {  // Keep the result on screen for a while before moving on
+        autoTestEnding = true;
+        autoTestEndTimer = millis();
+        return;
+    }
+    if (millis() - autoTestEndTimer < MESSAGE_DURATION_MS) {
+        return;
+    }
+    autoTestEnding = false;
     if (!isAborted) {
         screenMode = ScreenMode::AUTO_RESULTS;
-        lcd.clear();
+        screen.clear();
     }
     else {
         testMode = TestMode::MANUAL;
@@ -1151,17 +2336,18 @@ void displayAutoTestEnd() {
 }
 
 bool newLine = false;
-void printDebug(String string) {
+void printDebug(const __FlashStringHelper* label, long value) {
 #ifdef _DEBUG_
     if (!newLine)
-        Serial.print(",");
-    Serial.print(string);
+        Serial.print(',');
+    Serial.print(label);
+    Serial.print(value);
     newLine = false;
 #endif
 }
 void printDebugNewLine() {
 #ifdef _DEBUG_
-    Serial.println("");
+    Serial.println();
     newLine = true;
 #endif
 }
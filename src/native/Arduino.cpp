@@ -0,0 +1,82 @@
+#include <Arduino.h>
+#include "Sim.h"
+
+uint8_t SREG;
+HardwareSerial Serial;
+
+unsigned long millis() {
+    return simTime() / 1000;
+}
+
+unsigned long micros() {
+    return simTime();
+}
+
+void delay(unsigned long ms) {
+    simAdvance(ms * 1000UL);
+}
+
+void delayMicroseconds(unsigned int us) {
+    simAdvance(us);
+}
+
+long map(long x, long inMin, long inMax, long outMin, long outMax) {
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t written = 0;
+    while (size--) {
+        written += write(*buffer++);
+    }
+    return written;
+}
+
+size_t Print::print(long value, int base) {
+    if (value < 0 && base == 10) {
+        return print('-') + print((unsigned long)-value, base);
+    }
+    return print((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+    char text[8 * sizeof(long) + 1];
+    char* p = text + sizeof(text) - 1;
+    *p = '\0';
+    do {
+        unsigned long digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        value /= base;
+    } while (value > 0);
+    return write(p);
+}
+
+size_t Print::print(double value, int digits) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.*f", digits, value);
+    return write(text);
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+}
+
+int HardwareSerial::available() {
+    return simSerialAvailable();
+}
+
+int HardwareSerial::read() {
+    return simSerialRead();
+}
+
+int HardwareSerial::peek() {
+    return simSerialPeek();
+}
+
+int HardwareSerial::availableForWrite() {
+    return simSerialAvailableForWrite();
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    simSerialWrite(c);
+    return 1;
+}
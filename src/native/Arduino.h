@@ -0,0 +1,118 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+/*
+The part of the Arduino API the firmware uses, for the native simulation
+build. Time is the simulator's virtual clock and Serial is backed by files,
+see Sim.h.
+
+The simulator runs its "interrupts" between two passes of loop() or inside
+delay(), never in the middle of a statement, so masking interrupts with
+cli() and SREG is a no-op here.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#define HIGH            1
+#define LOW             0
+#define INPUT           0
+#define OUTPUT          1
+#define INPUT_PULLUP    2
+
+#define A0              14
+#define A1              15
+#define A2              16
+#define A3              17
+#define A4              18
+#define A5              19
+#define A6              20
+#define A7              21
+
+#define E2END           0x3FF
+
+#define _BV(bit)        (1 << (bit))
+#define min(a, b)       ((a) < (b) ? (a) : (b))
+#define max(a, b)       ((a) > (b) ? (a) : (b))
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// The host has a single address space, so flash strings and tables are plain ones
+class __FlashStringHelper;
+#define PROGMEM
+#define PSTR(s)             (s)
+#define F(s)                (reinterpret_cast<const __FlashStringHelper*>(PSTR(s)))
+#define pgm_read_byte(p)    (*(const uint8_t*)(p))
+#define pgm_read_word(p)    (*(const uint16_t*)(p))
+#define pgm_read_ptr(p)     (*(void* const*)(p))
+#define memcpy_P            memcpy
+#define strcasecmp_P        strcasecmp
+#define strcpy_P            strcpy
+#define strncpy_P           strncpy
+#define strlen_P            strlen
+#define snprintf_P          snprintf
+
+extern uint8_t SREG;
+inline void cli() {}
+inline void sei() {}
+
+// micros() never wraps in the simulator, a run would have to last 2^64us
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+long map(long x, long inMin, long inMax, long outMin, long outMax);
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    virtual int availableForWrite() { return 0; }
+    size_t write(const char* text) { return write((const uint8_t*)text, strlen(text)); }
+
+    size_t print(const char* text) { return write(text); }
+    size_t print(const __FlashStringHelper* text) { return write(reinterpret_cast<const char*>(text)); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value, int base = 10) { return print((long)value, base); }
+    size_t print(unsigned int value, int base = 10) { return print((unsigned long)value, base); }
+    size_t print(long value, int base = 10);
+    size_t print(unsigned long value, int base = 10);
+    size_t print(double value, int digits = 2);
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long baud);
+    int available() override;
+    int read() override;
+    int peek() override;
+    int availableForWrite() override;
+    size_t write(uint8_t c) override;
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+void setup();
+void loop();
+
+#endif
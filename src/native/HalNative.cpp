@@ -0,0 +1,300 @@
+#include <Arduino.h>
+#include "Hal.h"
+#include "AdcSampler.h"
+#include "LoadCell.h"
+#include "SafetyMonitor.h"
+#include "Buttons.h"
+#include "LcdFrameBuffer.h"
+#include "Conversion.h"
+#include "WatmeterTestBench.h"
+#include "Sim.h"
+
+/*
+Bench simulator implementation of the HAL. The peripherals are driven by
+halNativeRun(), which the simulator calls at the times halNativeNextEvent()
+asks for: a started ADC conversion completes SIM_ADC_CONVERSION_US later,
+the HX711 converts every SIM_LOADCELL_PERIOD_US, the tick runs at 1kHz and
+the bench model steps every SIM_PHYSICS_US.
+
+Sensor readings are generated from the bench model through the inverse of
+the firmware's own conversions (Conversion.h), plus one count of noise.
+*/
+
+static uint8_t adcPin;
+static unsigned long adcDue = SIM_NEVER;
+
+static bool loadCellStarted;
+static unsigned long loadCellDue = SIM_NEVER;
+
+static bool replaying;
+
+static unsigned long tickDue = SIM_NEVER;
+static unsigned long physicsDue = 0;
+
+static int escPulse;
+static int throttlePot;
+static uint8_t buttonMask;
+static unsigned long buttonReleaseDue = SIM_NEVER;
+
+static char lcdText[LCD_ROWS][LCD_COLUMNS];
+static uint8_t lcdCol;
+static uint8_t lcdRow;
+static bool lcdDirty;
+
+static uint8_t eeprom[E2END + 1];
+static bool eepromReady;
+static unsigned long eepromDone;        // Time the last byte write completes
+static unsigned long eepromBlocked;     // us writes waited for the previous one
+
+static unsigned long noiseState = 1;
+
+// Small LCG, -1, 0 or +1
+static int noise() {
+    noiseState = noiseState * 1103515245UL + 12345UL;
+    return (int)((noiseState >> 16) % 3) - 1;
+}
+
+static uint16_t adcCounts(float counts) {
+    long value = (long)(counts + 0.5F) + noise();
+    return (uint16_t)constrain(value, 0L, 1023L);
+}
+
+static uint16_t adcSample(uint8_t pin) {
+    switch (pin) {
+    case CurrentChannel::pin:
+        return adcCounts(benchCurrent() * 1000.0F / CurrentChannel::scale - CurrentChannel::offset);
+    case VoltageChannel::pin:
+        return adcCounts(benchVoltage() * 1000.0F / VoltageChannel::scale - VoltageChannel::offset);
+    case SIM_PIN_THROTTLE:
+        return adcCounts(throttlePot);
+    default:
+        return 0;
+    }
+}
+
+unsigned long halNativeNextEvent() {
+    unsigned long next = physicsDue;
+    next = min(next, adcDue);
+    next = min(next, loadCellDue);
+    next = min(next, tickDue);
+    next = min(next, buttonReleaseDue);
+    return next;
+}
+
+void halNativeRun(unsigned long now) {
+    if (now >= physicsDue) {
+        benchStep(escPulse, SIM_PHYSICS_US / 1000000.0F);
+        physicsDue += SIM_PHYSICS_US;
+    }
+    if (now >= adcDue) {
+        adcDue = SIM_NEVER;
+        adcConversionComplete(adcSample(adcPin));   // Usually starts the next conversion
+    }
+    if (now >= loadCellDue) {
+        loadCellDue += SIM_LOADCELL_PERIOD_US;
+        long raw = SIM_LOADCELL_ZERO + (long)(benchThrust() * SIM_LOADCELL_SCALE) + noise() * 20;
+        loadCellConversionComplete(raw);
+    }
+    if (now >= tickDue) {
+        tickDue += SIM_TICK_US;
+        safetyTick();
+        buttonsTick();
+    }
+    if (now >= buttonReleaseDue) {
+        buttonReleaseDue = SIM_NEVER;
+        buttonMask = 0;
+    }
+}
+
+void halAdcBegin(const uint8_t* pins, uint8_t count) {
+    adcDue = SIM_NEVER;
+}
+
+void halAdcStart(uint8_t pin) {
+    adcPin = pin;
+    if (!replaying) {
+        adcDue = simTime() + SIM_ADC_CONVERSION_US;
+    }
+}
+
+void halLoadCellBegin(uint8_t doutPin, uint8_t sckPin) {
+    if (!loadCellStarted && !replaying) {
+        loadCellStarted = true;
+        loadCellDue = simTime() + SIM_LOADCELL_PERIOD_US;
+    }
+}
+
+void halTickBegin() {
+    tickDue = simTime() + SIM_TICK_US;
+}
+
+void halEscBegin(uint8_t pin, int minPulse, int maxPulse) {
+    escPulse = minPulse;
+}
+
+void halEscWrite(int pulse) {
+    escPulse = pulse;
+}
+
+int halEscRead() {
+    return escPulse;
+}
+
+void halButtonsBegin(uint8_t commonPin, const int* pins, uint8_t count) {
+}
+
+uint8_t halButtonsScan() {
+    return buttonMask;
+}
+
+// The buttons read as held down for holdUs, the tick's debouncer picks them up
+void simPressButtons(uint8_t mask, unsigned long holdUs) {
+    buttonMask = mask;
+    buttonReleaseDue = simTime() + holdUs;
+}
+
+// Sensor inputs come from a recording instead of the bench model
+void halNativeReplay() {
+    replaying = true;
+    adcDue = SIM_NEVER;
+    loadCellDue = SIM_NEVER;
+}
+
+/*
+Replays one recorded AdcBlock through the sampler's interrupt handler. The
+sums are spread over the conversions so the block sums come out exactly;
+every conversion runs at the current time, so the block gets the recorded
+time stamp. The throttle pot gets the recorded reading whenever the sampler
+asks for it, after adcBegin() and every ADC_SAFETY_SAMPLES pairs.
+*/
+void halNativeAdcBlock(unsigned long currentSum, unsigned long voltageSum, uint16_t samples, uint16_t throttle) {
+    uint16_t i = 0;
+    while (i < samples) {
+        if (adcPin == SIM_PIN_THROTTLE) {
+            adcConversionComplete(throttle);
+            continue;
+        }
+        adcConversionComplete(currentSum / samples + (i < currentSum % samples ? 1 : 0));
+        adcConversionComplete(voltageSum / samples + (i < voltageSum % samples ? 1 : 0));
+        i++;
+    }
+    if (adcPin == SIM_PIN_THROTTLE) {
+        adcConversionComplete(throttle);
+    }
+}
+
+void simSetThrottlePot(int value) {
+    throttlePot = constrain(value, 0, 1023);
+}
+
+void halLcdBegin() {
+    halLcdClear();
+}
+
+// Every command and character is sent over I2C and polled, as on the AVR
+void halLcdClear() {
+    simAdvance(SIM_LCD_BYTE_US + SIM_LCD_CLEAR_US);
+    memset(lcdText, ' ', sizeof(lcdText));
+    lcdCol = 0;
+    lcdRow = 0;
+    lcdDirty = true;
+}
+
+void halLcdSetCursor(uint8_t col, uint8_t row) {
+    simAdvance(SIM_LCD_BYTE_US);
+    lcdCol = col;
+    lcdRow = row;
+}
+
+void halLcdWrite(uint8_t c) {
+    simAdvance(SIM_LCD_BYTE_US);
+    if (lcdRow < LCD_ROWS && lcdCol < LCD_COLUMNS) {
+        lcdText[lcdRow][lcdCol] = c >= ' ' && c < 0x7F ? c : '?';
+        lcdDirty = true;
+    }
+    lcdCol++;
+}
+
+bool simLcdChanged() {
+    bool changed = lcdDirty;
+    lcdDirty = false;
+    return changed;
+}
+
+void simLcdPrint(FILE* out) {
+    fprintf(out, "+--------------------+ %lu.%03lus\n", simTime() / 1000000UL, simTime() / 1000UL % 1000UL);
+    for (uint8_t row = 0; row < LCD_ROWS; row++) {
+        fprintf(out, "|%.*s|\n", LCD_COLUMNS, lcdText[row]);
+    }
+    fprintf(out, "+--------------------+\n");
+}
+
+static void eepromBegin() {
+    if (!eepromReady) {
+        memset(eeprom, 0xFF, sizeof(eeprom));   // Erased cells
+        eepromReady = true;
+    }
+}
+
+uint8_t halEepromRead(int address) {
+    eepromBegin();
+    return address >= 0 && address <= E2END ? eeprom[address] : 0xFF;
+}
+
+// Like eeprom_write_byte() on the AVR, waits for the previous write, then returns while this one runs
+void halEepromWrite(int address, uint8_t value) {
+    eepromBegin();
+    long wait = (long)(eepromDone - simTime());
+    if (wait > 0) {
+        eepromBlocked += wait;
+        simAdvance(wait);
+    }
+    eepromDone = simTime() + SIM_EEPROM_WRITE_US;
+    if (address >= 0 && address <= E2END) {
+        eeprom[address] = value;
+    }
+}
+
+bool halEepromReady() {
+    return (long)(eepromDone - simTime()) <= 0;
+}
+
+unsigned long simEepromBlocked() {
+    return eepromBlocked;
+}
+
+bool simEepromLoad(const char* path) {
+    eepromBegin();
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;   // First run, starts erased
+    }
+    fread(eeprom, 1, sizeof(eeprom), file);
+    fclose(file);
+    return true;
+}
+
+bool simEepromSave(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    bool written = fwrite(eeprom, 1, sizeof(eeprom), file) == sizeof(eeprom);
+    fclose(file);
+    return written;
+}
+
+// Every pass of loop() already moves the clock to the next event soon enough
+void halSleep() {
+}
+
+#if INSTRUMENTATION
+// The host has no fixed SRAM, both read as 0
+unsigned int halFreeMemory() {
+    return 0;
+}
+
+unsigned int halStackUnused() {
+    return 0;
+}
+#endif
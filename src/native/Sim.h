@@ -0,0 +1,83 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <Arduino.h>
+
+/*
+Bench simulator for the native build.
+
+The firmware runs unchanged on top of a virtual clock. Each pass of loop()
+costs SIM_LOOP_US of virtual time; the HAL "interrupts" (ADC conversions,
+HX711 conversions, the 1kHz tick, button presses) and the motor model run
+in time order whenever the clock advances. Nothing waits for the wall
+clock, so a run goes as fast as the host allows.
+*/
+
+#define SIM_LOOP_US             20      // Virtual time of one pass of loop()
+#define SIM_ADC_CONVERSION_US   104     // 13 ADC clocks at 125kHz
+#define SIM_LOADCELL_PERIOD_US  12500   // HX711 at 80 SPS
+#define SIM_TICK_US             1000
+#define SIM_PHYSICS_US          1000
+#define SIM_PRESS_MS            100     // Default hold of a scripted press
+#define SIM_SERIAL_TX_BUFFER    63      // Bytes the AVR core's transmit buffer holds
+#define SIM_EEPROM_WRITE_US     3400    // Erase and write of one EEPROM byte
+#define SIM_LCD_BYTE_US         500     // One byte through the I2C backpack at 100kHz
+#define SIM_LCD_CLEAR_US        2000    // The display's clear command
+#define SIM_NEVER               ((unsigned long)-1)
+
+// Wiring and calibration as in main.cpp
+#define SIM_PIN_THROTTLE        A7
+#define SIM_LOADCELL_SCALE      139
+#define SIM_LOADCELL_ZERO       84000L  // Raw reading of the unloaded load cell
+
+// Virtual clock, us since the start of the run
+unsigned long simTime();
+void simAdvance(unsigned long us);
+
+// Scripted inputs
+void simPressButtons(uint8_t mask, unsigned long holdUs);
+void simSetThrottlePot(int value);
+
+// Serial port backed by files
+int simSerialAvailable();
+int simSerialRead();
+int simSerialPeek();
+int simSerialAvailableForWrite();
+void simSerialWrite(uint8_t c);
+void simSerialOutput(FILE* out);
+
+// Motor, propeller and battery model
+void benchBegin();
+void benchStep(int escPulse, float dt);
+float benchCurrent();       // A
+float benchVoltage();       // V at the battery terminals
+float benchThrust();        // g
+float benchRpm();
+
+// Virtual display
+bool simLcdChanged();
+void simLcdPrint(FILE* out);
+
+// Virtual EEPROM
+bool simEepromLoad(const char* path);
+bool simEepromSave(const char* path);
+unsigned long simEepromBlocked();
+
+// Advances the HAL devices up to the given time
+void halNativeRun(unsigned long now);
+unsigned long halNativeNextEvent();
+void halNativeReplay();
+void halNativeAdcBlock(unsigned long currentSum, unsigned long voltageSum, uint16_t samples, uint16_t throttle);
+
+// Replay of a RECORD_RAW capture, see SimReplay.cpp
+bool replayLoad(const char* path);
+void replayBegin(unsigned long now);
+unsigned long replayNextEvent();
+void replayRun();
+unsigned long replayEnd();
+unsigned long replayBlocks();
+
+// Line to the --values output
+void simLogEvent(const char* name, long value);
+
+#endif
@@ -0,0 +1,67 @@
+#include <Arduino.h>
+#include "Sim.h"
+
+/*
+Brushless motor, propeller and battery model, good enough to give the
+firmware realistic shapes: the rotor follows the throttle with a first
+order lag, thrust grows with rpm squared and shaft power with rpm cubed,
+and the battery sags with current and with the charge taken out.
+
+The constants give a 4S 5000mAh pack driving a 900kV motor to about 2kg
+of thrust at 40A.
+*/
+
+#define BENCH_CELLS             4
+#define BENCH_CELL_FULL         4.2F    // V
+#define BENCH_CELL_EMPTY        3.5F    // V
+#define BENCH_CAPACITY          5000.0F // mAh
+#define BENCH_RESISTANCE        0.02F   // Ohm, pack and wiring
+#define BENCH_KV                900.0F  // rpm/V
+#define BENCH_LOAD_FACTOR       0.85F   // Loaded rpm against no load rpm
+#define BENCH_TIME_CONSTANT     0.15F   // s
+#define BENCH_THRUST_FACTOR     1.335e-5F   // g/rpm^2
+#define BENCH_POWER_FACTOR      2.79e-10F   // W/rpm^3
+#define BENCH_EFFICIENCY        0.8F
+#define BENCH_IDLE_CURRENT      0.3F    // A drawn by the ESC alone
+
+static float rpm;
+static float current;
+static float voltage;
+static float usedCharge;    // mAh
+
+void benchBegin() {
+    rpm = 0;
+    current = BENCH_IDLE_CURRENT;
+    usedCharge = 0;
+    voltage = BENCH_CELLS * BENCH_CELL_FULL;
+}
+
+void benchStep(int escPulse, float dt) {
+    float throttle = constrain((escPulse - 1000) / 1000.0F, 0.0F, 1.0F);
+    float state = 1 - usedCharge / BENCH_CAPACITY;
+    float openVoltage = BENCH_CELLS * (BENCH_CELL_EMPTY + (BENCH_CELL_FULL - BENCH_CELL_EMPTY) * constrain(state, 0.0F, 1.0F));
+
+    float target = throttle * BENCH_KV * voltage * BENCH_LOAD_FACTOR;
+    rpm += (target - rpm) * dt / BENCH_TIME_CONSTANT;
+
+    float shaftPower = BENCH_POWER_FACTOR * rpm * rpm * rpm;
+    current = BENCH_IDLE_CURRENT + shaftPower / BENCH_EFFICIENCY / voltage;
+    voltage = openVoltage - current * BENCH_RESISTANCE;
+    usedCharge += current * dt * 1000.0F / 3600.0F;
+}
+
+float benchCurrent() {
+    return current;
+}
+
+float benchVoltage() {
+    return voltage;
+}
+
+float benchThrust() {
+    return BENCH_THRUST_FACTOR * rpm * rpm;
+}
+
+float benchRpm() {
+    return rpm;
+}
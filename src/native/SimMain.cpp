@@ -0,0 +1,368 @@
+#include <Arduino.h>
+#include <time.h>
+#include "WatmeterTestBench.h"
+#include "SafetyMonitor.h"
+#include "Sim.h"
+
+/*
+Entry point of the native build: runs setup() and loop() against the bench
+model for a given stretch of virtual time.
+
+    watmeter-sim [options]
+        --time S            seconds of virtual time to run (60)
+        --press T:BUTTON[:MS]
+                            press screen, test, cut, ok or previous at T seconds,
+                            held for MS milliseconds (100)
+        --throttle T:VALUE  set the throttle pot to 0..1023 at T seconds
+        --lcd               print the display whenever it changes
+        --serial FILE       write the serial output to FILE, it drains at 115200 baud
+        --input FILE        feed FILE to the serial input at 115200 baud
+        --eeprom FILE       load the EEPROM from FILE and save it back at the end
+        --replay FILE       take the sensors and buttons from a RECORD_RAW capture
+        --values FILE       write every new WattmeterValues and the events as CSV
+
+Times can be fractional, e.g. --press 3.5:test; --press 3.5:previous:1500
+is a long press. A replay runs until one second
+after the last record unless --time is given.
+*/
+
+#define SIM_MAX_EVENTS      64
+#define SIM_BYTE_US         87      // 10 bits at 115200 baud, both directions
+
+enum SimEventType { EVENT_PRESS, EVENT_THROTTLE };
+
+struct SimEvent {
+    unsigned long time;
+    SimEventType type;
+    int value;
+    unsigned long hold;     // us a press is held
+};
+
+#define SIM_REPLAY_TAIL_US  1000000
+
+static const char* const buttonNames[] = { "screen", "test", "cut", "ok", "previous" };    // buttonPins order
+
+extern WattmeterValues runningValues;   // main.cpp
+
+static unsigned long long now;
+static bool inInterrupt;
+
+static SimEvent events[SIM_MAX_EVENTS];
+static uint8_t eventCount;
+static uint8_t nextEvent;
+
+static FILE* valuesOut;
+static FILE* serialOut;
+static uint8_t* serialIn;
+static long serialInSize;
+static long serialInRead;
+static unsigned long long serialOutDone;    // Time the transmit buffer is empty
+static unsigned long serialBlocked;         // us writes waited for a full transmit buffer
+
+unsigned long simTime() {
+    return (unsigned long)now;
+}
+
+static unsigned long nextScriptEvent() {
+    return nextEvent < eventCount ? events[nextEvent].time : SIM_NEVER;
+}
+
+static void runScriptEvent(const SimEvent& event) {
+    switch (event.type) {
+    case EVENT_PRESS:
+        simLogEvent("press", event.value);
+        simPressButtons(1 << event.value, event.hold);
+        break;
+    case EVENT_THROTTLE:
+        simLogEvent("throttle", event.value);
+        simSetThrottlePot(event.value);
+        break;
+    }
+}
+
+/*
+Moves the clock forward, running every device event and script event that
+falls due on the way. Called from delay() inside an event it only moves the
+clock, as interrupts stay masked inside an AVR interrupt handler.
+*/
+void simAdvance(unsigned long us) {
+    unsigned long long target = now + us;
+    if (inInterrupt) {
+        now = target;
+        return;
+    }
+
+    inInterrupt = true;
+    for (;;) {
+        unsigned long device = halNativeNextEvent();
+        unsigned long script = nextScriptEvent();
+        unsigned long replay = replayNextEvent();
+        unsigned long due = min(device, min(script, replay));
+        if (due > target) {
+            break;
+        }
+        if (due > now) {
+            now = due;
+        }
+        if (script == due) {
+            runScriptEvent(events[nextEvent++]);
+        }
+        else if (replay == due) {
+            replayRun();
+        }
+        else {
+            halNativeRun((unsigned long)now);
+        }
+    }
+    now = target;
+    inInterrupt = false;
+}
+
+int simSerialAvailable() {
+    long arrived = min((long)(now / SIM_BYTE_US), serialInSize);
+    return arrived > serialInRead ? (int)(arrived - serialInRead) : 0;
+}
+
+int simSerialRead() {
+    return simSerialAvailable() > 0 ? serialIn[serialInRead++] : -1;
+}
+
+int simSerialPeek() {
+    return simSerialAvailable() > 0 ? serialIn[serialInRead] : -1;
+}
+
+// The transmit buffer drains one byte every SIM_BYTE_US
+int simSerialAvailableForWrite() {
+    if (serialOutDone <= now) {
+        return SIM_SERIAL_TX_BUFFER;
+    }
+    long queued = (long)((serialOutDone - now + SIM_BYTE_US - 1) / SIM_BYTE_US);
+    return queued < SIM_SERIAL_TX_BUFFER ? (int)(SIM_SERIAL_TX_BUFFER - queued) : 0;
+}
+
+// Like Serial.write() on the AVR, waits while the transmit buffer is full
+void simSerialWrite(uint8_t c) {
+    if (simSerialAvailableForWrite() == 0) {
+        unsigned long wait = (unsigned long)(serialOutDone - now) - (SIM_SERIAL_TX_BUFFER - 1) * SIM_BYTE_US;
+        serialBlocked += wait;
+        simAdvance(wait);
+    }
+    serialOutDone = max(serialOutDone, now) + SIM_BYTE_US;
+    if (serialOut != NULL) {
+        fputc(c, serialOut);
+    }
+}
+
+// Where the transmitted bytes go, NULL drops them
+void simSerialOutput(FILE* out) {
+    serialOut = out;
+}
+
+void simLogEvent(const char* name, long value) {
+    if (valuesOut != NULL) {
+        fprintf(valuesOut, "%llu,event,%s,%ld\n", now, name, value);
+    }
+}
+
+#ifndef PIO_UNIT_TESTING     // The unit tests under test/ bring their own main()
+
+// One line per change of the running values, as acquisitionTask() left them
+static void logValues() {
+    static WattmeterValues logged;
+    static SafetyFault fault;
+
+    if (memcmp(&logged, &runningValues, sizeof(runningValues)) != 0) {
+        logged = runningValues;
+        fprintf(valuesOut, "%llu,values,%d,%ld,%ld,%ld,%ld,%d\n", now, logged.throttle, logged.voltage,
+            logged.current, logged.power, logged.consumption, logged.thrust);
+    }
+    if (safetyFault() != fault) {
+        fault = safetyFault();
+        simLogEvent("fault", fault);
+    }
+}
+
+static bool loadInput(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    serialInSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    serialIn = (uint8_t*)malloc(serialInSize > 0 ? serialInSize : 1);
+    serialInSize = fread(serialIn, 1, serialInSize, file);
+    fclose(file);
+    return true;
+}
+
+// "T:VALUE", T in seconds, a press may add ":MS"; false when malformed or the table is full
+static bool addEvent(SimEventType type, const char* text) {
+    char* end;
+    double seconds = strtod(text, &end);
+    if (*end != ':' || seconds < 0 || eventCount >= SIM_MAX_EVENTS) {
+        return false;
+    }
+    const char* argument = end + 1;
+
+    SimEvent& event = events[eventCount];
+    event.time = (unsigned long)(seconds * 1000000.0);
+    event.type = type;
+    event.hold = SIM_PRESS_MS * 1000UL;
+    if (type == EVENT_PRESS) {
+        const char* hold = strchr(argument, ':');
+        size_t length = hold != NULL ? (size_t)(hold - argument) : strlen(argument);
+        event.value = -1;
+        for (uint8_t i = 0; i < sizeof(buttonNames) / sizeof(buttonNames[0]); i++) {
+            if (strlen(buttonNames[i]) == length && strncasecmp(argument, buttonNames[i], length) == 0) {
+                event.value = i;
+            }
+        }
+        if (event.value < 0) {
+            return false;
+        }
+        if (hold != NULL) {
+            double ms = strtod(hold + 1, &end);
+            if (*end != '\0' || ms <= 0) {
+                return false;
+            }
+            event.hold = (unsigned long)(ms * 1000.0);
+        }
+    }
+    else {
+        event.value = (int)strtol(argument, &end, 10);
+        if (*end != '\0') {
+            return false;
+        }
+    }
+
+    // Keep the table sorted, events at the same time run in command line order
+    uint8_t i = eventCount++;
+    SimEvent added = event;
+    while (i > 0 && events[i - 1].time > added.time) {
+        events[i] = events[i - 1];
+        i--;
+    }
+    events[i] = added;
+    return true;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: watmeter-sim [--time S] [--press T:BUTTON[:MS]] [--throttle T:VALUE] [--lcd]\n"
+                    "                    [--serial FILE] [--input FILE] [--eeprom FILE]\n"
+                    "                    [--replay FILE] [--values FILE]\n");
+}
+
+static double wallSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    double duration = 60;
+    bool durationGiven = false;
+    bool replay = false;
+    bool showLcd = false;
+    const char* eepromPath = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char* option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        bool valid = value != NULL;
+
+        if (strcmp(option, "--lcd") == 0) {
+            showLcd = true;
+            continue;
+        }
+        else if (strcmp(option, "--time") == 0 && valid) {
+            duration = atof(value);
+            durationGiven = true;
+        }
+        else if (strcmp(option, "--press") == 0 && valid) {
+            valid = addEvent(EVENT_PRESS, value);
+        }
+        else if (strcmp(option, "--throttle") == 0 && valid) {
+            valid = addEvent(EVENT_THROTTLE, value);
+        }
+        else if (strcmp(option, "--serial") == 0 && valid) {
+            serialOut = strcmp(value, "-") == 0 ? stdout : fopen(value, "wb");
+            valid = serialOut != NULL;
+        }
+        else if (strcmp(option, "--input") == 0 && valid) {
+            valid = loadInput(value);
+        }
+        else if (strcmp(option, "--replay") == 0 && valid) {
+            valid = replay = replayLoad(value);
+        }
+        else if (strcmp(option, "--values") == 0 && valid) {
+            valuesOut = strcmp(value, "-") == 0 ? stdout : fopen(value, "w");
+            valid = valuesOut != NULL;
+        }
+        else if (strcmp(option, "--eeprom") == 0 && valid) {
+            eepromPath = value;
+            simEepromLoad(value);
+        }
+        else {
+            valid = false;
+        }
+
+        if (!valid) {
+            fprintf(stderr, "watmeter-sim: bad option %s %s\n", option, value != NULL ? value : "");
+            usage();
+            return 2;
+        }
+        i++;
+    }
+
+    double wallStart = wallSeconds();
+    unsigned long long end = (unsigned long long)(duration * 1000000.0);
+
+    if (valuesOut != NULL) {
+        fprintf(valuesOut, "time_us,kind,throttle_pct|event,voltage_mv|value,current_ma,power_mw,consumption_mah,thrust_g\n");
+    }
+    benchBegin();
+    if (replay) {   // Records made during setup() are replayed while it runs, as they happened
+        replayBegin(now);
+        if (!durationGiven) {
+            end = replayEnd() + SIM_REPLAY_TAIL_US;
+        }
+    }
+    setup();
+    while (now < end) {
+        loop();
+        simAdvance(SIM_LOOP_US);
+        if (valuesOut != NULL) {
+            logValues();
+        }
+        if (showLcd && simLcdChanged()) {
+            simLcdPrint(stdout);
+        }
+    }
+
+    if (eepromPath != NULL && !simEepromSave(eepromPath)) {
+        fprintf(stderr, "watmeter-sim: cannot write %s\n", eepromPath);
+    }
+    if (serialOut != NULL && serialOut != stdout) {
+        fclose(serialOut);
+    }
+    if (valuesOut != NULL && valuesOut != stdout) {
+        fclose(valuesOut);
+    }
+
+    double wall = wallSeconds() - wallStart;
+    double simulated = now / 1e6;
+    fprintf(stderr, "watmeter-sim: %.1fs simulated in %.2fs (x%.0f)\n", simulated, wall, wall > 0 ? simulated / wall : 0.0);
+    if (serialBlocked > 0) {
+        fprintf(stderr, "watmeter-sim: serial writes waited %luus for the transmit buffer\n", serialBlocked);
+    }
+    if (simEepromBlocked() > 0) {
+        fprintf(stderr, "watmeter-sim: EEPROM writes waited %luus for the previous write\n", simEepromBlocked());
+    }
+    if (replay) {
+        fprintf(stderr, "watmeter-sim: %lu ADC blocks replayed, %.0f blocks/s\n", replayBlocks(), wall > 0 ? replayBlocks() / wall : 0.0);
+    }
+    return 0;
+}
+
+#endif
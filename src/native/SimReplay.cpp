@@ -0,0 +1,236 @@
+#include <Arduino.h>
+#include "TelemetryProtocol.h"
+#include "LoadCell.h"
+#include "AdcSampler.h"
+#include "Buttons.h"
+#include "Sim.h"
+
+/*
+Replays a serial capture of a firmware built with RECORD_RAW. The raw ADC
+blocks, HX711 conversions, debounced button events and tare offsets are
+fed through the same entry points the hardware uses, at their recorded times
+on the virtual clock, so conversion, statistics, integration and cutoff
+code all run exactly as they did on the bench. Other frames and text in
+the capture are skipped.
+
+Recorded time stamps are micros() of the bench; they are unwrapped and kept
+as they are, so a capture started at reset replays in step with setup() and
+the output lines up with the capture.
+*/
+
+#define REPLAY_START_US     1000    // Start of a capture with a zero first time stamp
+
+struct ReplayRecord {
+    unsigned long time;             // Unwrapped us from the first record
+    uint8_t type;                   // TelemetryFrameType
+    uint8_t event;                  // TelemetryRawEventType
+    uint16_t samples;
+    uint16_t throttle;
+    unsigned long currentSum;
+    unsigned long voltageSum;
+    long value;                     // HX711 counts or event value
+};
+
+static ReplayRecord* records;
+static unsigned long recordCount;
+static unsigned long nextRecord;
+static unsigned long base;
+static unsigned long blocks;
+static bool started;
+
+static bool addRecord(const ReplayRecord& record) {
+    static unsigned long capacity;
+    if (recordCount == capacity) {
+        capacity = capacity ? capacity * 2 : 1024;
+        ReplayRecord* grown = (ReplayRecord*)realloc(records, capacity * sizeof(ReplayRecord));
+        if (grown == NULL) {
+            return false;
+        }
+        records = grown;
+    }
+    records[recordCount++] = record;
+    return true;
+}
+
+// Frame at data[0], false when it is not a valid frame
+static bool parseFrame(const uint8_t* data, long size, ReplayRecord& record, uint32_t& timestamp, long& frameSize) {
+    if (size < TELEMETRY_HEADER_SIZE + 1 || data[0] != TELEMETRY_SYNC || data[2] > TELEMETRY_MAX_PAYLOAD) {
+        return false;
+    }
+    uint8_t length = data[2];
+    frameSize = TELEMETRY_HEADER_SIZE + length + 1;
+    if (size < frameSize) {
+        return false;
+    }
+    uint8_t crc = 0;
+    for (long i = 1; i < frameSize - 1; i++) {
+        crc = telemetryCrc8(crc, data[i]);
+    }
+    if (crc != data[frameSize - 1]) {
+        return false;
+    }
+
+    const uint8_t* payload = data + TELEMETRY_HEADER_SIZE;
+    memset(&record, 0, sizeof(record));
+    record.type = data[1];
+    switch (record.type) {
+    case TELEMETRY_RAW_ADC: {
+        if (length < TELEMETRY_RAW_ADC_SIZE) {
+            return false;
+        }
+        TelemetryRawAdc raw;
+        telemetryDecodeRawAdc(payload, raw);
+        timestamp = raw.timestamp;
+        record.currentSum = raw.currentSum;
+        record.voltageSum = raw.voltageSum;
+        record.samples = raw.samples;
+        record.throttle = raw.throttle;
+        return true;
+    }
+    case TELEMETRY_RAW_LOADCELL: {
+        if (length < TELEMETRY_RAW_LOADCELL_SIZE) {
+            return false;
+        }
+        TelemetryRawLoadCell raw;
+        telemetryDecodeRawLoadCell(payload, raw);
+        timestamp = raw.timestamp;
+        record.value = raw.raw;
+        return true;
+    }
+    case TELEMETRY_RAW_EVENT: {
+        if (length < TELEMETRY_RAW_EVENT_SIZE) {
+            return false;
+        }
+        TelemetryRawEvent raw;
+        telemetryDecodeRawEvent(payload, raw);
+        timestamp = raw.timestamp;
+        record.event = raw.type;
+        record.value = raw.value;
+        return true;
+    }
+    default:
+        return false;   // Valid frame, but not an input; skipped like any other byte run
+    }
+}
+
+bool replayLoad(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t* data = (uint8_t*)malloc(size > 0 ? size : 1);
+    size = fread(data, 1, size, file);
+    fclose(file);
+
+    // Frames go out in the order loop() sends them, which is not quite time order
+    uint32_t first = 0;
+    uint32_t last = 0;
+    unsigned long unwrapped = 0;
+    long pos = 0;
+    while (pos < size) {
+        ReplayRecord record;
+        uint32_t timestamp;
+        long frameSize;
+        if (!parseFrame(data + pos, size - pos, record, timestamp, frameSize)) {
+            pos++;
+            continue;
+        }
+        pos += frameSize;
+
+        if (recordCount == 0) {
+            first = last = timestamp;
+        }
+        unwrapped += (int32_t)(timestamp - last);   // Signed, out of order frames step back
+        last = timestamp;
+        record.time = unwrapped;
+        if (!addRecord(record)) {
+            break;
+        }
+    }
+    free(data);
+
+    // Stable insertion sort, the capture is nearly sorted already
+    for (unsigned long i = 1; i < recordCount; i++) {
+        ReplayRecord record = records[i];
+        unsigned long j = i;
+        while (j > 0 && (long)(records[j - 1].time - record.time) > 0) {
+            records[j] = records[j - 1];
+            j--;
+        }
+        records[j] = record;
+    }
+    if (recordCount > 0 && (long)records[0].time < 0) {
+        unsigned long shift = -records[0].time;
+        for (unsigned long i = 0; i < recordCount; i++) {
+            records[i].time += shift;
+        }
+        first -= shift;
+    }
+    base = first;   // Relative times plus base give the recorded micros()
+    return true;
+}
+
+void replayBegin(unsigned long now) {
+    halNativeReplay();
+    if (base <= now) {
+        base = now + REPLAY_START_US;
+    }
+    started = true;
+}
+
+unsigned long replayNextEvent() {
+    return started && nextRecord < recordCount ? base + records[nextRecord].time : SIM_NEVER;
+}
+
+unsigned long replayEnd() {
+    return recordCount > 0 ? base + records[recordCount - 1].time : base;
+}
+
+unsigned long replayBlocks() {
+    return blocks;
+}
+
+void replayRun() {
+    const ReplayRecord& record = records[nextRecord++];
+    switch (record.type) {
+    case TELEMETRY_RAW_ADC:
+        if (record.samples != adcBlockSamples()) {  // Recorded with another oversampling, switch to it
+            uint8_t bits = ADC_OVERSAMPLE_MIN;
+            while (bits < ADC_OVERSAMPLE_MAX && (1U << (2 * bits)) != record.samples) {
+                bits++;
+            }
+            if (!adcSetOversampling(bits) || adcBlockSamples() != record.samples) {
+                break;
+            }
+            simLogEvent("oversampling", bits);
+        }
+        halNativeAdcBlock(record.currentSum, record.voltageSum, record.samples, record.throttle);
+        blocks++;
+        break;
+    case TELEMETRY_RAW_LOADCELL:
+        loadCellConversionComplete(record.value);
+        break;
+    case TELEMETRY_RAW_EVENT:
+        if (record.event == RAW_EVENT_BUTTON) {
+            simLogEvent("button", record.value);
+            buttonsPost(record.value & 0xFF, record.value >> 8, record.time);
+        }
+        else if (record.event == RAW_EVENT_BUTTONS) {
+            // Older captures hold the scan of a press, replayed as presses of the buttons in it
+            simLogEvent("buttons", record.value);
+            for (uint8_t i = 0; i < 8; i++) {
+                if (record.value & (1 << i)) {
+                    buttonsPost(i, BUTTON_PRESS, record.time);
+                }
+            }
+        }
+        else if (record.event == RAW_EVENT_TARE) {
+            simLogEvent("tare", record.value);
+            loadCellSetOffset(record.value);
+        }
+        break;
+    }
+}
@@ -0,0 +1,113 @@
+#include <Arduino.h>
+#include <unity.h>
+#include "Calibration.h"
+
+/*
+Runs against the simulator's virtual EEPROM, so the points go through the
+same store, load and compile path as on the bench.
+*/
+
+void setUp() {
+    for (uint8_t channel = 0; channel < CALIBRATION_CHANNELS; channel++) {
+        calibrationClear(channel);
+    }
+    calibrationBegin();
+}
+
+void tearDown() {
+}
+
+static void test_uncalibrated_passes_through() {
+    TEST_ASSERT_EQUAL(1234, calibrationApply(CALIBRATION_CURRENT, 1234));
+    TEST_ASSERT_EQUAL(-56, calibrationInverse(CALIBRATION_CURRENT, -56));
+}
+
+static void test_single_point_corrects_offset() {
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_VOLTAGE, 100, 110));
+    TEST_ASSERT_EQUAL(210, calibrationApply(CALIBRATION_VOLTAGE, 200));
+    TEST_ASSERT_EQUAL(-90, calibrationApply(CALIBRATION_VOLTAGE, -100));
+    TEST_ASSERT_EQUAL(200, calibrationInverse(CALIBRATION_VOLTAGE, 210));
+    TEST_ASSERT_EQUAL(5, calibrationApply(CALIBRATION_CURRENT, 5));
+}
+
+static void test_linear_fit() {
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_THRUST, 0, 10));
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_THRUST, 1000, 1510));
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_THRUST, 2000, 3010));
+    TEST_ASSERT_EQUAL(10, calibrationApply(CALIBRATION_THRUST, 0));
+    TEST_ASSERT_EQUAL(760, calibrationApply(CALIBRATION_THRUST, 500));
+    TEST_ASSERT_EQUAL(4510, calibrationApply(CALIBRATION_THRUST, 3000));
+    TEST_ASSERT_EQUAL(500, calibrationInverse(CALIBRATION_THRUST, 760));
+    TEST_ASSERT_EQUAL(-100, calibrationInverse(CALIBRATION_THRUST, -140));
+}
+
+static void test_table_segments() {
+    TEST_ASSERT_TRUE(calibrationSetMode(CALIBRATION_CURRENT, CALIBRATION_TABLE));
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_CURRENT, 300, 250));
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_CURRENT, 0, 0));
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_CURRENT, 100, 150));
+
+    CalibrationTable table;
+    TEST_ASSERT_TRUE(calibrationLoad(CALIBRATION_CURRENT, table));
+    TEST_ASSERT_EQUAL(3, table.count);
+    TEST_ASSERT_EQUAL(0, table.points[0].input);
+    TEST_ASSERT_EQUAL(300, table.points[2].input);
+
+    TEST_ASSERT_EQUAL(75, calibrationApply(CALIBRATION_CURRENT, 50));
+    TEST_ASSERT_EQUAL(150, calibrationApply(CALIBRATION_CURRENT, 100));
+    TEST_ASSERT_EQUAL(200, calibrationApply(CALIBRATION_CURRENT, 200));
+    TEST_ASSERT_EQUAL(-15, calibrationApply(CALIBRATION_CURRENT, -10));     // First segment extends down
+    TEST_ASSERT_EQUAL(300, calibrationApply(CALIBRATION_CURRENT, 400));     // Last one up
+
+    TEST_ASSERT_EQUAL(50, calibrationInverse(CALIBRATION_CURRENT, 75));
+    TEST_ASSERT_EQUAL(200, calibrationInverse(CALIBRATION_CURRENT, 200));
+    TEST_ASSERT_EQUAL(400, calibrationInverse(CALIBRATION_CURRENT, 300));
+    TEST_ASSERT_EQUAL(-10, calibrationInverse(CALIBRATION_CURRENT, -15));
+}
+
+static void test_inverse_round_trip() {
+    TEST_ASSERT_TRUE(calibrationSetMode(CALIBRATION_CURRENT, CALIBRATION_TABLE));
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_CURRENT, 0, 40));
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_CURRENT, 1000, 1300));
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_CURRENT, 5000, 5100));
+    for (long output = -500; output < 8000; output += 37) {
+        long input = calibrationInverse(CALIBRATION_CURRENT, output);
+        TEST_ASSERT_INT_WITHIN(1, output, calibrationApply(CALIBRATION_CURRENT, input));
+    }
+}
+
+// A gain of 2 or more would overflow the correction, the table keeps its last valid state
+static void test_rejects_steep_points() {
+    TEST_ASSERT_TRUE(calibrationSetMode(CALIBRATION_VOLTAGE, CALIBRATION_TABLE));
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_VOLTAGE, 0, 0));
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_VOLTAGE, 100, 100));
+    uint8_t changes = calibrationChanges();
+    TEST_ASSERT_FALSE(calibrationAddPoint(CALIBRATION_VOLTAGE, 200, 400));
+    TEST_ASSERT_EQUAL(changes, calibrationChanges());
+    TEST_ASSERT_EQUAL(300, calibrationApply(CALIBRATION_VOLTAGE, 300));
+
+    CalibrationTable table;
+    TEST_ASSERT_TRUE(calibrationLoad(CALIBRATION_VOLTAGE, table));
+    TEST_ASSERT_EQUAL(2, table.count);
+}
+
+static void test_reloads_from_eeprom() {
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_THRUST, 0, 0));
+    TEST_ASSERT_TRUE(calibrationAddPoint(CALIBRATION_THRUST, 1000, 1250));
+    calibrationBegin();
+    TEST_ASSERT_EQUAL(2500, calibrationApply(CALIBRATION_THRUST, 2000));
+    TEST_ASSERT_TRUE(calibrationSetMode(CALIBRATION_THRUST, CALIBRATION_OFF));
+    TEST_ASSERT_EQUAL(2000, calibrationApply(CALIBRATION_THRUST, 2000));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_uncalibrated_passes_through);
+    RUN_TEST(test_single_point_corrects_offset);
+    RUN_TEST(test_linear_fit);
+    RUN_TEST(test_table_segments);
+    RUN_TEST(test_inverse_round_trip);
+    RUN_TEST(test_rejects_steep_points);
+    RUN_TEST(test_reloads_from_eeprom);
+    return UNITY_END();
+}
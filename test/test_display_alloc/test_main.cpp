@@ -0,0 +1,102 @@
+#include <Arduino.h>
+#include <unity.h>
+#include "WatmeterTestBench.h"
+#include "Sim.h"
+
+/*
+Runs the firmware on the simulated bench through every screen and an
+automatic test with malloc(), calloc() and realloc() replaced: once setup()
+is done, any heap allocation, whether from new, a library or the C
+functions directly, is counted and fails the test. The replacements hand
+the memory to glibc's own allocator, so this test only builds on a glibc
+host.
+*/
+
+#define BUTTON_SCREEN   0   // buttonPins order
+#define BUTTON_TEST     1
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void __libc_free(void* p);
+}
+
+static bool trapping;
+static unsigned long allocations;
+
+static void countAllocation() {
+    if (trapping) {
+        allocations++;
+    }
+}
+
+// operator new of the C++ library allocates through malloc(), so it is counted too
+extern "C" void* malloc(size_t size) {
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size) {
+    countAllocation();
+    return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* p, size_t size) {
+    countAllocation();
+    return __libc_realloc(p, size);
+}
+
+extern "C" void free(void* p) {
+    __libc_free(p);
+}
+
+// Runs loop() for the given virtual time, returns the display updates
+static unsigned long run(unsigned long ms) {
+    unsigned long updates = 0;
+    unsigned long end = simTime() + ms * 1000;
+    while (simTime() < end) {
+        loop();
+        simAdvance(SIM_LOOP_US);
+        if (simLcdChanged()) {
+            updates++;
+        }
+    }
+    return updates;
+}
+
+static unsigned long press(uint8_t button) {
+    simPressButtons(1 << button, SIM_PRESS_MS * 1000UL);
+    return run(1000);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+    trapping = false;
+}
+
+static void test_display_loop_does_not_allocate() {
+    benchBegin();
+    setup();
+    run(3000);
+
+    trapping = true;
+    unsigned long updates = run(2000);
+    for (uint8_t screen = 0; screen < 4; screen++) {
+        updates += press(BUTTON_SCREEN);
+    }
+    updates += press(BUTTON_TEST);
+    updates += run(20000);
+    trapping = false;
+
+    TEST_ASSERT_TRUE(updates >= 5);     // Every press changes the screen
+    TEST_ASSERT_EQUAL_MESSAGE(0, allocations, "heap allocation after setup()");
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_display_loop_does_not_allocate);
+    return UNITY_END();
+}
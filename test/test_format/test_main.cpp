@@ -0,0 +1,65 @@
+#include <Arduino.h>
+#include <unity.h>
+#include "Format.h"
+
+/*
+Fixed width fields of the screens: every field is exactly width characters,
+padded with spaces or cut, and always terminated.
+*/
+
+static char buf[21];
+
+void setUp() {
+    memset(buf, '#', sizeof(buf));
+}
+
+void tearDown() {
+}
+
+static void test_pads_to_width() {
+    TEST_ASSERT_EQUAL_STRING("V=12V     ", formatField(buf, 10, F("V="), 12, F("V")));
+    TEST_ASSERT_EQUAL_STRING("OFF   ", formatTextField(buf, 6, F("OFF")));
+    TEST_ASSERT_EQUAL_STRING("    ", formatTextField(buf, 4, F("")));
+}
+
+static void test_truncates_to_width() {
+    TEST_ASSERT_EQUAL_STRING("T=1234", formatField(buf, 6, F("T="), 123456, F("g")));
+    TEST_ASSERT_EQUAL_STRING("ABC", formatTextField(buf, 3, F("ABCDEF")));
+    TEST_ASSERT_EQUAL_STRING("", formatField(buf, 0, F("V="), 1, F("V")));
+}
+
+static void test_terminates_at_width() {
+    formatField(buf, 5, F(""), 7, F(""));
+    TEST_ASSERT_EQUAL_CHAR('\0', buf[5]);
+    TEST_ASSERT_EQUAL_CHAR('#', buf[6]);
+}
+
+static void test_fixed_point() {
+    TEST_ASSERT_EQUAL_STRING("I=12.34A", formatFixedField(buf, 8, F("I="), 1234, 2, F("A")));
+    TEST_ASSERT_EQUAL_STRING("0.05", formatFixedField(buf, 4, F(""), 5, 2, F("")));
+    TEST_ASSERT_EQUAL_STRING("3.000", formatFixedField(buf, 5, F(""), 3000, 3, F("")));
+}
+
+static void test_fixed_point_negative() {
+    TEST_ASSERT_EQUAL_STRING("-1.25A", formatFixedField(buf, 6, F(""), -125, 2, F("A")));
+    TEST_ASSERT_EQUAL_STRING("-0.5 ", formatFixedField(buf, 5, F(""), -5, 1, F("")));
+    TEST_ASSERT_EQUAL_STRING("-0.05", formatFixedField(buf, 5, F(""), -5, 2, F("")));
+    TEST_ASSERT_EQUAL_STRING("-7g", formatField(buf, 3, F(""), -7, F("g")));
+    TEST_ASSERT_EQUAL_STRING("-2147483648", formatField(buf, 11, F(""), -2147483647L - 1, F("")));
+}
+
+static void test_float() {
+    TEST_ASSERT_EQUAL_STRING("P=12.5W ", formatFloatField(buf, 8, F("P="), 12.46F, 1, F("W")));
+    TEST_ASSERT_EQUAL_STRING("-0.25", formatFloatField(buf, 5, F(""), -0.25F, 2, F("")));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_pads_to_width);
+    RUN_TEST(test_truncates_to_width);
+    RUN_TEST(test_terminates_at_width);
+    RUN_TEST(test_fixed_point);
+    RUN_TEST(test_fixed_point_negative);
+    RUN_TEST(test_float);
+    return UNITY_END();
+}
@@ -0,0 +1,81 @@
+#include <Arduino.h>
+#include <unity.h>
+#include "RingBuffer.h"
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void test_starts_empty() {
+    RingBuffer<int, 4> queue;
+    int item = 42;
+    TEST_ASSERT_TRUE(queue.isEmpty());
+    TEST_ASSERT_EQUAL(0, queue.count());
+    TEST_ASSERT_FALSE(queue.pop(item));
+    TEST_ASSERT_EQUAL(42, item);
+}
+
+static void test_keeps_order() {
+    RingBuffer<int, 8> queue;
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_TRUE(queue.push(i));
+    }
+    TEST_ASSERT_EQUAL(5, queue.count());
+    for (int i = 0; i < 5; i++) {
+        int item;
+        TEST_ASSERT_TRUE(queue.pop(item));
+        TEST_ASSERT_EQUAL(i, item);
+    }
+    TEST_ASSERT_TRUE(queue.isEmpty());
+}
+
+// One slot stays free to tell full from empty
+static void test_full_rejects_push() {
+    RingBuffer<int, 4> queue;
+    TEST_ASSERT_TRUE(queue.push(1));
+    TEST_ASSERT_TRUE(queue.push(2));
+    TEST_ASSERT_TRUE(queue.push(3));
+    TEST_ASSERT_FALSE(queue.push(4));
+    TEST_ASSERT_EQUAL(3, queue.count());
+
+    int item;
+    TEST_ASSERT_TRUE(queue.pop(item));
+    TEST_ASSERT_EQUAL(1, item);
+    TEST_ASSERT_TRUE(queue.push(4));
+}
+
+static void test_wraps_around() {
+    RingBuffer<uint8_t, 4> queue;
+    uint8_t next = 0;
+    for (int i = 0; i < 1000; i++) {
+        TEST_ASSERT_TRUE(queue.push((uint8_t)i));
+        TEST_ASSERT_EQUAL(1, queue.count());
+        uint8_t item;
+        TEST_ASSERT_TRUE(queue.pop(item));
+        TEST_ASSERT_EQUAL(next++, item);
+    }
+}
+
+static void test_clear() {
+    RingBuffer<int, 4> queue;
+    queue.push(1);
+    queue.push(2);
+    queue.clear();
+    TEST_ASSERT_TRUE(queue.isEmpty());
+    TEST_ASSERT_TRUE(queue.push(3));
+    int item;
+    TEST_ASSERT_TRUE(queue.pop(item));
+    TEST_ASSERT_EQUAL(3, item);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_starts_empty);
+    RUN_TEST(test_keeps_order);
+    RUN_TEST(test_full_rejects_push);
+    RUN_TEST(test_wraps_around);
+    RUN_TEST(test_clear);
+    return UNITY_END();
+}
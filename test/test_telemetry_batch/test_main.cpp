@@ -0,0 +1,145 @@
+#include <unity.h>
+#include <stdio.h>
+#include "../../tools/telemetry/TelemetryDecoder.cpp"
+// After the standard library, which Arduino's min() and max() macros would break
+#include <Arduino.h>
+#include "Telemetry.h"
+#include "Sim.h"
+
+/*
+Streamed samples through the firmware's batch encoder (src/Telemetry.cpp),
+captured from the simulated serial port and read back by the host decoder:
+the values, the time stamps spread over the span by ADC blocks, and the
+deltas, block gaps and spans that end a batch.
+*/
+
+#define BLOCK_US        3448    // One ADC block at the default oversampling
+#define DRAIN_US        5000    // Longer than a whole batch frame takes at 115200 baud
+
+static FILE* capture;
+static std::vector<uint8_t> frameTypes;
+static std::vector<SampleRecord> decoded;
+
+struct Input {
+    unsigned long timestamp;
+    uint8_t blocks;             // Since the previous sample
+    WattmeterValues values;
+};
+
+// Each sample after the transmit buffer drained, so no frame is dropped
+static void send(const Input* inputs, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        simAdvance(DRAIN_US);
+        telemetryBatchSample(inputs[i].values, inputs[i].timestamp, inputs[i].blocks);
+    }
+    simAdvance(DRAIN_US);
+    telemetryFlushBatch();
+}
+
+static void decodeCapture() {
+    std::vector<uint8_t> bytes;
+    fflush(capture);
+    rewind(capture);
+    int c;
+    while ((c = fgetc(capture)) != EOF) {
+        bytes.push_back((uint8_t)c);
+    }
+
+    TelemetryDecoder decoder;
+    TimestampUnwrapper clock;
+    std::vector<SampleRecord> records;
+    decoder.feed(bytes.data(), bytes.size(), [&](const TelemetryFrame& frame) {
+        frameTypes.push_back(frame.type);
+        decodeSampleFrame(frame, clock, records);
+        decoded.insert(decoded.end(), records.begin(), records.end());
+    });
+    TEST_ASSERT_EQUAL(0, decoder.stats().lostFrames);
+}
+
+// Every sample back with its time stamp and its values in the telemetry units
+static void assertDecoded(const Input* inputs, uint8_t count) {
+    TEST_ASSERT_EQUAL(count, decoded.size());
+    for (uint8_t i = 0; i < count; i++) {
+        const WattmeterValues& values = inputs[i].values;
+        const SampleRecord& record = decoded[i];
+        TEST_ASSERT_EQUAL(inputs[i].timestamp, (unsigned long)record.timestamp);
+        TEST_ASSERT_EQUAL(values.throttle, record.throttle);
+        TEST_ASSERT_EQUAL(values.voltage / 10, lround(record.voltage * 100));
+        TEST_ASSERT_EQUAL(values.current / 10, lround(record.current * 100));
+        TEST_ASSERT_EQUAL(values.power / 100, lround(record.power * 10));
+        TEST_ASSERT_EQUAL(values.consumption, record.consumption);
+        TEST_ASSERT_EQUAL(values.thrust, record.thrust);
+    }
+}
+
+void setUp() {
+    capture = tmpfile();
+    simSerialOutput(capture);
+    frameTypes.clear();
+    decoded.clear();
+}
+
+void tearDown() {
+    simSerialOutput(NULL);
+    fclose(capture);
+}
+
+static void test_batch_round_trip() {
+    // 1 to 4 blocks between samples, the span spread over them exactly, and entries of 1 to 5 bytes
+    static const Input inputs[] = {
+        { 1000000,                  0, { 40, 16000, 10000, 160000, 100, 500 } },
+        { 1000000 + 1 * BLOCK_US,   1, { 40, 16030, 10000, 161100, 100, 500 } },
+        { 1000000 + 3 * BLOCK_US,   2, { 40, 16030, 10050, 161100, 100, 500 } },
+        { 1000000 + 4 * BLOCK_US,   1, { 40, 16030, 10050, 161100, 100, 500 } },
+        { 1000000 + 7 * BLOCK_US,   3, { 41, 15990, 9050, 151100, 100, 500 } },
+        { 1000000 + 11 * BLOCK_US,  4, { 41, 15990, 9050, 151100, 101, 498 } }
+    };
+    send(inputs, 6);
+    decodeCapture();
+
+    TEST_ASSERT_EQUAL(1, frameTypes.size());
+    TEST_ASSERT_EQUAL(TELEMETRY_SAMPLE_BATCH, frameTypes[0]);
+    assertDecoded(inputs, 6);
+}
+
+static void test_delta_overflow_ends_batch() {
+    // The third sample's voltage is 140 steps of 10mV away, more than an int8 delta
+    static const Input inputs[] = {
+        { 2000000,                  0, { 50, 16000, 20000, 320000, 200, 800 } },
+        { 2000000 + BLOCK_US,       1, { 50, 16100, 20000, 322000, 200, 800 } },
+        { 2000000 + 2 * BLOCK_US,   1, { 50, 17500, 20000, 350000, 200, 800 } }
+    };
+    send(inputs, 3);
+    decodeCapture();
+
+    TEST_ASSERT_EQUAL(2, frameTypes.size());
+    TEST_ASSERT_EQUAL(TELEMETRY_SAMPLE_BATCH, frameTypes[0]);
+    TEST_ASSERT_EQUAL(TELEMETRY_SAMPLE, frameTypes[1]);     // Left alone in the next batch
+    assertDecoded(inputs, 3);
+}
+
+static void test_block_gap_and_span_end_batch() {
+    // 5 blocks do not fit the flags, then a gap longer than the 16 bit span
+    static const Input inputs[] = {
+        { 3000000,                          0, { -1, 16800, 0, 0, 0, 0 } },
+        { 3000000 + 5 * BLOCK_US,           5, { -1, 16800, 0, 0, 0, 0 } },
+        { 3000000 + 5 * BLOCK_US + 70000,   1, { -1, 16790, 0, 0, 0, 1 } },
+        { 3000000 + 6 * BLOCK_US + 70000,   1, { -1, 16790, 0, 0, 0, 1 } }
+    };
+    send(inputs, 4);
+    decodeCapture();
+
+    TEST_ASSERT_EQUAL(3, frameTypes.size());
+    TEST_ASSERT_EQUAL(TELEMETRY_SAMPLE, frameTypes[0]);
+    TEST_ASSERT_EQUAL(TELEMETRY_SAMPLE, frameTypes[1]);
+    TEST_ASSERT_EQUAL(TELEMETRY_SAMPLE_BATCH, frameTypes[2]);
+    assertDecoded(inputs, 4);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_batch_round_trip);
+    RUN_TEST(test_delta_overflow_ends_batch);
+    RUN_TEST(test_block_gap_and_span_end_batch);
+    return UNITY_END();
+}
@@ -0,0 +1,155 @@
+#include <unity.h>
+#include <string.h>
+#include "../../tools/telemetry/TelemetryDecoder.cpp"
+
+/*
+The host decoder of tools/telemetry, fed hand built frames: CRC checking,
+resynchronisation and the sequence gaps that show lost frames.
+*/
+
+static std::vector<uint8_t> stream;
+static std::vector<uint8_t> types;
+static std::vector<uint8_t> sequences;
+
+static void addFrame(uint8_t type, uint8_t seq, const uint8_t* payload, uint8_t length) {
+    size_t start = stream.size();
+    stream.push_back(TELEMETRY_SYNC);
+    stream.push_back(type);
+    stream.push_back(length);
+    stream.push_back(seq);
+    stream.insert(stream.end(), payload, payload + length);
+    uint8_t crc = 0;
+    for (size_t i = start + 1; i < stream.size(); i++) {
+        crc = telemetryCrc8(crc, stream[i]);
+    }
+    stream.push_back(crc);
+}
+
+static void addStatus(uint8_t seq) {
+    static const uint8_t payload[] = { 1, 2, 3, 4, 5 };
+    addFrame(TELEMETRY_STATUS, seq, payload, sizeof(payload));
+}
+
+static void feed(TelemetryDecoder& decoder, size_t chunk) {
+    for (size_t pos = 0; pos < stream.size(); pos += chunk) {
+        size_t size = stream.size() - pos < chunk ? stream.size() - pos : chunk;
+        decoder.feed(&stream[pos], size, [](const TelemetryFrame& frame) {
+            types.push_back(frame.type);
+            sequences.push_back(frame.seq);
+        });
+    }
+}
+
+void setUp() {
+    stream.clear();
+    types.clear();
+    sequences.clear();
+}
+
+void tearDown() {
+}
+
+static void test_decodes_frames_in_any_chunks() {
+    for (uint8_t seq = 0; seq < 10; seq++) {
+        addStatus(seq);
+    }
+    static const size_t chunks[] = { 1, 3, 7, 64, 1000 };
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        TelemetryDecoder decoder;
+        sequences.clear();
+        feed(decoder, chunks[i]);
+        TEST_ASSERT_EQUAL(10, decoder.stats().frames);
+        TEST_ASSERT_EQUAL(0, decoder.stats().crcErrors);
+        TEST_ASSERT_EQUAL(0, decoder.stats().lostFrames);
+        TEST_ASSERT_EQUAL(0, decoder.stats().skippedBytes);
+        TEST_ASSERT_EQUAL(10, sequences.size());
+        TEST_ASSERT_EQUAL(9, sequences.back());
+    }
+}
+
+static void test_rejects_bad_crc() {
+    addStatus(0);
+    addStatus(1);
+    stream.back() ^= 0x01;
+    addStatus(2);
+
+    TelemetryDecoder decoder;
+    feed(decoder, 1000);
+    TEST_ASSERT_EQUAL(2, decoder.stats().frames);
+    TEST_ASSERT_EQUAL(1, decoder.stats().crcErrors);
+    TEST_ASSERT_EQUAL(2, sequences.size());
+    TEST_ASSERT_EQUAL(0, sequences[0]);
+    TEST_ASSERT_EQUAL(2, sequences[1]);
+    TEST_ASSERT_EQUAL(1, decoder.stats().lostFrames);    // The corrupt frame's number is missing
+}
+
+static void test_corrupt_payload_fails_crc() {
+    addStatus(0);
+    stream[5] ^= 0x40;
+
+    TelemetryDecoder decoder;
+    feed(decoder, 1000);
+    TEST_ASSERT_EQUAL(0, decoder.stats().frames);
+    TEST_ASSERT_EQUAL(1, decoder.stats().crcErrors);
+}
+
+static void test_resynchronises_after_garbage() {
+    static const uint8_t garbage[] = { 0x00, TELEMETRY_SYNC, 0xFF, TELEMETRY_SYNC, 0x01, 0x02 };
+    stream.insert(stream.end(), garbage, garbage + sizeof(garbage));
+    addStatus(7);
+
+    TelemetryDecoder decoder;
+    feed(decoder, 2);
+    TEST_ASSERT_EQUAL(1, decoder.stats().frames);
+    TEST_ASSERT_EQUAL(7, sequences[0]);
+    TEST_ASSERT_EQUAL(sizeof(garbage), decoder.stats().skippedBytes);
+}
+
+static void test_counts_sequence_gaps() {
+    addStatus(10);
+    addStatus(11);
+    addStatus(14);      // 12 and 13 lost
+    addStatus(15);
+
+    TelemetryDecoder decoder;
+    feed(decoder, 1000);
+    TEST_ASSERT_EQUAL(4, decoder.stats().frames);
+    TEST_ASSERT_EQUAL(2, decoder.stats().lostFrames);
+}
+
+static void test_sequence_wraps() {
+    addStatus(254);
+    addStatus(255);
+    addStatus(0);
+    addStatus(2);       // 1 lost
+
+    TelemetryDecoder decoder;
+    feed(decoder, 1000);
+    TEST_ASSERT_EQUAL(4, decoder.stats().frames);
+    TEST_ASSERT_EQUAL(1, decoder.stats().lostFrames);
+}
+
+static void test_reset_forgets_sequence() {
+    addStatus(3);
+    TelemetryDecoder decoder;
+    feed(decoder, 1000);
+    decoder.reset();
+
+    stream.clear();
+    addStatus(40);
+    feed(decoder, 1000);
+    TEST_ASSERT_EQUAL(1, decoder.stats().frames);
+    TEST_ASSERT_EQUAL(0, decoder.stats().lostFrames);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_decodes_frames_in_any_chunks);
+    RUN_TEST(test_rejects_bad_crc);
+    RUN_TEST(test_corrupt_payload_fails_crc);
+    RUN_TEST(test_resynchronises_after_garbage);
+    RUN_TEST(test_counts_sequence_gaps);
+    RUN_TEST(test_sequence_wraps);
+    RUN_TEST(test_reset_forgets_sequence);
+    return UNITY_END();
+}
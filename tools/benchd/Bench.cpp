@@ -0,0 +1,274 @@
+#include "Bench.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "SerialPort.h"
+
+#define BENCH_FILE_BUFFER       65536
+#define BENCH_STREAM_RETRY_US   2000000     // An Uno resets when the port opens, the bootloader takes ~2s
+
+int64_t hostMicros() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// mkdir -p
+static bool makeDirectory(const std::string& path) {
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+        std::string part = path.substr(0, slash);
+        if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) {
+            return false;
+        }
+        if (slash == std::string::npos) {
+            return true;
+        }
+    }
+}
+
+static std::string utcName(int64_t us) {
+    time_t seconds = (time_t)(us / 1000000);
+    tm utc;
+    gmtime_r(&seconds, &utc);
+    char text[32];
+    strftime(text, sizeof(text), "%Y%m%dT%H%M%SZ", &utc);
+    return text;
+}
+
+Bench::Bench(const std::string& name, const std::string& port, const BenchOptions& options)
+    : benchName(name), portPath(port), options(options), portFd(-1), openedUs(0), streamSentUs(0),
+      haveOffset(false), offsetUs(0), offsetBenchUs(0), run(), state(), shared() {
+}
+
+Bench::~Bench() {
+    close();
+}
+
+bool Bench::open() {
+    int fd = ::open(portPath.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        return false;
+    }
+    if (isatty(fd) && !configureSerial(fd, options.baud)) {
+        ::close(fd);
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        portFd = fd;
+    }
+    openedUs = hostMicros();
+    streamSentUs = 0;
+    state.connected = true;
+    state.opens++;
+    tick(openedUs);
+    return true;
+}
+
+void Bench::close() {
+    endRun();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (portFd >= 0) {
+            ::close(portFd);
+            portFd = -1;
+        }
+    }
+    state.connected = false;
+    publish();
+}
+
+// Reads everything the port has; false when it went away and has to be closed
+bool Bench::poll() {
+    uint8_t chunk[4096];
+    for (;;) {
+        ssize_t count = read(portFd, chunk, sizeof(chunk));
+        if (count > 0) {
+            int64_t receivedUs = hostMicros();
+            decoder.feed(chunk, (size_t)count, [&](const TelemetryFrame& frame) {
+                onFrame(frame, receivedUs);
+            });
+            continue;
+        }
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        return false;
+    }
+    publish();
+    return true;
+}
+
+// About once a second: asks for the stream until samples arrive and makes the run file readable
+void Bench::tick(int64_t nowUs) {
+    if (portFd >= 0 && options.streamRate > 0 && (!state.haveSample || state.latestHostUs < openedUs)
+        && nowUs - streamSentUs >= BENCH_STREAM_RETRY_US) {
+        streamSentUs = nowUs;
+        send("STREAM " + std::to_string(options.streamRate));
+    }
+    if (run.file != NULL) {
+        fflush(run.file);
+    }
+    publish();
+}
+
+// Writes a command line to the bench, the reply shows up in the stream as text and is skipped
+bool Bench::send(const std::string& line) {
+    std::string data = line + "\n";
+    std::lock_guard<std::mutex> lock(mutex);
+    return portFd >= 0 && write(portFd, data.data(), data.size()) == (ssize_t)data.size();
+}
+
+BenchSnapshot Bench::snapshot() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return shared;
+}
+
+void Bench::publish() {
+    const TelemetryDecoderStats& stats = decoder.stats();
+    state.frames = stats.frames;
+    state.lostFrames = stats.lostFrames;
+    state.crcErrors = stats.crcErrors;
+    state.skippedBytes = stats.skippedBytes;
+    state.offsetUs = offsetUs;
+    state.running = run.file != NULL;
+    std::lock_guard<std::mutex> lock(mutex);
+    shared = state;
+}
+
+void Bench::onFrame(const TelemetryFrame& frame, int64_t receivedUs) {
+    if (frame.type == TELEMETRY_STATUS && frame.length >= TELEMETRY_STATUS_SIZE) {
+        telemetryDecodeStatus(frame.payload, state.status);
+        state.haveStatus = true;
+        return;
+    }
+
+    if (decodeSampleFrame(frame, clock, records) == 0) {
+        return;
+    }
+    const SampleRecord& first = records.front();
+    if (state.haveSample && (first.timestamp < state.latest.timestamp
+        || first.timestamp - state.latest.timestamp > (uint64_t)BENCH_RESYNC_US)) {
+        endRun();   // The bench was reset or stopped streaming, its clock starts over
+        preRoll.clear();
+        clock.reset();
+        haveOffset = false;
+        decodeSampleFrame(frame, clock, records);
+    }
+
+    // A batch arrives after its last sample, the earlier ones look delayed and leave the offset to it
+    for (const SampleRecord& record : records) {
+        int64_t hostUs = align(record.timestamp, receivedUs);
+        state.latest = record;
+        state.latestHostUs = hostUs;
+        state.haveSample = true;
+        onSample(record, hostUs);
+    }
+}
+
+int64_t Bench::align(uint64_t benchUs, int64_t receivedUs) {
+    int64_t observed = receivedUs - (int64_t)benchUs;
+    if (!haveOffset) {
+        offsetUs = observed;
+        haveOffset = true;
+    }
+    else {
+        int64_t allowed = offsetUs + (int64_t)(benchUs - offsetBenchUs) * BENCH_SKEW_PPM / 1000000;
+        offsetUs = observed < allowed ? observed : allowed;
+    }
+    offsetBenchUs = benchUs;
+    return (int64_t)benchUs + offsetUs;
+}
+
+void Bench::onSample(const SampleRecord& record, int64_t hostUs) {
+    bool active = record.throttle >= 0;
+    if (run.file == NULL) {
+        if (!active) {
+            preRoll.push_back({ record, hostUs });
+            while (hostUs - preRoll.front().hostUs > options.preRollUs) {
+                preRoll.pop_front();
+            }
+            return;
+        }
+        if (!startRun(preRoll.empty() ? hostUs : preRoll.front().hostUs)) {
+            return;
+        }
+        for (const Pending& pending : preRoll) {
+            writeSample(pending.record, pending.hostUs);
+        }
+        preRoll.clear();
+    }
+
+    writeSample(record, hostUs);
+    if (active) {
+        run.lastActive = record.timestamp;
+    }
+    else if (record.timestamp - run.lastActive >= (uint64_t)options.runTailUs) {
+        endRun();
+    }
+}
+
+bool Bench::startRun(int64_t hostUs) {
+    std::string directory = options.directory + "/" + benchName;
+    std::string path = directory + "/run-" + utcName(hostUs) + ".csv";
+    FILE* file = makeDirectory(directory) ? fopen(path.c_str(), "w") : NULL;
+    if (file == NULL) {
+        fprintf(stderr, "%s: %s: %s\n", benchName.c_str(), path.c_str(), strerror(errno));
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, BENCH_FILE_BUFFER);
+    fprintf(file, "host_time_us,timestamp_us,seq,throttle_pct,voltage_v,current_a,power_w,consumption_mah,thrust_g\n");
+
+    run = Run();
+    run.file = file;
+    run.path = path;
+    run.startUs = hostUs;
+    run.lostAtStart = decoder.stats().lostFrames;
+    state.runs++;
+    state.runFile = path;
+    return true;
+}
+
+void Bench::writeSample(const SampleRecord& r, int64_t hostUs) {
+    fprintf(run.file, "%lld,%llu,%u,%d,%.2f,%.2f,%.1f,%u,%d\n", (long long)hostUs, (unsigned long long)r.timestamp,
+        r.seq, r.throttle, r.voltage, r.current, r.power, r.consumption, r.thrust);
+    if (run.samples++ == 0) {
+        run.consumptionAtStart = r.consumption;
+    }
+    run.endUs = hostUs;
+    run.consumption = r.consumption;
+    run.currentMax = r.current > run.currentMax ? r.current : run.currentMax;
+    run.powerMax = r.power > run.powerMax ? r.power : run.powerMax;
+    run.thrustMax = r.thrust > run.thrustMax ? r.thrust : run.thrustMax;
+}
+
+void Bench::endRun() {
+    if (run.file == NULL) {
+        return;
+    }
+    fclose(run.file);
+    run.file = NULL;
+
+    std::string index = options.directory + "/" + benchName + "/runs.csv";
+    bool created = access(index.c_str(), F_OK) != 0;
+    FILE* file = fopen(index.c_str(), "a");
+    if (file == NULL) {
+        fprintf(stderr, "%s: %s: %s\n", benchName.c_str(), index.c_str(), strerror(errno));
+        return;
+    }
+    if (created) {
+        fprintf(file, "file,start_us,end_us,samples,lost,current_max_a,power_max_w,thrust_max_g,consumption_mah\n");
+    }
+    fprintf(file, "%s,%lld,%lld,%llu,%llu,%.2f,%.1f,%d,%u\n", run.path.substr(run.path.rfind('/') + 1).c_str(),
+        (long long)run.startUs, (long long)run.endUs, (unsigned long long)run.samples,
+        (unsigned long long)(decoder.stats().lostFrames - run.lostAtStart), run.currentMax, run.powerMax,
+        run.thrustMax, run.consumption - run.consumptionAtStart);
+    fclose(file);
+}
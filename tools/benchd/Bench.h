@@ -0,0 +1,133 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "TelemetryDecoder.h"
+
+/*
+One bench on a serial port: decodes its telemetry stream, aligns the bench
+clock to the host clock and writes every run to a CSV file of its own.
+
+Alignment: the bench time stamps (micros() of the firmware) are unwrapped
+and mapped onto the host's CLOCK_REALTIME by an offset, the smallest
+difference between a frame's arrival and its bench time stamp seen so far.
+That is the frame with the least USB and scheduling latency; the offset may
+creep up by BENCH_SKEW_PPM of the elapsed bench time, so a slow resonator is
+followed too. A bench clock that jumps back or stalls for BENCH_RESYNC_US
+means the bench was reset, the alignment then starts over.
+
+Runs: a run starts with the first sample with the throttle enabled and ends
+once the throttle has been disabled for BenchOptions::runTailUs, so the
+spin-down is included. The idle samples of the preRollUs before the start
+are written first, for the zero readings. Each run goes to
+directory/name/run-<UTC start>.csv and gets a line in directory/name/runs.csv
+when it ends.
+
+The worker thread owning the bench calls open(), poll(), tick() and close();
+send() and snapshot() may be called from any thread.
+*/
+
+#define BENCH_SKEW_PPM      5000        // Ceramic resonators are within 0.5%
+#define BENCH_RESYNC_US     10000000LL
+
+struct BenchOptions {
+    std::string directory;
+    long baud;
+    int streamRate;         // Sent as STREAM until samples arrive, 0 to leave the bench's stream alone
+    int64_t runTailUs;
+    int64_t preRollUs;
+};
+
+struct BenchSnapshot {
+    bool connected;
+    unsigned opens;
+    uint64_t frames;
+    uint64_t lostFrames;
+    uint64_t crcErrors;
+    uint64_t skippedBytes;
+    bool haveSample;
+    SampleRecord latest;
+    int64_t latestHostUs;   // Aligned time of the latest sample, us since the epoch
+    int64_t offsetUs;       // Host minus bench clock
+    bool haveStatus;
+    TelemetryStatus status;
+    bool running;
+    unsigned runs;
+    std::string runFile;    // The running or the last run
+};
+
+class Bench {
+public:
+    Bench(const std::string& name, const std::string& port, const BenchOptions& options);
+    ~Bench();
+
+    const std::string& name() const { return benchName; }
+    const std::string& port() const { return portPath; }
+    int fd() const { return portFd; }
+
+    bool open();
+    void close();
+    bool poll();
+    void tick(int64_t nowUs);
+    bool send(const std::string& line);
+    BenchSnapshot snapshot() const;
+
+private:
+    struct Pending {
+        SampleRecord record;
+        int64_t hostUs;
+    };
+
+    struct Run {
+        FILE* file;
+        std::string path;
+        int64_t startUs;        // Host time
+        int64_t endUs;
+        uint64_t lastActive;    // Bench time of the last sample with the throttle enabled
+        uint64_t samples;
+        uint64_t lostAtStart;
+        unsigned consumptionAtStart;
+        unsigned consumption;
+        double currentMax;
+        double powerMax;
+        int thrustMax;
+    };
+
+    void onFrame(const TelemetryFrame& frame, int64_t receivedUs);
+    void onSample(const SampleRecord& record, int64_t hostUs);
+    int64_t align(uint64_t benchUs, int64_t receivedUs);
+    bool startRun(int64_t hostUs);
+    void writeSample(const SampleRecord& record, int64_t hostUs);
+    void endRun();
+    void publish();
+
+    std::string benchName;
+    std::string portPath;
+    BenchOptions options;
+    int portFd;
+    int64_t openedUs;
+    int64_t streamSentUs;
+
+    TelemetryDecoder decoder;
+    TimestampUnwrapper clock;
+    std::vector<SampleRecord> records;  // Samples of the last frame
+    bool haveOffset;
+    int64_t offsetUs;
+    uint64_t offsetBenchUs;     // Bench time the offset was last updated at
+
+    std::deque<Pending> preRoll;
+    Run run;
+    BenchSnapshot state;        // Worker side, copied to shared by publish()
+
+    mutable std::mutex mutex;   // Guards shared and writes to the port
+    BenchSnapshot shared;
+};
+
+int64_t hostMicros();
+
+#endif
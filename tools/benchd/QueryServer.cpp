@@ -0,0 +1,227 @@
+#include "QueryServer.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define QUERY_LINE_MAX      256
+#define QUERY_EVENTS        32
+#define QUERY_WAIT_MS       200     // Longest wait before the stop flag is checked
+
+QueryServer::QueryServer(const std::vector<Bench*>& benches) : benches(benches), listenFd(-1), epollFd(-1) {
+}
+
+QueryServer::~QueryServer() {
+    for (auto& entry : clients) {
+        close(entry.first);
+    }
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(socketPath.c_str());
+    }
+    if (epollFd >= 0) {
+        close(epollFd);
+    }
+}
+
+bool QueryServer::listen(const std::string& path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy(address.sun_path, path.c_str());
+    unlink(path.c_str());   // Left behind by a daemon that was killed
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 || bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(listenFd, 16) != 0) {
+        return false;
+    }
+    socketPath = path;
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = listenFd;
+    return epollFd >= 0 && epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event) == 0;
+}
+
+void QueryServer::run(const std::atomic<bool>& stop) {
+    epoll_event events[QUERY_EVENTS];
+    while (!stop) {
+        int count = epoll_wait(epollFd, events, QUERY_EVENTS, QUERY_WAIT_MS);
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listenFd) {
+                accept();
+                continue;
+            }
+            auto client = clients.find(fd);
+            if (client == clients.end()) {
+                continue;
+            }
+            bool open = !(events[i].events & EPOLLERR);
+            if (open && (events[i].events & (EPOLLIN | EPOLLHUP))) {
+                open = receive(fd, client->second);
+            }
+            else if (open) {
+                open = flush(fd, client->second);
+            }
+            if (!open) {
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+                close(fd);
+                clients.erase(client);
+            }
+        }
+    }
+}
+
+void QueryServer::accept() {
+    for (;;) {
+        int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            continue;
+        }
+        clients[fd] = Client();
+    }
+}
+
+// Runs the complete lines; false once the client hung up
+bool QueryServer::receive(int fd, Client& client) {
+    char chunk[1024];
+    bool open = true;
+    for (;;) {
+        ssize_t count = read(fd, chunk, sizeof(chunk));
+        if (count > 0) {
+            client.input.append(chunk, (size_t)count);
+            continue;
+        }
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        open = count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        break;
+    }
+
+    size_t end;
+    while ((end = client.input.find('\n')) != std::string::npos) {
+        std::string line = client.input.substr(0, end);
+        client.input.erase(0, end + 1);
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            bool ok = execute(line, client.output);
+            client.output += ok ? "OK\n" : "ERR\n";
+        }
+    }
+    if (client.input.size() > QUERY_LINE_MAX) {
+        client.input.clear();
+        client.output += "ERR\n";
+    }
+    return open && flush(fd, client);
+}
+
+// Writes what the socket takes and waits for EPOLLOUT for the rest
+bool QueryServer::flush(int fd, Client& client) {
+    while (!client.output.empty()) {
+        ssize_t count = send(fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+        if (count > 0) {
+            client.output.erase(0, (size_t)count);
+            continue;
+        }
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        return false;
+    }
+    epoll_event event;
+    event.events = client.output.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT;
+    event.data.fd = fd;
+    return epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+Bench* QueryServer::find(const std::string& name) const {
+    for (Bench* bench : benches) {
+        if (bench->name() == name) {
+            return bench;
+        }
+    }
+    return NULL;
+}
+
+bool QueryServer::execute(const std::string& line, std::string& out) {
+    char name[QUERY_LINE_MAX + 1];
+    char command[QUERY_LINE_MAX + 1];
+    int rest = 0;
+    int fields = sscanf(line.c_str(), "%256s %256s %n", command, name, &rest);
+    bool more = fields == 2 && rest < (int)line.size();     // Text after the bench name
+    char text[512];
+
+    if (fields == 1 && strcasecmp(command, "LIST") == 0) {
+        out += "name,port,connected,running,frames,lost,crc_errors,skipped_bytes,runs\n";
+        for (Bench* bench : benches) {
+            BenchSnapshot s = bench->snapshot();
+            snprintf(text, sizeof(text), "%s,%s,%d,%d,%llu,%llu,%llu,%llu,%u\n", bench->name().c_str(),
+                bench->port().c_str(), s.connected, s.running, (unsigned long long)s.frames,
+                (unsigned long long)s.lostFrames, (unsigned long long)s.crcErrors,
+                (unsigned long long)s.skippedBytes, s.runs);
+            out += text;
+        }
+        return true;
+    }
+    if (fields < 2) {
+        return false;
+    }
+    Bench* bench = find(name);
+    if (bench == NULL) {
+        return false;
+    }
+    BenchSnapshot s = bench->snapshot();
+
+    if (strcasecmp(command, "LATEST") == 0 && !more) {
+        if (!s.haveSample) {
+            return false;
+        }
+        const SampleRecord& r = s.latest;
+        out += "host_time_us,timestamp_us,seq,throttle_pct,voltage_v,current_a,power_w,consumption_mah,thrust_g\n";
+        snprintf(text, sizeof(text), "%lld,%llu,%u,%d,%.2f,%.2f,%.1f,%u,%d\n", (long long)s.latestHostUs,
+            (unsigned long long)r.timestamp, r.seq, r.throttle, r.voltage, r.current, r.power, r.consumption, r.thrust);
+        out += text;
+        return true;
+    }
+    if (strcasecmp(command, "STATUS") == 0 && !more) {
+        snprintf(text, sizeof(text), "connected=%d opens=%u frames=%llu lost=%llu crc_errors=%llu skipped_bytes=%llu "
+            "offset_us=%lld runs=%u running=%d run_file=%s\n", s.connected, s.opens, (unsigned long long)s.frames,
+            (unsigned long long)s.lostFrames, (unsigned long long)s.crcErrors, (unsigned long long)s.skippedBytes,
+            (long long)s.offsetUs, s.runs, s.running, s.runFile.c_str());
+        out += text;
+        if (s.haveStatus) {
+            snprintf(text, sizeof(text), "adc_bits=%u block_samples=%u block_rate=%.1f adc_overruns=%u telemetry_dropped=%u\n",
+                s.status.adcBits, s.status.blockSamples, s.status.blockRate / 10.0, s.status.adcOverruns, s.status.dropped);
+            out += text;
+        }
+        return true;
+    }
+    if (strcasecmp(command, "SEND") == 0 && more) {
+        return bench->send(line.substr(rest));
+    }
+    return false;
+}
@@ -0,0 +1,51 @@
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include "Bench.h"
+
+/*
+Local query socket of the daemon: a UNIX stream socket taking one command
+per line, answered like the firmware's commands with any output lines and
+then OK or ERR.
+
+    LIST                one CSV line per bench: name, port, connection,
+                        run state, frame counters and runs
+    LATEST name         the bench's latest sample in the run file columns
+    STATUS name         counters, clock offset and acquisition settings
+    SEND name command   forward a command line to the bench, e.g. THR 40
+
+Any number of clients are served from one thread with epoll; a client that
+stops reading only grows its own output buffer.
+*/
+class QueryServer {
+public:
+    explicit QueryServer(const std::vector<Bench*>& benches);
+    ~QueryServer();
+
+    bool listen(const std::string& path);
+    void run(const std::atomic<bool>& stop);
+
+private:
+    struct Client {
+        std::string input;
+        std::string output;
+    };
+
+    void accept();
+    bool receive(int fd, Client& client);
+    bool flush(int fd, Client& client);
+    bool execute(const std::string& line, std::string& out);
+    Bench* find(const std::string& name) const;
+
+    std::vector<Bench*> benches;
+    std::map<int, Client> clients;
+    std::string socketPath;
+    int listenFd;
+    int epollFd;
+};
+
+#endif
@@ -0,0 +1,195 @@
+/*
+benchd: records the telemetry of several test benches at once.
+
+    benchd [-d directory] [-q socket] [-b baud] [-s rate] [-j threads]
+           [-t tail_s] [-p preroll_s] [name=]port ...
+
+Each port is a bench's serial device (or a pseudo-terminal of benchd-sim),
+named after the device unless a name is given. The benches are spread over
+at most one worker thread per core (-j, default the number of cores); a
+worker waits on all of its ports with one epoll set and only wakes up for
+data, so a worker easily keeps up with many benches at the full line rate.
+Ports that can not be opened or go away are retried every second.
+
+On open a bench is asked for its sample frames with STREAM rate (-s, 100
+by default, 0 to leave the bench as it is); the request is repeated until
+samples arrive, as opening an Uno's port resets it. Runs are written to
+directory/name/ (-d, default runs), see Bench.h, and the query socket (-q,
+default /tmp/benchd.sock) is described in QueryServer.h. SIGINT or SIGTERM
+close the open runs and print the frame counters of every bench.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "Bench.h"
+#include "QueryServer.h"
+
+#define WORKER_EVENTS       64
+#define WORKER_WAIT_MS      200     // Longest wait before the stop flag is checked
+#define WORKER_TICK_US      1000000 // Retries, stream requests and run file flushes
+
+static std::atomic<bool> stopRequested(false);
+
+static void onSignal(int) {
+    stopRequested = true;
+}
+
+struct Worker {
+    std::vector<Bench*> benches;
+    std::thread thread;
+};
+
+static void addPort(int epollFd, Bench* bench) {
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = bench;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, bench->fd(), &event) != 0) {
+        bench->close();
+    }
+}
+
+// Owns its benches: nothing of a bench but its snapshot and send() is touched by another thread
+static void runWorker(Worker& worker) {
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        perror("epoll_create1");
+        stopRequested = true;
+        return;
+    }
+    epoll_event events[WORKER_EVENTS];
+    int64_t nextTick = 0;
+
+    while (!stopRequested) {
+        int count = epoll_wait(epollFd, events, WORKER_EVENTS, WORKER_WAIT_MS);
+        for (int i = 0; i < count; i++) {
+            Bench* bench = (Bench*)events[i].data.ptr;
+            if (!bench->poll()) {
+                fprintf(stderr, "%s: %s closed\n", bench->name().c_str(), bench->port().c_str());
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, bench->fd(), NULL);
+                bench->close();
+            }
+        }
+
+        int64_t now = hostMicros();
+        if (now < nextTick) {
+            continue;
+        }
+        nextTick = now + WORKER_TICK_US;
+        for (Bench* bench : worker.benches) {
+            if (bench->fd() < 0 && bench->open()) {
+                addPort(epollFd, bench);
+            }
+            bench->tick(now);
+        }
+    }
+
+    for (Bench* bench : worker.benches) {
+        bench->close();
+    }
+    close(epollFd);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: benchd [-d directory] [-q socket] [-b baud] [-s rate] [-j threads]\n"
+                    "              [-t tail_s] [-p preroll_s] [name=]port ...\n");
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    options.directory = "runs";
+    options.baud = 115200;
+    options.streamRate = 100;
+    options.runTailUs = 2000000;
+    options.preRollUs = 1000000;
+    std::string socketPath = "/tmp/benchd.sock";
+    unsigned threads = std::max(1U, std::thread::hardware_concurrency());
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:q:b:s:j:t:p:h")) != -1) {
+        switch (opt) {
+        case 'd':
+            options.directory = optarg;
+            break;
+        case 'q':
+            socketPath = optarg;
+            break;
+        case 'b':
+            options.baud = strtol(optarg, NULL, 10);
+            break;
+        case 's':
+            options.streamRate = atoi(optarg);
+            break;
+        case 'j':
+            threads = std::max(1, atoi(optarg));
+            break;
+        case 't':
+            options.runTailUs = (int64_t)(atof(optarg) * 1000000);
+            break;
+        case 'p':
+            options.preRollUs = (int64_t)(atof(optarg) * 1000000);
+            break;
+        default:
+            usage();
+            return 2;
+        }
+    }
+    if (optind == argc) {
+        usage();
+        return 2;
+    }
+
+    std::vector<Bench*> benches;
+    for (int i = optind; i < argc; i++) {
+        std::string argument = argv[i];
+        size_t equals = argument.find('=');
+        std::string port = equals == std::string::npos ? argument : argument.substr(equals + 1);
+        std::string name = equals == std::string::npos ? port.substr(port.rfind('/') + 1) : argument.substr(0, equals);
+        benches.push_back(new Bench(name, port, options));
+    }
+
+    QueryServer server(benches);
+    if (!server.listen(socketPath)) {
+        fprintf(stderr, "%s: %s\n", socketPath.c_str(), strerror(errno));
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Round robin, so the benches of a worker are as many as the others' or one more
+    std::vector<Worker> workers(std::min<size_t>(threads, benches.size()));
+    for (size_t i = 0; i < benches.size(); i++) {
+        workers[i % workers.size()].benches.push_back(benches[i]);
+    }
+    for (Worker& worker : workers) {
+        worker.thread = std::thread(runWorker, std::ref(worker));
+    }
+
+    server.run(stopRequested);
+    for (Worker& worker : workers) {
+        worker.thread.join();
+    }
+
+    for (Bench* bench : benches) {
+        BenchSnapshot s = bench->snapshot();
+        fprintf(stderr, "%s frames=%llu lost=%llu crc_errors=%llu skipped_bytes=%llu runs=%u\n", bench->name().c_str(),
+            (unsigned long long)s.frames, (unsigned long long)s.lostFrames, (unsigned long long)s.crcErrors,
+            (unsigned long long)s.skippedBytes, s.runs);
+        delete bench;
+    }
+    return 0;
+}
@@ -0,0 +1,422 @@
+/*
+benchd-sim: simulated benches on pseudo-terminals, to run benchd without
+hardware.
+
+    benchd-sim [-n benches] [-l directory] [-r rate] [-t seconds] [-e]
+
+Creates n pseudo-terminals (-n, default 16) linked as directory/bench00,
+bench01, ... (-l, default /tmp/benches). Each one acts like the firmware on
+its serial port: STREAM rate|ALL|OFF is answered with OK and any other
+command with ERR, and while streaming it sends a status frame every second
+and the samples in delta coded batches, like the firmware: a sample goes
+out on every ADC block the rate asks for, and a batch once the next sample
+does not fit it or 50ms after its first sample. Rates up to 1000 samples a
+second are sent as asked, beyond the ~290 ADC blocks a second that bound the
+firmware's stream, by running the blocks at the rate to measure headroom;
+ALL sends a sample every block. With -e a bench streams at -r (100)
+from the start, like a firmware built with EXPORT_VALUES.
+
+Every bench runs a throttle ramp up and down every 30s, offset from the
+others. Their clocks start at random values and are off by up to 0.5%, so
+the daemon's clock alignment has something to do. A frame that does not
+fit the pseudo-terminal's buffer is dropped and counted, like on the bench.
+Runs until -t seconds have passed or SIGINT, then prints the frames sent
+and dropped per bench.
+*/
+
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "TelemetryProtocol.h"
+
+#define SIM_STEP_US         1000
+#define SIM_RATE_MAX        1000
+#define SIM_BLOCK_RATE      291     // STREAM ALL, the firmware's blocks per second with 16 pairs
+#define SIM_CYCLE_US        30000000LL
+#define SIM_SKEW_PPM        5000
+#define SIM_BATCH_US        50000   // TELEMETRY_BATCH_US of the firmware
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int) {
+    stopRequested = 1;
+}
+
+struct SimBench {
+    std::string link;
+    int master;
+    int slave;          // Held open so the pseudo-terminal survives the daemon closing it
+    uint32_t clockStart;
+    long skewPpm;
+    int rate;           // Samples a second, 0 when not streaming
+    int blockRate;      // ADC blocks a second, the rate when it is higher
+    int64_t streamStart;
+    uint64_t streamBlocks;
+    int streamPhase;
+    uint8_t sampleBlocks;   // Blocks since the last sample
+    int64_t nextStatus;
+    uint8_t seq;
+    uint64_t frames;
+    uint64_t dropped;
+    double consumption; // mAh
+    int64_t lastSample;
+    // The open sample batch as in src/Telemetry.cpp, batchLength is 0 when there is none
+    uint8_t batch[TELEMETRY_BATCH_PAYLOAD];
+    uint8_t batchLength;
+    uint8_t batchBlocks;
+    uint32_t batchLast;
+    int64_t batchStart;
+    TelemetrySample batchPrevious;
+    std::string input;
+};
+
+static int64_t monotonicMicros() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// micros() of the bench at elapsed us of the simulation
+static uint32_t benchMicros(const SimBench& bench, int64_t elapsed) {
+    return bench.clockStart + (uint32_t)(elapsed + elapsed * bench.skewPpm / 1000000);
+}
+
+// Like telemetrySendFrame(): the sequence number counts dropped frames too
+static void sendFrame(SimBench& bench, uint8_t type, const uint8_t* payload, uint8_t length) {
+    uint8_t frame[TELEMETRY_HEADER_SIZE + TELEMETRY_MAX_PAYLOAD + 1];
+    uint8_t size = TELEMETRY_HEADER_SIZE + length + 1;
+    frame[0] = TELEMETRY_SYNC;
+    frame[1] = type;
+    frame[2] = length;
+    frame[3] = bench.seq++;
+    memcpy(frame + TELEMETRY_HEADER_SIZE, payload, length);
+    uint8_t crc = 0;
+    for (uint8_t i = 1; i < size - 1; i++) {
+        crc = telemetryCrc8(crc, frame[i]);
+    }
+    frame[size - 1] = crc;
+
+    if (write(bench.master, frame, size) == size) {
+        bench.frames++;
+    }
+    else {
+        bench.dropped++;
+    }
+}
+
+// Sends the open batch, a batch of one sample as a TELEMETRY_SAMPLE frame
+static void flushBatch(SimBench& bench) {
+    if (bench.batchLength == 0) {
+        return;
+    }
+    if (bench.batchBlocks == 0) {
+        sendFrame(bench, TELEMETRY_SAMPLE, bench.batch, TELEMETRY_SAMPLE_SIZE);
+    }
+    else {
+        telemetryPut16(bench.batch + TELEMETRY_SAMPLE_SIZE, (uint16_t)(bench.batchLast - telemetryGet32(bench.batch)));
+        sendFrame(bench, TELEMETRY_SAMPLE_BATCH, bench.batch, bench.batchLength);
+    }
+    bench.batchLength = 0;
+}
+
+// Adds an entry for sample to the open batch, false when it does not fit
+static bool batchAppend(SimBench& bench, const TelemetrySample& sample, uint8_t blocks) {
+    if (blocks == 0 || blocks > TELEMETRY_BATCH_BLOCKS_MAX || bench.batchBlocks + blocks > 0xFF
+            || sample.timestamp - telemetryGet32(bench.batch) > 0xFFFF) {
+        return false;
+    }
+    const TelemetrySample& previous = bench.batchPrevious;
+    int deltas[TELEMETRY_BATCH_FIELDS] = {
+        sample.throttle - previous.throttle,
+        sample.voltage - previous.voltage,
+        sample.current - previous.current,
+        sample.power - previous.power,
+        sample.consumption - previous.consumption,
+        sample.thrust - previous.thrust
+    };
+    uint8_t entry[1 + TELEMETRY_BATCH_FIELDS];
+    uint8_t length = 1;
+    entry[0] = (uint8_t)((blocks - 1) << TELEMETRY_BATCH_BLOCKS_SHIFT);
+    for (int i = 0; i < TELEMETRY_BATCH_FIELDS; i++) {
+        if (deltas[i] == 0) {
+            continue;
+        }
+        if (deltas[i] < -128 || deltas[i] > 127) {
+            return false;
+        }
+        entry[0] |= 1 << i;
+        entry[length++] = (uint8_t)deltas[i];
+    }
+    if (bench.batchLength + length > TELEMETRY_BATCH_PAYLOAD) {
+        return false;
+    }
+    memcpy(bench.batch + bench.batchLength, entry, length);
+    bench.batchLength += length;
+    bench.batchBlocks += blocks;
+    bench.batchLast = sample.timestamp;
+    bench.batchPrevious = sample;
+    return true;
+}
+
+static void sendSample(SimBench& bench, int64_t elapsed, int index, uint8_t blocks) {
+    int64_t position = (elapsed + index * SIM_CYCLE_US / 7) % SIM_CYCLE_US;
+    int throttle = TELEMETRY_THROTTLE_IDLE;
+    if (position >= 6000000 && position < 26000000) {   // 10s up, 10s down
+        double ramp = (position - 6000000) / 20000000.0;
+        throttle = (int)lround(100 * (1 - fabs(2 * ramp - 1)));
+    }
+    double load = throttle > 0 ? throttle / 100.0 : 0;
+    double current = 40 * load * load + 0.05 * (rand() % 3);
+    double voltage = 16.8 - 0.02 * current;
+    bench.consumption += current * (elapsed - bench.lastSample) / 3600000.0;
+    bench.lastSample = elapsed;
+
+    TelemetrySample sample;
+    sample.timestamp = benchMicros(bench, elapsed);
+    sample.throttle = (int8_t)throttle;
+    sample.voltage = (uint16_t)lround(voltage * 100);
+    sample.current = (uint16_t)lround(current * 100);
+    sample.power = (uint16_t)lround(voltage * current * 10);
+    sample.consumption = (uint16_t)bench.consumption;
+    sample.thrust = (int16_t)lround(2500 * pow(load, 1.5)) + rand() % 3 - 1;
+    if (bench.batchLength > 0 && batchAppend(bench, sample, blocks)) {
+        return;
+    }
+    flushBatch(bench);
+
+    telemetryEncodeSample(sample, bench.batch);
+    bench.batchLength = TELEMETRY_BATCH_HEADER_SIZE;
+    bench.batchBlocks = 0;
+    bench.batchLast = sample.timestamp;
+    bench.batchStart = elapsed;
+    bench.batchPrevious = sample;
+}
+
+// One ADC block at elapsed us, taken for a sample like streamBlock() of the firmware does
+static void streamBlock(SimBench& bench, int64_t elapsed, int index) {
+    if (bench.sampleBlocks < 0xFF) {
+        bench.sampleBlocks++;
+    }
+    bench.streamPhase += bench.rate;
+    if (bench.streamPhase < bench.blockRate) {
+        return;
+    }
+    bench.streamPhase -= bench.blockRate;
+    sendSample(bench, elapsed, index, bench.sampleBlocks);
+    bench.sampleBlocks = 0;
+}
+
+static void sendStatus(SimBench& bench, int64_t elapsed) {
+    TelemetryStatus status;
+    status.timestamp = benchMicros(bench, elapsed);
+    status.adcBits = 12;
+    status.blockSamples = 16;
+    status.blockRate = 2913;
+    status.currentStep = 30517;
+    status.voltageStep = 5393;
+    status.flags = 0;
+    status.adcOverruns = 0;
+    status.dropped = (uint16_t)bench.dropped;
+    uint8_t payload[TELEMETRY_STATUS_SIZE];
+    telemetryEncodeStatus(status, payload);
+    sendFrame(bench, TELEMETRY_STATUS, payload, TELEMETRY_STATUS_SIZE);
+}
+
+static void startStream(SimBench& bench, int rate, int64_t elapsed) {
+    flushBatch(bench);
+    bench.rate = rate;
+    bench.blockRate = rate > SIM_BLOCK_RATE ? rate : SIM_BLOCK_RATE;
+    bench.streamStart = elapsed;
+    bench.streamBlocks = 0;
+    bench.streamPhase = 0;
+    bench.sampleBlocks = 0;
+    bench.nextStatus = elapsed;
+    bench.lastSample = elapsed;
+}
+
+static void reply(SimBench& bench, bool ok) {
+    const char* text = ok ? "OK\r\n" : "ERR\r\n";
+    if (write(bench.master, text, strlen(text)) < 0) {
+        bench.dropped++;
+    }
+}
+
+static void readCommands(SimBench& bench, int64_t elapsed) {
+    char chunk[256];
+    ssize_t count;
+    while ((count = read(bench.master, chunk, sizeof(chunk))) > 0) {
+        bench.input.append(chunk, (size_t)count);
+    }
+
+    size_t end;
+    while ((end = bench.input.find('\n')) != std::string::npos) {
+        std::string line = bench.input.substr(0, end);
+        bench.input.erase(0, end + 1);
+        char argument[32];
+        int rate;
+        if (sscanf(line.c_str(), "STREAM %31s", argument) != 1) {
+            reply(bench, false);
+        }
+        else if (strcmp(argument, "OFF") == 0) {
+            flushBatch(bench);
+            bench.rate = 0;
+            reply(bench, true);
+        }
+        else if (strcmp(argument, "ALL") == 0) {
+            startStream(bench, SIM_BLOCK_RATE, elapsed);
+            reply(bench, true);
+        }
+        else if (sscanf(argument, "%d", &rate) == 1 && rate >= 1 && rate <= SIM_RATE_MAX) {
+            startStream(bench, rate, elapsed);
+            reply(bench, true);
+        }
+        else {
+            reply(bench, false);
+        }
+    }
+    if (bench.input.size() > 64) {
+        bench.input.clear();
+    }
+}
+
+static bool openBench(SimBench& bench, const std::string& directory, int index) {
+    bench.master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (bench.master < 0 || grantpt(bench.master) != 0 || unlockpt(bench.master) != 0) {
+        return false;
+    }
+    const char* path = ptsname(bench.master);
+    bench.slave = path != NULL ? open(path, O_RDWR | O_NOCTTY) : -1;
+    termios tty;
+    if (bench.slave < 0 || tcgetattr(bench.slave, &tty) != 0) {
+        return false;
+    }
+    cfmakeraw(&tty);
+    tcsetattr(bench.slave, TCSANOW, &tty);
+    fcntl(bench.master, F_SETFL, fcntl(bench.master, F_GETFL) | O_NONBLOCK);
+
+    char name[16];
+    snprintf(name, sizeof(name), "bench%02d", index);
+    bench.link = directory + "/" + name;
+    unlink(bench.link.c_str());
+    if (symlink(path, bench.link.c_str()) != 0) {
+        return false;
+    }
+    printf("%s %s\n", bench.link.c_str(), path);
+    return true;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: benchd-sim [-n benches] [-l directory] [-r rate] [-t seconds] [-e]\n");
+}
+
+int main(int argc, char** argv) {
+    int count = 16;
+    std::string directory = "/tmp/benches";
+    int rate = 100;
+    double duration = 0;
+    bool streaming = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:r:t:eh")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'l':
+            directory = optarg;
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 't':
+            duration = atof(optarg);
+            break;
+        case 'e':
+            streaming = true;
+            break;
+        default:
+            usage();
+            return 2;
+        }
+    }
+    if (count < 1 || rate < 1 || rate > SIM_RATE_MAX) {
+        usage();
+        return 2;
+    }
+
+    mkdir(directory.c_str(), 0755);
+    srand(1);
+    std::vector<SimBench> benches(count);
+    for (int i = 0; i < count; i++) {
+        SimBench& bench = benches[i];
+        if (!openBench(bench, directory, i)) {
+            fprintf(stderr, "bench%02d: %s\n", i, strerror(errno));
+            return 1;
+        }
+        bench.clockStart = (uint32_t)rand();
+        bench.skewPpm = rand() % (2 * SIM_SKEW_PPM + 1) - SIM_SKEW_PPM;
+        if (streaming) {
+            startStream(bench, rate, 0);
+        }
+    }
+    fflush(stdout);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    int64_t start = monotonicMicros();
+    int64_t end = duration > 0 ? (int64_t)(duration * 1000000) : INT64_MAX;
+    timespec wake;
+    clock_gettime(CLOCK_MONOTONIC, &wake);
+    for (int64_t elapsed = 0; !stopRequested && elapsed < end; elapsed = monotonicMicros() - start) {
+        for (int i = 0; i < count; i++) {
+            SimBench& bench = benches[i];
+            readCommands(bench, elapsed);
+            if (bench.rate == 0) {
+                continue;
+            }
+            if (elapsed >= bench.nextStatus) {
+                bench.nextStatus += 1000000;
+                sendStatus(bench, elapsed);
+            }
+            if (bench.batchLength > 0 && elapsed - bench.batchStart >= SIM_BATCH_US) {
+                flushBatch(bench);
+            }
+            // Blocks stay on their own grid when a step comes late
+            int64_t block;
+            while ((block = bench.streamStart + (int64_t)(bench.streamBlocks * 1000000 / bench.blockRate)) <= elapsed) {
+                streamBlock(bench, block, i);
+                bench.streamBlocks++;
+            }
+        }
+
+        wake.tv_nsec += SIM_STEP_US * 1000;
+        if (wake.tv_nsec >= 1000000000) {
+            wake.tv_nsec -= 1000000000;
+            wake.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+    }
+
+    for (SimBench& bench : benches) {
+        fprintf(stderr, "%s frames=%llu dropped=%llu\n", bench.link.c_str(), (unsigned long long)bench.frames,
+            (unsigned long long)bench.dropped);
+        unlink(bench.link.c_str());
+        close(bench.slave);
+        close(bench.master);
+    }
+    return 0;
+}
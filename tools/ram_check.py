@@ -0,0 +1,34 @@
+# PlatformIO post script: fails the AVR build when the static RAM leaves too
+# little for the stack. The ATmega328P has 2048 bytes; .data and .bss are
+# placed from the bottom, the stack grows down from the top and nothing in
+# the firmware uses the heap. The deepest call chain, the acquisition task
+# flushing a telemetry frame, plus an interrupt on top of it, is estimated
+# at under 300 bytes; the reserve leaves some margin over that.
+#
+#   extra_scripts = post:tools/ram_check.py
+
+import subprocess
+
+Import("env")
+
+RAM_SIZE = 2048
+STACK_RESERVE = 320
+
+
+def ram_check(source, target, env):
+    elf = str(source[0])
+    size_tool = env.subst("$SIZETOOL") or "avr-size"
+    output = subprocess.check_output([size_tool, "-A", elf]).decode()
+    used = 0
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0] in (".data", ".bss", ".noinit"):
+            used += int(fields[1])
+    budget = RAM_SIZE - STACK_RESERVE
+    print("Static RAM: %d of %d bytes, %d left for the stack" % (used, RAM_SIZE, RAM_SIZE - used))
+    if used > budget:
+        print("Error: static RAM above %d bytes, the stack needs %d" % (budget, STACK_RESERVE))
+        env.Exit(1)
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", ram_check)
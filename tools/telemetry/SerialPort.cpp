@@ -0,0 +1,38 @@
+#include "SerialPort.h"
+
+#include <cstdio>
+#include <termios.h>
+
+static speed_t baudConstant(long baud) {
+    switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 1000000: return B1000000;
+    default: return 0;
+    }
+}
+
+bool configureSerial(int fd, long baud) {
+    termios tty;
+    if (tcgetattr(fd, &tty) != 0) {
+        return false;
+    }
+    cfmakeraw(&tty);
+    speed_t speed = baudConstant(baud);
+    if (speed == 0) {
+        fprintf(stderr, "unsupported baud rate %ld\n", baud);
+        return false;
+    }
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cc[VMIN] = 1;
+    tty.c_cc[VTIME] = 0;
+    return tcsetattr(fd, TCSANOW, &tty) == 0;
+}
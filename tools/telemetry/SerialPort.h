@@ -0,0 +1,10 @@
+#ifndef SERIAL_PORT_H
+#define SERIAL_PORT_H
+
+/*
+Raw mode setup of a host serial port for the telemetry tools: 8N1, no flow
+control, no line editing or echo, reads return whatever has arrived.
+*/
+bool configureSerial(int fd, long baud);
+
+#endif
@@ -0,0 +1,147 @@
+#include "TelemetryDecoder.h"
+
+TelemetryDecoder::TelemetryDecoder() {
+    reset();
+}
+
+void TelemetryDecoder::reset() {
+    buffer.clear();
+    counters = TelemetryDecoderStats();
+    haveSequence = false;
+    lastSequence = 0;
+}
+
+void TelemetryDecoder::feed(const uint8_t* data, size_t size, const FrameHandler& handler) {
+    buffer.insert(buffer.end(), data, data + size);
+
+    size_t pos = 0;
+    while (pos < buffer.size()) {
+        if (buffer[pos] != TELEMETRY_SYNC) {
+            pos++;
+            counters.skippedBytes++;
+            continue;
+        }
+        if (buffer.size() - pos < TELEMETRY_HEADER_SIZE) {
+            break;  // Wait for the rest of the header
+        }
+
+        uint8_t length = buffer[pos + 2];
+        if (length > TELEMETRY_MAX_PAYLOAD) {   // Not a real sync byte
+            pos++;
+            counters.skippedBytes++;
+            continue;
+        }
+        size_t frameSize = TELEMETRY_HEADER_SIZE + length + 1;
+        if (buffer.size() - pos < frameSize) {
+            break;
+        }
+
+        uint8_t crc = 0;
+        for (size_t i = 1; i < frameSize - 1; i++) {
+            crc = telemetryCrc8(crc, buffer[pos + i]);
+        }
+        if (crc != buffer[pos + frameSize - 1]) {
+            counters.crcErrors++;
+            counters.skippedBytes++;
+            pos++;
+            continue;
+        }
+
+        TelemetryFrame frame;
+        frame.type = buffer[pos + 1];
+        frame.length = length;
+        frame.seq = buffer[pos + 3];
+        frame.payload = &buffer[pos + TELEMETRY_HEADER_SIZE];
+
+        if (haveSequence) {
+            counters.lostFrames += (uint8_t)(frame.seq - lastSequence - 1);
+        }
+        haveSequence = true;
+        lastSequence = frame.seq;
+        counters.frames++;
+
+        handler(frame);
+        pos += frameSize;
+    }
+
+    buffer.erase(buffer.begin(), buffer.begin() + pos);
+}
+
+uint64_t TimestampUnwrapper::unwrap(uint32_t timestamp) {
+    if (started && timestamp < last && last - timestamp > 0x80000000UL) {
+        high += 0x100000000ULL;
+    }
+    started = true;
+    last = timestamp;
+    return high + timestamp;
+}
+
+static SampleRecord toRecord(const TelemetrySample& sample, uint64_t timestamp, uint8_t seq) {
+    SampleRecord record;
+    record.timestamp = timestamp;
+    record.seq = seq;
+    record.throttle = sample.throttle;
+    record.voltage = sample.voltage / 100.0;
+    record.current = sample.current / 100.0;
+    record.power = sample.power / 10.0;
+    record.consumption = sample.consumption;
+    record.thrust = sample.thrust;
+    return record;
+}
+
+/*
+Replaces records with the samples of a sample frame, oldest first, and
+returns how many there are; 0 for other frames and for batches whose
+entries run past the payload.
+*/
+size_t decodeSampleFrame(const TelemetryFrame& frame, TimestampUnwrapper& clock, std::vector<SampleRecord>& records) {
+    records.clear();
+    if (frame.type == TELEMETRY_SAMPLE && frame.length >= TELEMETRY_SAMPLE_SIZE) {
+        TelemetrySample sample;
+        telemetryDecodeSample(frame.payload, sample);
+        records.push_back(toRecord(sample, clock.unwrap(sample.timestamp), frame.seq));
+        return 1;
+    }
+    if (frame.type != TELEMETRY_SAMPLE_BATCH || frame.length < TELEMETRY_BATCH_HEADER_SIZE) {
+        return 0;
+    }
+
+    // Total blocks first, the time stamps are spread over the span in proportion to them
+    unsigned blocks = 0;
+    for (size_t pos = TELEMETRY_BATCH_HEADER_SIZE; pos < frame.length; ) {
+        uint8_t flags = frame.payload[pos++];
+        blocks += (flags >> TELEMETRY_BATCH_BLOCKS_SHIFT) + 1;
+        for (int field = 0; field < TELEMETRY_BATCH_FIELDS; field++) {
+            pos += (flags >> field) & 1;
+        }
+        if (pos > frame.length) {
+            return 0;
+        }
+    }
+
+    TelemetrySample sample;
+    telemetryDecodeSample(frame.payload, sample);
+    uint64_t start = clock.unwrap(sample.timestamp);
+    uint16_t span = telemetryGet16(frame.payload + TELEMETRY_SAMPLE_SIZE);
+    records.push_back(toRecord(sample, start, frame.seq));
+
+    unsigned blocksSoFar = 0;
+    for (size_t pos = TELEMETRY_BATCH_HEADER_SIZE; pos < frame.length; ) {
+        uint8_t flags = frame.payload[pos++];
+        int16_t deltas[TELEMETRY_BATCH_FIELDS];
+        for (int field = 0; field < TELEMETRY_BATCH_FIELDS; field++) {
+            deltas[field] = (flags >> field) & 1 ? (int8_t)frame.payload[pos++] : 0;
+        }
+        sample.throttle = (int8_t)(sample.throttle + deltas[0]);
+        sample.voltage = (uint16_t)(sample.voltage + deltas[1]);
+        sample.current = (uint16_t)(sample.current + deltas[2]);
+        sample.power = (uint16_t)(sample.power + deltas[3]);
+        sample.consumption = (uint16_t)(sample.consumption + deltas[4]);
+        sample.thrust = (int16_t)(sample.thrust + deltas[5]);
+        blocksSoFar += (flags >> TELEMETRY_BATCH_BLOCKS_SHIFT) + 1;
+        uint64_t timestamp = start + (uint64_t)span * blocksSoFar / blocks;
+        sample.timestamp = (uint32_t)timestamp;
+        records.push_back(toRecord(sample, clock.unwrap(sample.timestamp), frame.seq));
+    }
+    return records.size();
+}
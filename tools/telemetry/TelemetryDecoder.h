@@ -0,0 +1,80 @@
+#ifndef TELEMETRY_DECODER_H
+#define TELEMETRY_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "TelemetryProtocol.h"
+
+/*
+Host side parser for the firmware telemetry stream (see
+include/TelemetryProtocol.h). Bytes can be fed in arbitrary chunks; complete
+frames with a valid CRC are passed to the handler, everything else is
+skipped and counted.
+*/
+
+struct TelemetryFrame {
+    uint8_t type;
+    uint8_t seq;
+    uint8_t length;
+    const uint8_t* payload;
+};
+
+struct TelemetryDecoderStats {
+    uint64_t frames;
+    uint64_t crcErrors;
+    uint64_t lostFrames;        // Gaps in the sequence numbers
+    uint64_t skippedBytes;      // Bytes outside of a valid frame
+};
+
+class TelemetryDecoder {
+public:
+    typedef std::function<void(const TelemetryFrame&)> FrameHandler;
+
+    TelemetryDecoder();
+    void feed(const uint8_t* data, size_t size, const FrameHandler& handler);
+    void reset();
+    const TelemetryDecoderStats& stats() const { return counters; }
+
+private:
+    std::vector<uint8_t> buffer;
+    TelemetryDecoderStats counters;
+    bool haveSequence;
+    uint8_t lastSequence;
+};
+
+/*
+Extends the 32 bit microsecond time stamps of the firmware to 64 bits.
+Assumes consecutive frames are less than ~35 minutes apart.
+*/
+class TimestampUnwrapper {
+public:
+    TimestampUnwrapper() : started(false), last(0), high(0) {}
+    uint64_t unwrap(uint32_t timestamp);
+    void reset() { started = false; high = 0; }
+
+private:
+    bool started;
+    uint32_t last;
+    uint64_t high;
+};
+
+/*
+A sample of a TELEMETRY_SAMPLE or TELEMETRY_SAMPLE_BATCH frame in
+engineering units.
+*/
+struct SampleRecord {
+    uint64_t timestamp;     // us since the first frame's clock origin
+    uint8_t seq;
+    int throttle;           // %, -1 when idle
+    double voltage;         // V
+    double current;         // A
+    double power;           // W
+    unsigned consumption;   // mAh
+    int thrust;             // g
+};
+
+size_t decodeSampleFrame(const TelemetryFrame& frame, TimestampUnwrapper& clock, std::vector<SampleRecord>& records);
+
+#endif
@@ -0,0 +1,256 @@
+/*
+telemetry-decode: converts the binary telemetry stream of the test bench to
+CSV or to a directory of column files.
+
+    telemetry-decode [-f csv|columns] [-o output] [-b baud] [input]
+
+input is a capture file or a serial device (configured raw at -b baud,
+default 115200); stdin when omitted. CSV goes to stdout unless -o is given.
+The columns format writes one little endian array per field into the -o
+directory plus schema.txt describing type, scale and unit of each column.
+*/
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "SerialPort.h"
+#include "TelemetryDecoder.h"
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int) {
+    stopRequested = 1;
+}
+
+class SampleWriter {
+public:
+    virtual ~SampleWriter() {}
+    virtual bool write(const SampleRecord& record) = 0;
+    virtual bool finish() = 0;
+};
+
+class CsvWriter : public SampleWriter {
+public:
+    explicit CsvWriter(FILE* out) : out(out) {
+        fprintf(out, "timestamp_us,seq,throttle_pct,voltage_v,current_a,power_w,consumption_mah,thrust_g\n");
+    }
+
+    bool write(const SampleRecord& r) override {
+        return fprintf(out, "%llu,%u,%d,%.2f,%.2f,%.1f,%u,%d\n", (unsigned long long)r.timestamp, r.seq,
+            r.throttle, r.voltage, r.current, r.power, r.consumption, r.thrust) > 0;
+    }
+
+    bool finish() override {
+        return fflush(out) == 0;
+    }
+
+private:
+    FILE* out;
+};
+
+/*
+Stores the fixed point values exactly as sent; schema.txt carries the scale
+needed to get back to engineering units.
+*/
+class ColumnWriter : public SampleWriter {
+public:
+    explicit ColumnWriter(const std::string& directory) : directory(directory), rows(0), ok(true) {
+        mkdir(directory.c_str(), 0755);
+        for (int i = 0; i < COLUMN_COUNT; i++) {
+            files[i] = fopen((directory + "/" + columns[i].name + ".bin").c_str(), "wb");
+            ok = ok && files[i] != NULL;
+        }
+    }
+
+    ~ColumnWriter() {
+        for (int i = 0; i < COLUMN_COUNT; i++) {
+            if (files[i] != NULL) {
+                fclose(files[i]);
+            }
+        }
+    }
+
+    bool isOpen() const { return ok; }
+
+    bool write(const SampleRecord& r) override {
+        int64_t timestamp = (int64_t)r.timestamp;
+        uint8_t seq = r.seq;
+        int8_t throttle = (int8_t)r.throttle;
+        uint16_t voltage = (uint16_t)(r.voltage * 100 + 0.5);
+        uint16_t current = (uint16_t)(r.current * 100 + 0.5);
+        uint16_t power = (uint16_t)(r.power * 10 + 0.5);
+        uint16_t consumption = (uint16_t)r.consumption;
+        int16_t thrust = (int16_t)r.thrust;
+
+        const void* values[COLUMN_COUNT] = { &timestamp, &seq, &throttle, &voltage, &current, &power, &consumption, &thrust };
+        for (int i = 0; i < COLUMN_COUNT; i++) {
+            if (fwrite(values[i], columns[i].size, 1, files[i]) != 1) {
+                return false;
+            }
+        }
+        rows++;
+        return true;
+    }
+
+    bool finish() override {
+        FILE* schema = fopen((directory + "/schema.txt").c_str(), "w");
+        if (schema == NULL) {
+            return false;
+        }
+        fprintf(schema, "rows %llu\n", (unsigned long long)rows);
+        fprintf(schema, "# column file type scale unit\n");
+        for (int i = 0; i < COLUMN_COUNT; i++) {
+            fprintf(schema, "%s %s.bin %s %s %s\n", columns[i].name, columns[i].name, columns[i].type, columns[i].scale, columns[i].unit);
+            fflush(files[i]);
+        }
+        return fclose(schema) == 0;
+    }
+
+private:
+    struct Column {
+        const char* name;
+        const char* type;
+        size_t size;
+        const char* scale;
+        const char* unit;
+    };
+    static const int COLUMN_COUNT = 8;
+    const Column columns[COLUMN_COUNT] = {
+        { "timestamp", "int64", 8, "1", "us" },
+        { "seq", "uint8", 1, "1", "-" },
+        { "throttle", "int8", 1, "1", "%" },
+        { "voltage", "uint16", 2, "0.01", "V" },
+        { "current", "uint16", 2, "0.01", "A" },
+        { "power", "uint16", 2, "0.1", "W" },
+        { "consumption", "uint16", 2, "1", "mAh" },
+        { "thrust", "int16", 2, "1", "g" },
+    };
+
+    std::string directory;
+    FILE* files[COLUMN_COUNT];
+    uint64_t rows;
+    bool ok;
+};
+
+static void usage() {
+    fprintf(stderr, "usage: telemetry-decode [-f csv|columns] [-o output] [-b baud] [input]\n");
+}
+
+int main(int argc, char** argv) {
+    std::string format = "csv";
+    std::string output;
+    long baud = 115200;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:o:b:h")) != -1) {
+        switch (opt) {
+        case 'f':
+            format = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'b':
+            baud = strtol(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+            return 2;
+        }
+    }
+
+    int fd = STDIN_FILENO;
+    if (optind < argc) {
+        fd = open(argv[optind], O_RDONLY | O_NOCTTY);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+            return 1;
+        }
+    }
+    if (isatty(fd) && !configureSerial(fd, baud)) {
+        fprintf(stderr, "cannot configure serial port: %s\n", strerror(errno));
+        return 1;
+    }
+
+    SampleWriter* writer;
+    FILE* csvFile = NULL;
+    if (format == "csv") {
+        csvFile = output.empty() ? stdout : fopen(output.c_str(), "w");
+        if (csvFile == NULL) {
+            fprintf(stderr, "%s: %s\n", output.c_str(), strerror(errno));
+            return 1;
+        }
+        writer = new CsvWriter(csvFile);
+    }
+    else if (format == "columns" && !output.empty()) {
+        ColumnWriter* columns = new ColumnWriter(output);
+        if (!columns->isOpen()) {
+            fprintf(stderr, "%s: cannot create column files\n", output.c_str());
+            return 1;
+        }
+        writer = columns;
+    }
+    else {
+        usage();
+        return 2;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;   // No SA_RESTART so read() returns on Ctrl-C
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    TelemetryDecoder decoder;
+    TimestampUnwrapper clock;
+    TelemetryStatus lastStatus = TelemetryStatus();
+    std::vector<SampleRecord> records;
+    bool writeFailed = false;
+    uint8_t chunk[4096];
+
+    while (!stopRequested && !writeFailed) {
+        ssize_t count = read(fd, chunk, sizeof(chunk));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        decoder.feed(chunk, (size_t)count, [&](const TelemetryFrame& frame) {
+            decodeSampleFrame(frame, clock, records);
+            for (const SampleRecord& record : records) {
+                if (!writeFailed && !writer->write(record)) {
+                    writeFailed = true;
+                }
+            }
+            if (frame.type == TELEMETRY_STATUS && frame.length >= TELEMETRY_STATUS_SIZE) {
+                TelemetryStatus status;
+                telemetryDecodeStatus(frame.payload, status);
+                if (status.blockSamples != lastStatus.blockSamples || status.flags != lastStatus.flags) {
+                    fprintf(stderr, "acquisition: %u bits, %u samples per block, %.1f blocks/s, %uuA and %uuV per count%s\n",
+                        status.adcBits, status.blockSamples, status.blockRate / 10.0, status.currentStep,
+                        status.voltageStep, status.flags & TELEMETRY_STATUS_SLEEP ? ", sleep" : "");
+                }
+                lastStatus = status;
+            }
+        });
+    }
+
+    bool finished = writer->finish();
+    delete writer;
+    if (csvFile != NULL && csvFile != stdout) {
+        fclose(csvFile);
+    }
+
+    const TelemetryDecoderStats& stats = decoder.stats();
+    fprintf(stderr, "frames=%llu lost=%llu crc_errors=%llu skipped_bytes=%llu\n",
+        (unsigned long long)stats.frames, (unsigned long long)stats.lostFrames,
+        (unsigned long long)stats.crcErrors, (unsigned long long)stats.skippedBytes);
+    return writeFailed || !finished ? 1 : 0;
+}